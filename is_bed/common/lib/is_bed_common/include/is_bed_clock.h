@@ -0,0 +1,64 @@
+#ifndef IS_BED_CLOCK_H
+#define IS_BED_CLOCK_H
+
+#include "is_bed_protocol.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Follows the pattern clock of the controller on the LCD, the way NTP does: the LCD sends its millis() in a
+// time request, the controller answers right away with its own, and the LCD takes it as the controller time
+// in the middle of the round trip. The offset between the two clocks comes from the answer with the shortest
+// round trip among the last IS_BED_CLOCK_SAMPLES ones, the one that waited the least in the serial buffers.
+// The LCD can then animate the patterns in step with the LEDs, without any message per frame.
+
+// Time between two time requests, and until IS_BED_CLOCK_SAMPLES answers were received since the last reset
+#define IS_BED_CLOCK_INTERVAL_MS 1000
+#define IS_BED_CLOCK_FAST_INTERVAL_MS 50
+// Answers the offset is chosen from
+#define IS_BED_CLOCK_SAMPLES 8
+// Answers with a longer round trip are ignored
+#define IS_BED_CLOCK_MAX_RTT_MS 250
+
+// An answer to a time request
+typedef struct {
+    // Pattern clock minus our millis(), and the round trip time of the request
+    int32_t offset_ms;
+    uint32_t rtt_ms;
+} is_bed_clock_sample_t;
+
+// The pattern clock of the controller, as seen from the LCD
+typedef struct {
+    // Whether an answer was received since the last reset, and the offset of the best recent one
+    bool synced;
+    int32_t offset_ms;
+    uint32_t rtt_ms;
+    // The last request, and whether it waits for its answer
+    bool waiting;
+    uint8_t sequence;
+    uint32_t request_ms;
+    // The last answers, the oldest one being replaced
+    is_bed_clock_sample_t samples[IS_BED_CLOCK_SAMPLES];
+    uint8_t num_samples;
+    uint8_t next_sample;
+} is_bed_clock_t;
+
+// Start following the clock. The first request is due right away.
+void is_bed_clock_init(is_bed_clock_t& clock, uint32_t now_ms);
+
+// The controller restarted, its clock with it: forget the answers, and ask again quickly. The offset is
+// kept until the next answer.
+void is_bed_clock_reset(is_bed_clock_t& clock, uint32_t now_ms);
+
+// Build the next time request, if it is due. Returns false if it is not.
+bool is_bed_clock_request(is_bed_clock_t& clock, uint32_t now_ms, is_bed_time_request_t& request);
+
+// Take the answer to the last request into account. Answers to older requests are ignored.
+void is_bed_clock_answer(is_bed_clock_t& clock, uint32_t now_ms, const is_bed_time_t& time);
+
+// The pattern clock of the controller at our now_ms. Until an answer arrives, the offset is 0, or the one
+// from before the last reset.
+static inline uint32_t is_bed_clock_now(const is_bed_clock_t& clock, uint32_t now_ms) {
+    return now_ms + clock.offset_ms;
+}
+
+#endif // IS_BED_CLOCK_H
@@ -0,0 +1,64 @@
+#ifndef IS_BED_LINK_H
+#define IS_BED_LINK_H
+
+#include "is_bed_protocol.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Instruments one side of the link (protocol version 4): numbers and timestamps the messages sent, counts
+// the messages of the other side that are lost, duplicated or late, and measures the round trip time
+// with pings. The counters are sent to the other side, so that both sides can show them.
+
+// Time between two pings, which are also when the counters are sent
+#define IS_BED_LINK_PING_INTERVAL_MS 1000
+// Growth of the gap between two messages on the way above which the second one is late
+#define IS_BED_LINK_LATE_MS 20
+
+// One side of the link
+typedef struct {
+    // Sequence number of the next message sent
+    uint8_t sequence;
+    // Sequence number expected next from the other side, and the time its last message was sent and received,
+    // once a message was received since the last hello
+    bool receiving;
+    uint8_t expected_sequence;
+    uint16_t last_sent_ms;
+    uint32_t last_received_ms;
+    // The last ping, and whether it waits for its pong
+    bool ping_waiting;
+    uint8_t ping_sequence;
+    uint32_t ping_ms;
+    // Sum of the round trip times, for the average
+    uint32_t rtt_total_ms;
+    is_bed_link_stats_t stats;
+} is_bed_link_t;
+
+// Start counting. The first ping is due right away.
+void is_bed_link_init(is_bed_link_t& link, uint32_t now_ms);
+
+// The other side said hello: its sequence numbers start over. This is a reconnect if messages were received
+// since the previous hello, repeated hellos being the same connection.
+void is_bed_link_hello(is_bed_link_t& link);
+
+// Fill the header of a message about to be sent
+void is_bed_link_send(is_bed_link_t& link, uint32_t now_ms, is_bed_link_header_t& header);
+
+// Count a message received with a header. Returns false if it is behind the last message received: a copy,
+// or a message that arrived after newer ones. It must then be ignored, as it could undo what the newer ones did.
+bool is_bed_link_receive(is_bed_link_t& link, uint32_t now_ms, const is_bed_link_header_t& header);
+
+// Count a frame rejected by SerialTransfer: a bad CRC if crc is true, a framing error otherwise
+void is_bed_link_error(is_bed_link_t& link, bool crc);
+
+// Build the next ping, if it is due. Returns false if it is not. A ping that got no pong is counted as lost.
+bool is_bed_link_ping(is_bed_link_t& link, uint32_t now_ms, is_bed_ping_t& ping);
+
+// Measure the round trip time of the pong of the last ping. Pongs of older pings are ignored.
+void is_bed_link_pong(is_bed_link_t& link, uint32_t now_ms, const is_bed_ping_t& pong);
+
+// Write the counters as lines of text, for the serial port and the LCD diagnostics screen.
+// Returns the length of the text, truncated to the size of the buffer.
+size_t is_bed_link_format(const is_bed_link_stats_t& stats, char *buffer, size_t size);
+
+#endif // IS_BED_LINK_H
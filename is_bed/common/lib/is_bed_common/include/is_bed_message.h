@@ -0,0 +1,48 @@
+#ifndef IS_BED_MESSAGE_H
+#define IS_BED_MESSAGE_H
+
+#include "is_bed_protocol.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Messages are read where they were received, in the receive buffer of SerialTransfer, instead of being copied
+// out with rxObj(). A message is checked once against the size of its type, then read through views over the
+// packed structs of is_bed_protocol.h, which have no alignment. The views are valid until the next frame is
+// received.
+
+// A message received
+typedef struct {
+    uint8_t type;
+    // The link header, for the messages that have one (version 4), nullptr otherwise
+    const is_bed_link_header_t *header;
+    // The payload, after the link header
+    const uint8_t *payload;
+    uint16_t size;
+} is_bed_message_t;
+
+// A color of the segment preview, in RGB565, to read the colors in place
+struct [[gnu::packed]] is_bed_preview_color_t {
+    uint16_t rgb565;
+};
+
+// Check a message received: its link header, if has_header is true and its type has one, and the size of its
+// payload for its type. The messages of a fixed size must have that size, and the others must fit their type.
+// Returns false if the message must be ignored, which is also how most frames whose type byte was damaged on
+// the way are caught, the CRC not covering it. The version 1 frames are not checked, their size depends on
+// the direction.
+bool is_bed_message_parse(uint8_t type, const uint8_t *data, uint16_t size, bool has_header, is_bed_message_t& message);
+
+// The payload, checked by is_bed_message_parse() for a message of its type
+template <typename T>
+static inline const T& is_bed_message_view(const is_bed_message_t& message) {
+    return *reinterpret_cast<const T *>(message.payload);
+}
+
+// The count structs that follow a struct at an offset of the payload, or nullptr if the payload ends before
+// the last one
+template <typename T>
+static inline const T *is_bed_message_array(const is_bed_message_t& message, uint16_t offset, uint32_t count) {
+    return offset + count * sizeof(T) <= message.size ? reinterpret_cast<const T *>(message.payload + offset) : nullptr;
+}
+
+#endif // IS_BED_MESSAGE_H
@@ -14,13 +14,73 @@ enum is_bed_pattern_type_t : uint8_t {
     IS_BED_PATTERN_CACHED = 6,
 };
 
+// Value of update_progress when no pattern update is running
+#define IS_BED_UPDATE_NONE 0xFF
+
+// Version of the protocol spoken by this firmware.
+// Version 1 is a single fixed frame in each direction, resent on a timer: is_bed_controller_to_lcd_t
+// and is_bed_lcd_to_controller_t.
+// Version 2 has typed messages, the SerialTransfer packet ID being the message type. The LCD says
+// hello first, and the controller keeps sending version 1 frames until then, so older LCDs keep working.
+// The state of each side is only sent when it changes, as deltas that the other side acknowledges.
+// Version 3 has the same messages, but the state of the LCD (is_bed_lcd_state_t) gives each zone its own
+// pattern, color, palette and frequency, and the state of the controller has the number of palettes.
+// Version 4 instruments the link: every message but the version 1 frames and the hello messages starts with
+// is_bed_link_header_t, and each side pings the other one and sends it its link counters (see is_bed_link.h).
+// Version 5 adds the phase of each zone to the state of the LCD.
+#define IS_BED_PROTOCOL_VERSION 5
+
+// Types of the version 2 messages, used as SerialTransfer packet IDs
+enum is_bed_message_type_t : uint8_t {
+    // A version 1 frame
+    IS_BED_MESSAGE_V1 = 0,
+    // is_bed_hello_t, sent by the LCD until the controller answers with its own
+    IS_BED_MESSAGE_HELLO = 1,
+    // is_bed_catalog_t, controller -> LCD, in answer to IS_BED_MESSAGE_CATALOG_REQUEST
+    IS_BED_MESSAGE_CATALOG = 2,
+    // The changed fields of the state of the sender (see the state messages below)
+    IS_BED_MESSAGE_STATE = 3,
+    // is_bed_preview_t, controller -> LCD
+    IS_BED_MESSAGE_PREVIEW = 4,
+    // is_bed_ack_t, acknowledges a state message
+    IS_BED_MESSAGE_ACK = 5,
+    // is_bed_catalog_request_t, LCD -> controller
+    IS_BED_MESSAGE_CATALOG_REQUEST = 6,
+    // is_bed_ping_t, answered with the same payload in a pong (version 4)
+    IS_BED_MESSAGE_PING = 7,
+    IS_BED_MESSAGE_PONG = 8,
+    // is_bed_link_stats_t, the counters of the sender (version 4)
+    IS_BED_MESSAGE_LINK_STATS = 9,
+    // is_bed_segment_preview_t, controller -> LCD, instead of IS_BED_MESSAGE_PREVIEW for the LCDs that can show it
+    IS_BED_MESSAGE_SEGMENT_PREVIEW = 10,
+    // is_bed_time_request_t, LCD -> controller, answered with is_bed_time_t (see is_bed_clock.h)
+    IS_BED_MESSAGE_TIME_REQUEST = 11,
+    IS_BED_MESSAGE_TIME = 12,
+};
+
+// Largest payload of a SerialTransfer frame
+#define IS_BED_MAX_MESSAGE_SIZE 254
+
+// Capabilities announced in the hello messages. A message that is not in the capabilities of the
+// other side is not sent to it.
+#define IS_BED_CAPABILITY_PREVIEW 0x01
+#define IS_BED_CAPABILITY_UPDATE_PROGRESS 0x02
+#define IS_BED_CAPABILITY_SEGMENT_PREVIEW 0x04
+// The controller answers the time requests. The LCD follows the pattern clock of the controller with them, and
+// animates the patterns that flash (blink and strobe) itself: their previews are sent lit.
+#define IS_BED_CAPABILITY_PATTERN_CLOCK 0x08
+
+// Time between two previews. The LCD redraws its image at that rate.
+#define IS_BED_PREVIEW_INTERVAL_MS 100
+
 struct [[gnu::packed]] color_rgb_t {
     uint8_t r;
     uint8_t g;
     uint8_t b;
 };
 
-// Struct used for controller -> LCD communication
+// Struct used for controller -> LCD communication (version 1). Its layout is frozen: the LCDs that only
+// speak version 1 read exactly these fields, what came later is only in the typed messages.
 struct [[gnu::packed]] is_bed_controller_to_lcd_t {
     // The controller is going to enumerate patterns by sending one at a time.
     // This is the index of the pattern being sent.
@@ -33,7 +93,8 @@ struct [[gnu::packed]] is_bed_controller_to_lcd_t {
     color_rgb_t zone_color[NUM_ZONES];
 };
 
-// Struct used for LCD -> controller communication
+// Struct used for LCD -> controller communication (version 1). Its layout is frozen, like the one of
+// is_bed_controller_to_lcd_t.
 struct [[gnu::packed]] is_bed_lcd_to_controller_t {
     // The index of the currently selected pattern
     uint8_t selected_pattern_index;
@@ -48,4 +109,173 @@ struct [[gnu::packed]] is_bed_lcd_to_controller_t {
     uint8_t frequency;
 };
 
+// State of the LCD in version 2: its version 1 frame, where the pattern, color and frequency apply to all the
+// zones, and the pattern set
+struct [[gnu::packed]] is_bed_lcd_v2_state_t {
+    is_bed_lcd_to_controller_t frame;
+    // The pattern set the pattern indexes refer to. The controller ignores them for any other set.
+    uint8_t pattern_set;
+};
+
+// What a zone plays (version 3)
+struct [[gnu::packed]] is_bed_zone_state_t {
+    // The index of the selected pattern, and of the one displayed on the LCD before it is selected
+    uint8_t selected_pattern_index;
+    uint8_t displayed_pattern_index;
+    // The color of single color patterns, and of the palettes that are composed with it
+    color_rgb_t color;
+    // The palette of palette based patterns, below the number of palettes of the controller state
+    uint8_t palette_index;
+    // The frequency of the pattern. The value in hz is computed as frequency_hz = frequency / 10
+    uint8_t frequency;
+    uint8_t brightness;
+    // The offset of cached patterns in their cycle, in 1/256th of the cycle (version 5)
+    uint8_t phase;
+};
+
+// State of the LCD, sent as deltas from version 3, one field per member of each zone
+struct [[gnu::packed]] is_bed_lcd_state_t {
+    is_bed_zone_state_t zones[NUM_ZONES];
+    // The pattern set the pattern indexes refer to. The controller ignores them for any other set.
+    uint8_t pattern_set;
+};
+
+// State of the controller, sent as deltas from version 2. Version 2 stops at pattern_set.
+struct [[gnu::packed]] is_bed_controller_state_t {
+    // Progress of the pattern update from a USB drive, in percent, or IS_BED_UPDATE_NONE
+    uint8_t update_progress;
+    // Changes each time the controller swaps in a new set of patterns, which invalidates the pattern indexes
+    uint8_t pattern_set;
+    // Number of palettes the zones can use (version 3)
+    uint8_t num_palettes;
+};
+
+// Version 2: what each side can do
+struct [[gnu::packed]] is_bed_hello_t {
+    // IS_BED_PROTOCOL_VERSION of the sender. Both sides use the lowest of the two versions.
+    uint8_t version;
+    // IS_BED_CAPABILITY_* flags
+    uint8_t capabilities;
+};
+
+// Version 2: one entry of the pattern catalog
+struct [[gnu::packed]] is_bed_catalog_entry_t {
+    is_bed_pattern_type_t type;
+    char name[16];
+};
+
+// Version 2: a chunk of the pattern catalog, followed by count is_bed_catalog_entry_t.
+// The controller sends the catalog when the LCD asks for it, one chunk per frame, from the requested
+// entry to the last one. The LCD asks again when the pattern set of the controller state changes.
+struct [[gnu::packed]] is_bed_catalog_t {
+    // The pattern set the catalog describes
+    uint8_t pattern_set;
+    // Number of patterns in the catalog
+    uint8_t num_patterns;
+    // Index of the first entry of the chunk, and number of entries in it
+    uint8_t first_index;
+    uint8_t count;
+};
+
+// Most entries in a catalog chunk
+#define IS_BED_CATALOG_MAX_ENTRIES ((IS_BED_MAX_MESSAGE_SIZE - sizeof(is_bed_catalog_t)) / sizeof(is_bed_catalog_entry_t))
+
+// Version 2: asks for the pattern catalog, from an entry to the last one
+struct [[gnu::packed]] is_bed_catalog_request_t {
+    uint8_t first_index;
+};
+
+// Version 2: the colors shown for each zone on the LCD composite image
+struct [[gnu::packed]] is_bed_preview_t {
+    color_rgb_t zone_color[NUM_ZONES];
+};
+
+// A preview of the output, with one color per LED segment: the average color of the segment before the
+// brightness is applied. It is followed by the colors, in RGB565 (see is_bed_rgb565()), those of the segments
+// of the first zone first, each zone in the order of its segments along the LED strings.
+struct [[gnu::packed]] is_bed_segment_preview_t {
+    // Number of segments of each zone
+    uint8_t num_segments[NUM_ZONES];
+};
+
+// Most segments in a segment preview
+#define IS_BED_PREVIEW_MAX_SEGMENTS 64
+
+// Quantize a color to RGB565, and back. The low bits are filled with the high ones, so that white stays white.
+static inline uint16_t is_bed_rgb565(uint8_t r, uint8_t g, uint8_t b) {
+    return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+}
+
+static inline color_rgb_t is_bed_rgb888(uint16_t rgb565) {
+    const uint8_t r = rgb565 >> 11;
+    const uint8_t g = (rgb565 >> 5) & 0x3F;
+    const uint8_t b = rgb565 & 0x1F;
+    return {(uint8_t)(r << 3 | r >> 2), (uint8_t)(g << 2 | g >> 4), (uint8_t)(b << 3 | b >> 2)};
+}
+
+// Version 2: a state message is a sequence number, which increments with each state message for the
+// acknowledgement, then the mask of the fields of the state it has, little endian, then the value of each
+// of these fields, in the order of the fields. The mask is 16 bits long, or 32 bits for the states that
+// have more than 16 fields (see is_bed_state_sync.h).
+
+// Version 2: acknowledges the state message with this sequence number
+struct [[gnu::packed]] is_bed_ack_t {
+    uint8_t sequence;
+};
+
+// Version 4: the start of every message, except the version 1 frames and the hello messages
+struct [[gnu::packed]] is_bed_link_header_t {
+    // Increments with each message of the sender, for the other side to count the lost messages
+    uint8_t sequence;
+    // millis() of the sender when it sent the message, modulo 65536, for the other side to see the late messages
+    uint16_t time_ms;
+};
+
+// Version 4: asks the other side for a pong with the same payload, to measure the round trip time
+struct [[gnu::packed]] is_bed_ping_t {
+    uint8_t sequence;
+    // millis() of the sender of the ping
+    uint32_t time_ms;
+};
+
+// Asks the controller for its pattern clock: the millis() its patterns are rendered with
+struct [[gnu::packed]] is_bed_time_request_t {
+    uint8_t sequence;
+    // millis() of the LCD when it sent the request
+    uint32_t lcd_ms;
+};
+
+// The answer to a time request: the request, and the pattern clock of the controller when it answered
+struct [[gnu::packed]] is_bed_time_t {
+    is_bed_time_request_t request;
+    uint32_t controller_ms;
+};
+
+// Version 4: the counters of one side of the link, since it started
+struct [[gnu::packed]] is_bed_link_stats_t {
+    // Messages sent and received, with a link header
+    uint32_t sent;
+    uint32_t received;
+    // Messages of the other side that never arrived, and that arrived twice or out of order,
+    // from the sequence numbers of their headers
+    uint32_t dropped;
+    uint32_t duplicated;
+    // Messages whose gap with the previous message grew by more than IS_BED_LINK_LATE_MS on the way,
+    // and the largest such growth
+    uint32_t late;
+    uint16_t max_late_ms;
+    // Frames rejected by SerialTransfer: bad CRC, and bad size, stop byte or timeout
+    uint32_t crc_errors;
+    uint32_t frame_errors;
+    // Times the other side said hello again after messages were exchanged
+    uint32_t reconnects;
+    // Pongs received, pings that got none, and round trip times of the pongs
+    uint32_t pongs;
+    uint32_t pings_lost;
+    uint16_t rtt_last_ms;
+    uint16_t rtt_min_ms;
+    uint16_t rtt_avg_ms;
+    uint16_t rtt_max_ms;
+};
+
 #endif // IS_BED_PROTOCOL_H
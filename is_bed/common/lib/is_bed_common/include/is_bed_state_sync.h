@@ -0,0 +1,84 @@
+#ifndef IS_BED_STATE_SYNC_H
+#define IS_BED_STATE_SYNC_H
+
+#include "is_bed_protocol.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Keeps the state of one side of the link up to date on the other side, by sending only the fields
+// that changed (protocol version 2). The state messages are resent until they are acknowledged.
+// A state message only holds absolute field values, so receiving one twice does no harm.
+
+// Largest state that can be synchronized, in bytes, and most fields in a state
+#define IS_BED_STATE_MAX_SIZE 48
+#define IS_BED_STATE_MAX_FIELDS 32
+// Largest state message: the sequence number, a 32 bit mask and all the fields. It fits in any SerialTransfer frame.
+#define IS_BED_STATE_MESSAGE_MAX_SIZE (1 + 4 + IS_BED_STATE_MAX_SIZE)
+
+// The header of a state message (see is_bed_protocol.h)
+typedef struct {
+    uint8_t sequence;
+    // The fields the message has, one bit per field
+    uint32_t changed;
+} is_bed_state_header_t;
+
+// A field of a state
+typedef struct {
+    uint8_t offset;
+    uint8_t size;
+} is_bed_state_field_t;
+
+// The fields of a state, in the order they are sent. At most IS_BED_STATE_MAX_FIELDS, one per bit of the changed mask.
+typedef struct {
+    const is_bed_state_field_t *fields;
+    uint8_t num_fields;
+    uint8_t size;
+} is_bed_state_layout_t;
+
+// The state of the LCD (is_bed_lcd_state_t) and the state of the controller (is_bed_controller_state_t)
+extern const is_bed_state_layout_t is_bed_lcd_state_layout;
+extern const is_bed_state_layout_t is_bed_controller_state_layout;
+// The state of the LCD in protocol versions 3 and 4, without the phases
+extern const is_bed_state_layout_t is_bed_lcd_v3_state_layout;
+// The same in protocol version 2: the state of the LCD is is_bed_lcd_v2_state_t, and the state of the
+// controller stops at pattern_set
+extern const is_bed_state_layout_t is_bed_lcd_v2_state_layout;
+extern const is_bed_state_layout_t is_bed_controller_v2_state_layout;
+
+// The sending side of a state
+typedef struct {
+    const is_bed_state_layout_t *layout;
+    // The state the other side acknowledged, if it acknowledged one since the last reset
+    bool acked_valid;
+    uint8_t acked[IS_BED_STATE_MAX_SIZE];
+    // The last state message sent, while it is waiting for its acknowledgement
+    bool waiting;
+    uint8_t sequence;
+    uint8_t sent[IS_BED_STATE_MAX_SIZE];
+} is_bed_state_sender_t;
+
+// Start sending a state. The whole state is sent first.
+void is_bed_state_sender_init(is_bed_state_sender_t& sender, const is_bed_state_layout_t& layout);
+
+// Forget what the other side has, for instance after it said hello again: the whole state is sent next.
+void is_bed_state_sender_reset(is_bed_state_sender_t& sender);
+
+// Check if the state changed since the last state message, or since the last acknowledged state if no message
+// is waiting for its acknowledgement
+bool is_bed_state_changed(const is_bed_state_sender_t& sender, const void *state);
+
+// Build the state message that brings the other side up to date, in a buffer of IS_BED_STATE_MESSAGE_MAX_SIZE
+// bytes. Returns its size, or 0 if the other side has the state already, unless heartbeat is true: the message
+// then has no fields. Until the message is acknowledged, the next calls build it again with the changes made since.
+uint8_t is_bed_state_message(is_bed_state_sender_t& sender, const void *state, uint8_t *message, bool heartbeat);
+
+// Record the acknowledgement of a state message
+void is_bed_state_ack(is_bed_state_sender_t& sender, const is_bed_ack_t& ack);
+
+// Apply a received state message to a state. Returns false if the message does not match the layout,
+// the state is then left unchanged, and the message must not be acknowledged. Otherwise the header of the
+// message is copied to header if it is not null, for the acknowledgement and the mask of the changed fields.
+bool is_bed_state_apply(const is_bed_state_layout_t& layout, void *state, const uint8_t *message, uint16_t size,
+                        is_bed_state_header_t *header);
+
+#endif // IS_BED_STATE_SYNC_H
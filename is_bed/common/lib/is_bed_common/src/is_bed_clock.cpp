@@ -0,0 +1,59 @@
+#include "is_bed_clock.h"
+#include <string.h>
+
+void is_bed_clock_init(is_bed_clock_t& clock, uint32_t now_ms) {
+    memset(&clock, 0, sizeof(clock));
+    clock.request_ms = now_ms - IS_BED_CLOCK_INTERVAL_MS;
+}
+
+void is_bed_clock_reset(is_bed_clock_t& clock, uint32_t now_ms) {
+    clock.synced = false;
+    clock.waiting = false;
+    clock.num_samples = 0;
+    clock.next_sample = 0;
+    clock.request_ms = now_ms - IS_BED_CLOCK_INTERVAL_MS;
+}
+
+bool is_bed_clock_request(is_bed_clock_t& clock, uint32_t now_ms, is_bed_time_request_t& request) {
+    const uint32_t interval_ms = clock.num_samples < IS_BED_CLOCK_SAMPLES ? IS_BED_CLOCK_FAST_INTERVAL_MS
+                                                                          : IS_BED_CLOCK_INTERVAL_MS;
+    if (now_ms - clock.request_ms < interval_ms) {
+        return false;
+    }
+    clock.waiting = true;
+    clock.sequence++;
+    clock.request_ms = now_ms;
+    request.sequence = clock.sequence;
+    request.lcd_ms = now_ms;
+    return true;
+}
+
+void is_bed_clock_answer(is_bed_clock_t& clock, uint32_t now_ms, const is_bed_time_t& time) {
+    if (!clock.waiting || time.request.sequence != clock.sequence || time.request.lcd_ms != clock.request_ms) {
+        return;
+    }
+    clock.waiting = false;
+    const uint32_t rtt_ms = now_ms - time.request.lcd_ms;
+    if (rtt_ms > IS_BED_CLOCK_MAX_RTT_MS) {
+        return;
+    }
+    // The controller answered in the middle of the round trip, as far as we can tell
+    is_bed_clock_sample_t& sample = clock.samples[clock.next_sample];
+    sample.offset_ms = (int32_t)(time.controller_ms - time.request.lcd_ms - rtt_ms / 2);
+    sample.rtt_ms = rtt_ms;
+    clock.next_sample = (clock.next_sample + 1) % IS_BED_CLOCK_SAMPLES;
+    if (clock.num_samples < IS_BED_CLOCK_SAMPLES) {
+        clock.num_samples++;
+    }
+    // The shortest round trip is the most symmetric one. The older samples go away, so the offset follows
+    // the drift of the two clocks.
+    const is_bed_clock_sample_t *best = &clock.samples[0];
+    for (uint32_t i = 1; i < clock.num_samples; i++) {
+        if (clock.samples[i].rtt_ms < best->rtt_ms) {
+            best = &clock.samples[i];
+        }
+    }
+    clock.synced = true;
+    clock.offset_ms = best->offset_ms;
+    clock.rtt_ms = best->rtt_ms;
+}
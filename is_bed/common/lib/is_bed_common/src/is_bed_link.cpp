@@ -0,0 +1,116 @@
+#include "is_bed_link.h"
+#include <stdio.h>
+#include <string.h>
+
+void is_bed_link_init(is_bed_link_t& link, uint32_t now_ms) {
+    memset(&link, 0, sizeof(link));
+    link.ping_ms = now_ms - IS_BED_LINK_PING_INTERVAL_MS;
+}
+
+void is_bed_link_hello(is_bed_link_t& link) {
+    if (link.receiving) {
+        link.stats.reconnects++;
+    }
+    link.receiving = false;
+    link.ping_waiting = false;
+}
+
+void is_bed_link_send(is_bed_link_t& link, uint32_t now_ms, is_bed_link_header_t& header) {
+    header.sequence = link.sequence++;
+    header.time_ms = (uint16_t)now_ms;
+    link.stats.sent++;
+}
+
+bool is_bed_link_receive(is_bed_link_t& link, uint32_t now_ms, const is_bed_link_header_t& header) {
+    is_bed_link_stats_t& stats = link.stats;
+    stats.received++;
+    if (link.receiving) {
+        // The sequence numbers wrap around: those behind the expected one are messages received again or late
+        const uint8_t skipped = header.sequence - link.expected_sequence;
+        if (skipped >= 128) {
+            stats.duplicated++;
+            return false;
+        }
+        stats.dropped += skipped;
+        // The clocks of the two sides are not related, but the gaps between two messages are
+        const int32_t growth = (int32_t)(now_ms - link.last_received_ms) - (uint16_t)(header.time_ms - link.last_sent_ms);
+        if (growth > IS_BED_LINK_LATE_MS) {
+            stats.late++;
+        }
+        if (growth > (int32_t)stats.max_late_ms) {
+            stats.max_late_ms = growth > UINT16_MAX ? UINT16_MAX : growth;
+        }
+    }
+    link.receiving = true;
+    link.expected_sequence = header.sequence + 1;
+    link.last_sent_ms = header.time_ms;
+    link.last_received_ms = now_ms;
+    return true;
+}
+
+void is_bed_link_error(is_bed_link_t& link, bool crc) {
+    if (crc) {
+        link.stats.crc_errors++;
+    } else {
+        link.stats.frame_errors++;
+    }
+}
+
+bool is_bed_link_ping(is_bed_link_t& link, uint32_t now_ms, is_bed_ping_t& ping) {
+    if (now_ms - link.ping_ms < IS_BED_LINK_PING_INTERVAL_MS) {
+        return false;
+    }
+    if (link.ping_waiting) {
+        link.stats.pings_lost++;
+    }
+    link.ping_waiting = true;
+    link.ping_sequence++;
+    link.ping_ms = now_ms;
+    ping.sequence = link.ping_sequence;
+    ping.time_ms = now_ms;
+    return true;
+}
+
+void is_bed_link_pong(is_bed_link_t& link, uint32_t now_ms, const is_bed_ping_t& pong) {
+    if (!link.ping_waiting || pong.sequence != link.ping_sequence || pong.time_ms != link.ping_ms) {
+        return;
+    }
+    is_bed_link_stats_t& stats = link.stats;
+    const uint32_t rtt_ms = now_ms - pong.time_ms;
+    link.ping_waiting = false;
+    link.rtt_total_ms += rtt_ms;
+    stats.pongs++;
+    stats.rtt_last_ms = rtt_ms > UINT16_MAX ? UINT16_MAX : rtt_ms;
+    if (stats.pongs == 1 || stats.rtt_last_ms < stats.rtt_min_ms) {
+        stats.rtt_min_ms = stats.rtt_last_ms;
+    }
+    if (stats.rtt_last_ms > stats.rtt_max_ms) {
+        stats.rtt_max_ms = stats.rtt_last_ms;
+    }
+    stats.rtt_avg_ms = link.rtt_total_ms / stats.pongs;
+}
+
+size_t is_bed_link_format(const is_bed_link_stats_t& stats, char *buffer, size_t size) {
+    int length = snprintf(buffer, size,
+                          "Sent %lu, received %lu\n"
+                          "Dropped %lu, duplicated %lu, late %lu (max %u ms)\n"
+                          "CRC errors %lu, frame errors %lu, reconnects %lu\n",
+                          (unsigned long)stats.sent, (unsigned long)stats.received, (unsigned long)stats.dropped,
+                          (unsigned long)stats.duplicated, (unsigned long)stats.late, stats.max_late_ms,
+                          (unsigned long)stats.crc_errors, (unsigned long)stats.frame_errors,
+                          (unsigned long)stats.reconnects);
+    if (length >= 0 && (size_t)length < size) {
+        if (stats.pongs > 0) {
+            length += snprintf(buffer + length, size - length,
+                               "RTT %u ms (min %u, avg %u, max %u), %lu pings lost\n", stats.rtt_last_ms,
+                               stats.rtt_min_ms, stats.rtt_avg_ms, stats.rtt_max_ms, (unsigned long)stats.pings_lost);
+        } else {
+            length += snprintf(buffer + length, size - length, "RTT unknown, %lu pings lost\n",
+                               (unsigned long)stats.pings_lost);
+        }
+    }
+    if (length < 0) {
+        return 0;
+    }
+    return (size_t)length < size ? length : size - 1;
+}
@@ -0,0 +1,78 @@
+#include "is_bed_message.h"
+#include "is_bed_state_sync.h"
+
+//
+// Static function prototypes
+//
+static bool catalog_size_valid(const is_bed_message_t& message);
+static bool segment_preview_size_valid(const is_bed_message_t& message);
+
+bool is_bed_message_parse(uint8_t type, const uint8_t *data, uint16_t size, bool has_header, is_bed_message_t& message) {
+    message.type = type;
+    message.header = nullptr;
+    if (has_header && type != IS_BED_MESSAGE_V1 && type != IS_BED_MESSAGE_HELLO) {
+        if (size < sizeof(is_bed_link_header_t)) {
+            return false;
+        }
+        message.header = reinterpret_cast<const is_bed_link_header_t *>(data);
+        data += sizeof(is_bed_link_header_t);
+        size -= sizeof(is_bed_link_header_t);
+    }
+    message.payload = data;
+    message.size = size;
+    switch (type) {
+    case IS_BED_MESSAGE_V1:
+        return true;
+    case IS_BED_MESSAGE_HELLO:
+        return size == sizeof(is_bed_hello_t);
+    case IS_BED_MESSAGE_CATALOG:
+        return catalog_size_valid(message);
+    case IS_BED_MESSAGE_STATE:
+        // A sequence number and the smallest mask, the fields are checked when the message is applied
+        return size >= 3 && size <= IS_BED_STATE_MESSAGE_MAX_SIZE;
+    case IS_BED_MESSAGE_PREVIEW:
+        return size == sizeof(is_bed_preview_t);
+    case IS_BED_MESSAGE_ACK:
+        return size == sizeof(is_bed_ack_t);
+    case IS_BED_MESSAGE_CATALOG_REQUEST:
+        return size == sizeof(is_bed_catalog_request_t);
+    case IS_BED_MESSAGE_PING:
+    case IS_BED_MESSAGE_PONG:
+        return size == sizeof(is_bed_ping_t);
+    case IS_BED_MESSAGE_LINK_STATS:
+        return size == sizeof(is_bed_link_stats_t);
+    case IS_BED_MESSAGE_SEGMENT_PREVIEW:
+        return segment_preview_size_valid(message);
+    case IS_BED_MESSAGE_TIME_REQUEST:
+        return size == sizeof(is_bed_time_request_t);
+    case IS_BED_MESSAGE_TIME:
+        return size == sizeof(is_bed_time_t);
+    default:
+        // The messages of newer versions are counted on the link, and ignored
+        return true;
+    }
+}
+
+// A catalog chunk has the entries it counts
+static bool catalog_size_valid(const is_bed_message_t& message) {
+    if (message.size < sizeof(is_bed_catalog_t)) {
+        return false;
+    }
+    const is_bed_catalog_t& catalog = is_bed_message_view<is_bed_catalog_t>(message);
+    return catalog.count <= IS_BED_CATALOG_MAX_ENTRIES &&
+           message.size == sizeof(is_bed_catalog_t) + catalog.count * sizeof(is_bed_catalog_entry_t);
+}
+
+// A segment preview has a color for each of its segments
+static bool segment_preview_size_valid(const is_bed_message_t& message) {
+    if (message.size < sizeof(is_bed_segment_preview_t)) {
+        return false;
+    }
+    const is_bed_segment_preview_t& preview = is_bed_message_view<is_bed_segment_preview_t>(message);
+    uint32_t num_segments = 0;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        num_segments += preview.num_segments[i];
+    }
+    return num_segments <= IS_BED_PREVIEW_MAX_SEGMENTS &&
+           message.size == sizeof(is_bed_segment_preview_t) + num_segments * sizeof(is_bed_preview_color_t);
+}
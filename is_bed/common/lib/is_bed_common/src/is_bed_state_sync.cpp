@@ -0,0 +1,168 @@
+#include "is_bed_state_sync.h"
+#include <stddef.h>
+#include <string.h>
+
+#define FIELD(type, member) {offsetof(type, member), sizeof(((type *)nullptr)->member)}
+
+// One field per member of a zone, so that changing a zone only sends what changed in it. The phase is apart.
+#define ZONE_FIELDS(zone) \
+    FIELD(is_bed_lcd_state_t, zones[zone].selected_pattern_index), \
+    FIELD(is_bed_lcd_state_t, zones[zone].displayed_pattern_index), \
+    FIELD(is_bed_lcd_state_t, zones[zone].color), \
+    FIELD(is_bed_lcd_state_t, zones[zone].palette_index), \
+    FIELD(is_bed_lcd_state_t, zones[zone].frequency), \
+    FIELD(is_bed_lcd_state_t, zones[zone].brightness)
+
+// The phases come last, versions 3 and 4 have the fields before them
+static const is_bed_state_field_t lcd_state_fields[] = {
+    ZONE_FIELDS(0),
+    ZONE_FIELDS(1),
+    ZONE_FIELDS(2),
+    ZONE_FIELDS(3),
+    FIELD(is_bed_lcd_state_t, pattern_set),
+    FIELD(is_bed_lcd_state_t, zones[0].phase),
+    FIELD(is_bed_lcd_state_t, zones[1].phase),
+    FIELD(is_bed_lcd_state_t, zones[2].phase),
+    FIELD(is_bed_lcd_state_t, zones[3].phase),
+};
+#define LCD_V3_STATE_FIELDS (NUM_ZONES * 6 + 1)
+static_assert(NUM_ZONES == 4, "One set of fields per zone");
+static_assert(sizeof(is_bed_lcd_state_t) <= IS_BED_STATE_MAX_SIZE, "The LCD state is too large");
+static_assert(sizeof(lcd_state_fields) / sizeof(lcd_state_fields[0]) <= IS_BED_STATE_MAX_FIELDS, "Too many fields");
+
+static const is_bed_state_field_t lcd_v2_state_fields[] = {
+    FIELD(is_bed_lcd_v2_state_t, frame.selected_pattern_index),
+    FIELD(is_bed_lcd_v2_state_t, frame.displayed_pattern_index),
+    FIELD(is_bed_lcd_v2_state_t, frame.zone_brightness[0]),
+    FIELD(is_bed_lcd_v2_state_t, frame.zone_brightness[1]),
+    FIELD(is_bed_lcd_v2_state_t, frame.zone_brightness[2]),
+    FIELD(is_bed_lcd_v2_state_t, frame.zone_brightness[3]),
+    FIELD(is_bed_lcd_v2_state_t, frame.selected_color),
+    FIELD(is_bed_lcd_v2_state_t, frame.frequency),
+    FIELD(is_bed_lcd_v2_state_t, pattern_set),
+};
+
+// Version 2 has the first fields only
+static const is_bed_state_field_t controller_state_fields[] = {
+    FIELD(is_bed_controller_state_t, update_progress),
+    FIELD(is_bed_controller_state_t, pattern_set),
+    FIELD(is_bed_controller_state_t, num_palettes),
+};
+
+const is_bed_state_layout_t is_bed_lcd_state_layout = {
+    lcd_state_fields, sizeof(lcd_state_fields) / sizeof(lcd_state_fields[0]), sizeof(is_bed_lcd_state_t)};
+const is_bed_state_layout_t is_bed_lcd_v3_state_layout = {lcd_state_fields, LCD_V3_STATE_FIELDS, sizeof(is_bed_lcd_state_t)};
+const is_bed_state_layout_t is_bed_controller_state_layout = {
+    controller_state_fields, sizeof(controller_state_fields) / sizeof(controller_state_fields[0]),
+    sizeof(is_bed_controller_state_t)};
+const is_bed_state_layout_t is_bed_lcd_v2_state_layout = {
+    lcd_v2_state_fields, sizeof(lcd_v2_state_fields) / sizeof(lcd_v2_state_fields[0]), sizeof(is_bed_lcd_v2_state_t)};
+const is_bed_state_layout_t is_bed_controller_v2_state_layout = {
+    controller_state_fields, 2, offsetof(is_bed_controller_state_t, num_palettes)};
+
+//
+// Static function prototypes
+//
+static uint8_t mask_size(const is_bed_state_layout_t& layout);
+
+void is_bed_state_sender_init(is_bed_state_sender_t& sender, const is_bed_state_layout_t& layout) {
+    memset(&sender, 0, sizeof(sender));
+    sender.layout = &layout;
+}
+
+void is_bed_state_sender_reset(is_bed_state_sender_t& sender) {
+    sender.acked_valid = false;
+    sender.waiting = false;
+}
+
+bool is_bed_state_changed(const is_bed_state_sender_t& sender, const void *state) {
+    if (sender.waiting) {
+        return memcmp(state, sender.sent, sender.layout->size) != 0;
+    }
+    return !sender.acked_valid || memcmp(state, sender.acked, sender.layout->size) != 0;
+}
+
+uint8_t is_bed_state_message(is_bed_state_sender_t& sender, const void *state, uint8_t *message, bool heartbeat) {
+    const is_bed_state_layout_t& layout = *sender.layout;
+    const uint8_t *values = (const uint8_t *)state;
+    is_bed_state_header_t header = {};
+    const uint8_t header_size = 1 + mask_size(layout);
+    uint8_t size = header_size;
+    for (uint8_t i = 0; i < layout.num_fields; i++) {
+        const is_bed_state_field_t& field = layout.fields[i];
+        // A field is sent if the other side may not have its value: it changed since the last acknowledged
+        // state, or it changed in a message that was not acknowledged yet and may have been received.
+        const bool changed = !sender.acked_valid ||
+                             memcmp(values + field.offset, sender.acked + field.offset, field.size) != 0 ||
+                             (sender.waiting && memcmp(sender.sent + field.offset, sender.acked + field.offset, field.size) != 0);
+        if (changed) {
+            header.changed |= 1u << i;
+            memcpy(message + size, values + field.offset, field.size);
+            size += field.size;
+        }
+    }
+    if (header.changed == 0 && !heartbeat) {
+        return 0;
+    }
+    header.sequence = ++sender.sequence;
+    message[0] = header.sequence;
+    memcpy(message + 1, &header.changed, header_size - 1);
+    memcpy(sender.sent, state, layout.size);
+    sender.waiting = true;
+    return size;
+}
+
+void is_bed_state_ack(is_bed_state_sender_t& sender, const is_bed_ack_t& ack) {
+    // Older acknowledgements are ignored, the last message includes what they acknowledge
+    if (!sender.waiting || ack.sequence != sender.sequence) {
+        return;
+    }
+    memcpy(sender.acked, sender.sent, sender.layout->size);
+    sender.acked_valid = true;
+    sender.waiting = false;
+}
+
+bool is_bed_state_apply(const is_bed_state_layout_t& layout, void *state, const uint8_t *message, uint16_t size,
+                        is_bed_state_header_t *header) {
+    is_bed_state_header_t message_header = {};
+    const uint8_t header_size = 1 + mask_size(layout);
+    if (size < header_size) {
+        return false;
+    }
+    message_header.sequence = message[0];
+    memcpy(&message_header.changed, message + 1, header_size - 1);
+    // Check the size before touching the state
+    uint16_t expected_size = header_size;
+    for (uint8_t i = 0; i < IS_BED_STATE_MAX_FIELDS; i++) {
+        if (message_header.changed & (1u << i)) {
+            if (i >= layout.num_fields) {
+                return false;
+            }
+            expected_size += layout.fields[i].size;
+        }
+    }
+    if (size != expected_size) {
+        return false;
+    }
+    uint8_t *values = (uint8_t *)state;
+    const uint8_t *data = message + header_size;
+    for (uint8_t i = 0; i < layout.num_fields; i++) {
+        const is_bed_state_field_t& field = layout.fields[i];
+        if (message_header.changed & (1u << i)) {
+            memcpy(values + field.offset, data, field.size);
+            data += field.size;
+        }
+    }
+    if (header != nullptr) {
+        *header = message_header;
+    }
+    return true;
+}
+
+//
+// Static functions
+//
+// Size of the changed mask of the state messages, in bytes. The mask is little endian, like the targets.
+static uint8_t mask_size(const is_bed_state_layout_t& layout) {
+    return layout.num_fields > 16 ? 4 : 2;
+}
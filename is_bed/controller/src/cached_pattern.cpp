@@ -1,68 +1,664 @@
 
 #include "cached_pattern.h"
+#include "led_array.h"
+#include "pattern_manifest.h"
+#include <zones.h>
 
-cached_pattern_t cached_patterns[MAX_CACHED_PATTERN_NUMBER];
+cached_pattern_t *cached_patterns = nullptr;
 uint32_t num_cached_patterns = 0;
 
-// List the name of the patterns available on the SD card
+// Number of animation steps kept in RAM. Enough for every zone and the LCD preview
+// to play a different interpolated pattern.
+#define CACHED_FRAME_SLOTS 12
+
+// An animation step of a cached pattern, in topology order
+typedef struct {
+    // The pattern and step held by the slot (nullptr if the slot is free)
+    cached_pattern_t *pattern;
+    uint32_t step;
+    // Value of frame_use_counter when the slot was last used, for LRU eviction
+    uint32_t last_use;
+    // One pixel per LED of the topology
+    CRGB *pixels;
+} cached_frame_t;
+
+static cached_frame_t cached_frames[CACHED_FRAME_SLOTS];
+static uint32_t frame_use_counter = 0;
+// Buffer for the pixels of remapped patterns, in file order
+static CRGB *remap_buffer = nullptr;
+static uint32_t remap_buffer_size = 0;
+
+// Number of pattern files kept open. Enough for every zone and the LCD preview to play a
+// different pattern; other patterns borrow the least recently used handle.
+#define CACHED_FILE_HANDLES (NUM_ZONES + 1)
+// Handles not used for this long are closed, so files replaced over MTP or by a USB update
+// are reopened instead of being read through a stale handle.
+#define CACHED_FILE_IDLE_MS 2000
+
+// An open pattern file
+typedef struct {
+    // The pattern the file belongs to (nullptr if the handle is free)
+    cached_pattern_t *pattern;
+    File file;
+    // Time of the last read, for LRU reuse and idle closing
+    uint32_t last_use_ms;
+} cached_file_t;
+
+static cached_file_t cached_files[CACHED_FILE_HANDLES];
+
+// Get the open file of a pattern, opening it if needed from the filesystem of the pattern.
+// Returns nullptr if the file can't be opened.
+static File *pattern_file(cached_pattern_t& pattern) {
+    const uint32_t now = millis();
+    cached_file_t *victim = &cached_files[0];
+    for (uint32_t i = 0; i < CACHED_FILE_HANDLES; i++) {
+        cached_file_t *handle = &cached_files[i];
+        if (handle->pattern == &pattern) {
+            handle->last_use_ms = now;
+            return &handle->file;
+        }
+        if (handle->pattern == nullptr ||
+            (victim->pattern != nullptr && now - handle->last_use_ms > now - victim->last_use_ms)) {
+            victim = handle;
+        }
+    }
+    if (victim->pattern != nullptr) {
+        victim->file.close();
+        victim->pattern = nullptr;
+    }
+    victim->file = pattern.fs->open(pattern.filepath.c_str());
+    if (!victim->file) {
+        return nullptr;
+    }
+    victim->pattern = &pattern;
+    victim->last_use_ms = now;
+    return &victim->file;
+}
+
+// Close the file of a pattern, if it is open
+static void release_file(cached_pattern_t& pattern) {
+    for (uint32_t i = 0; i < CACHED_FILE_HANDLES; i++) {
+        if (cached_files[i].pattern == &pattern) {
+            cached_files[i].file.close();
+            cached_files[i].pattern = nullptr;
+        }
+    }
+}
+
+// Read the header and the extended header (if any) of a pattern file
+static void read_headers(File& file, cached_pattern_header_t& header, cached_pattern_ext_header_t& ext) {
+    memset(&header, 0, sizeof(header));
+    memset(&ext, 0, sizeof(ext));
+    file.seek(0);
+    file.read(&header, sizeof(header));
+    if (header.magic == CACHED_PATTERN_MAGIC_EXT) {
+        uint16_t ext_size = 0;
+        file.read(&ext_size, sizeof(ext_size));
+        file.seek(sizeof(cached_pattern_header_t));
+        file.read(&ext, min((size_t)ext_size, sizeof(ext)));
+        ext.ext_size = ext_size;
+    } else {
+        // Plain RGB pattern, the steps directly follow the header
+        ext.data_offset = sizeof(cached_pattern_header_t);
+    }
+}
+
+// Load the palette to use for a given step, if not already loaded
+static void load_palette(cached_pattern_t& pattern, File& file, uint32_t step) {
+    const bool per_step = pattern.ext.flags & CACHED_PATTERN_FLAG_STEP_PALETTE;
+    if (!per_step) {
+        step = 0;
+    }
+    if (pattern.palette != nullptr && pattern.palette_step == step) {
+        return;
+    }
+    if (pattern.palette == nullptr) {
+        // Always allocate the full 256 entries, so indices never need to be checked
+        pattern.palette = new CRGB[256];
+    }
+    memset(pattern.palette, 0, 256 * sizeof(CRGB));
+    uint64_t pos = sizeof(cached_pattern_header_t) + pattern.ext.ext_size;
+    if (per_step) {
+        pos = pattern.ext.data_offset + (uint64_t)pattern.step_size * step;
+    }
+    file.seek(pos);
+    file.read(pattern.palette, pattern.ext.palette_size * sizeof(CRGB));
+    pattern.palette_step = step;
+}
+
+// Load the remap table, if not already loaded. Out of range entries are dropped.
+static void load_remap(cached_pattern_t& pattern, File& file) {
+    if (pattern.remap != nullptr) {
+        return;
+    }
+    const uint32_t num_pixels = pattern.header.num_pixels;
+    pattern.remap = new uint16_t[num_pixels];
+    memset(pattern.remap, 0xFF, num_pixels * sizeof(uint16_t));
+    if (pattern.ext.flags & CACHED_PATTERN_FLAG_REMAP) {
+        file.seek(pattern.ext.remap_offset);
+        file.read(pattern.remap, num_pixels * sizeof(uint16_t));
+    } else {
+        File map_file = SD.open(pattern.remap_path.c_str());
+        map_file.read(pattern.remap, num_pixels * sizeof(uint16_t));
+        map_file.close();
+    }
+    const uint32_t num_leds = leds_in_topology();
+    for (uint32_t i = 0; i < num_pixels; i++) {
+        if (pattern.remap[i] >= num_leds) {
+            pattern.remap[i] = CACHED_PATTERN_UNMAPPED;
+        }
+    }
+}
+
+// Load the spans of a segment scoped pattern, if not already loaded.
+// Returns false if the segment table does not match the LED topology, which is only reported once.
+static bool load_spans(cached_pattern_t& pattern, File& file) {
+    if (pattern.spans != nullptr) {
+        return true;
+    }
+    if (pattern.spans_invalid) {
+        return false;
+    }
+    const uint32_t num_segments = pattern.ext.num_segments;
+    cached_pattern_segment_t *segments = new cached_pattern_segment_t[num_segments];
+    file.seek(pattern.ext.segments_offset);
+    bool ok = file.read(segments, num_segments * sizeof(cached_pattern_segment_t)) ==
+              num_segments * sizeof(cached_pattern_segment_t);
+    cached_pattern_span_t *spans = new cached_pattern_span_t[num_segments];
+    uint32_t num_leds = 0;
+    for (uint32_t i = 0; i < num_segments && ok; i++) {
+        const cached_pattern_segment_t& segment = segments[i];
+        if (segment.string_index >= num_strings ||
+            segment.segment_index >= led_strings[segment.string_index].num_segments) {
+            ok = false;
+            break;
+        }
+        spans[i].topology_offset = led_strings[segment.string_index].segments[segment.segment_index].string_offset;
+        for (uint32_t j = 0; j < segment.string_index; j++) {
+            spans[i].topology_offset += led_strings[j].num_leds;
+        }
+        spans[i].num_leds = led_strings[segment.string_index].segments[segment.segment_index].num_leds;
+        num_leds += spans[i].num_leds;
+    }
+    delete[] segments;
+    if (!ok || num_leds != pattern.header.num_pixels) {
+        Serial.printf("Segment table of %s does not match the LED topology\n", pattern.filepath.c_str());
+        delete[] spans;
+        pattern.spans_invalid = true;
+        return false;
+    }
+    pattern.spans = spans;
+    return true;
+}
+
+// Load the timeline of a keyframe pattern, if not already loaded.
+// Returns false if the pattern has uniform steps, or if its hold table can't be used.
+static bool load_timeline(cached_pattern_t& pattern) {
+    if (!(pattern.ext.flags & CACHED_PATTERN_FLAG_HOLD)) {
+        return false;
+    }
+    if (pattern.timeline != nullptr) {
+        return true;
+    }
+    File *file = pattern_file(pattern);
+    if (file == nullptr) {
+        return false;
+    }
+    const uint32_t steps = pattern.header.animation_steps;
+    uint16_t *holds = new uint16_t[steps];
+    file->seek(pattern.ext.timeline_offset);
+    const bool ok = file->read(holds, steps * sizeof(uint16_t)) == steps * sizeof(uint16_t);
+    uint32_t *timeline = new uint32_t[steps + 1];
+    timeline[0] = 0;
+    for (uint32_t i = 0; i < steps; i++) {
+        timeline[i + 1] = timeline[i] + holds[i];
+    }
+    delete[] holds;
+    if (!ok || timeline[steps] == 0) {
+        delete[] timeline;
+        return false;
+    }
+    pattern.timeline = timeline;
+    return true;
+}
+
+// Read all the pixels of an animation step, in file order.
+// Palette indexed patterns are expanded to CRGB.
+static void read_step(cached_pattern_t& pattern, File& file, uint32_t step, CRGB *pixels) {
+    const uint32_t num_pixels = pattern.header.num_pixels;
+    uint64_t pos = pattern.ext.data_offset + (uint64_t)pattern.step_size * step;
+    if (!(pattern.ext.flags & CACHED_PATTERN_FLAG_PALETTE)) {
+        // Plain RGB, a single read straight into the pixels
+        file.seek(pos);
+        file.read(pixels, num_pixels * sizeof(CRGB));
+        return;
+    }
+
+    load_palette(pattern, file, step);
+    if (pattern.ext.flags & CACHED_PATTERN_FLAG_STEP_PALETTE) {
+        pos += pattern.ext.palette_size * sizeof(CRGB);
+    }
+    file.seek(pos);
+    // Read the indices in the last third of the pixel buffer, then expand them front to back.
+    // Writing pixel i only touches bytes below index i + 1, so no index is overwritten before use.
+    uint8_t *indices = (uint8_t *)pixels + 2 * num_pixels;
+    file.read(indices, num_pixels);
+    const CRGB *palette = pattern.palette;
+    for (uint32_t i = 0; i < num_pixels; i++) {
+        pixels[i] = palette[indices[i]];
+    }
+}
+
+// Load an animation step in topology order into a frame
+static void load_frame(cached_pattern_t& pattern, File& file, uint32_t step, CRGB *frame) {
+    const uint32_t num_pixels = pattern.header.num_pixels;
+    const bool segments = pattern.ext.flags & CACHED_PATTERN_FLAG_SEGMENTS;
+    if (!segments && pattern.remap_path.length() == 0 && !(pattern.ext.flags & CACHED_PATTERN_FLAG_REMAP)) {
+        // Same layout as the topology
+        read_step(pattern, file, step, frame);
+        return;
+    }
+    // Read in file order, then move the pixels to their LEDs
+    if (remap_buffer_size < num_pixels) {
+        delete[] remap_buffer;
+        remap_buffer = new CRGB[num_pixels];
+        remap_buffer_size = num_pixels;
+    }
+    memset(frame, 0, leds_in_topology() * sizeof(CRGB));
+    if (segments) {
+        if (!load_spans(pattern, file)) {
+            return;
+        }
+        read_step(pattern, file, step, remap_buffer);
+        const CRGB *pixels = remap_buffer;
+        for (uint32_t i = 0; i < pattern.ext.num_segments; i++) {
+            const cached_pattern_span_t& span = pattern.spans[i];
+            memcpy(frame + span.topology_offset, pixels, span.num_leds * sizeof(CRGB));
+            pixels += span.num_leds;
+        }
+        return;
+    }
+    load_remap(pattern, file);
+    read_step(pattern, file, step, remap_buffer);
+    const uint16_t *remap = pattern.remap;
+    for (uint32_t i = 0; i < num_pixels; i++) {
+        if (remap[i] != CACHED_PATTERN_UNMAPPED) {
+            frame[remap[i]] = remap_buffer[i];
+        }
+    }
+}
+
+uint32_t cached_pattern_period_ms(const cached_pattern_t& pattern) {
+    if (pattern.ext.period_ms != 0) {
+        return pattern.ext.period_ms;
+    }
+    return pattern.header.animation_period_s * 1000;
+}
+
+uint32_t cached_pattern_locate(cached_pattern_t& pattern, uint32_t phase, fract8 *fraction) {
+    const uint32_t steps = pattern.header.animation_steps;
+    if (!load_timeline(pattern)) {
+        // Uniform steps. Position in the animation, in 1/256th of a step
+        const uint64_t position = ((uint64_t)phase * steps) >> 24;
+        *fraction = position & 0xFF;
+        return position >> 8;
+    }
+    // Position in the animation, in 1/256th of a hold unit
+    const uint32_t *timeline = pattern.timeline;
+    const uint64_t position = ((uint64_t)phase * timeline[steps]) >> 24;
+    // Binary search of the last step starting at or before the position.
+    // Steps with no hold are never picked, as the next step starts at the same time.
+    uint32_t low = 0;
+    uint32_t high = steps - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if ((uint64_t)timeline[middle] * 256 <= position) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    *fraction = (position - (uint64_t)timeline[low] * 256) / (timeline[low + 1] - timeline[low]);
+    return low;
+}
+
+const CRGB *cached_pattern_frame(cached_pattern_t& pattern, uint32_t step) {
+    frame_use_counter++;
+    cached_frame_t *victim = &cached_frames[0];
+    for (uint32_t i = 0; i < CACHED_FRAME_SLOTS; i++) {
+        cached_frame_t *frame = &cached_frames[i];
+        if (frame->pattern == &pattern && frame->step == step) {
+            frame->last_use = frame_use_counter;
+            return frame->pixels;
+        }
+        if (frame->pattern == nullptr || (victim->pattern != nullptr && frame->last_use < victim->last_use)) {
+            victim = frame;
+        }
+    }
+    if (victim->pixels == nullptr) {
+        victim->pixels = new CRGB[leds_in_topology()];
+    }
+    File *file = pattern_file(pattern);
+    if (file != nullptr) {
+        load_frame(pattern, *file, step, victim->pixels);
+    } else {
+        memset(victim->pixels, 0, leds_in_topology() * sizeof(CRGB));
+    }
+    victim->pattern = &pattern;
+    victim->step = step;
+    victim->last_use = frame_use_counter;
+    return victim->pixels;
+}
+
+void cached_pattern_setup(cached_pattern_t& pattern, const char *filepath, const cached_pattern_header_t& header,
+                          const cached_pattern_ext_header_t& ext, uint32_t file_size) {
+    pattern.header = header;
+    pattern.ext = ext;
+    const bool indexed = ext.flags & CACHED_PATTERN_FLAG_PALETTE;
+    pattern.step_size = header.num_pixels * (indexed ? 1 : sizeof(CRGB));
+    if (indexed && (ext.flags & CACHED_PATTERN_FLAG_STEP_PALETTE)) {
+        pattern.step_size += ext.palette_size * sizeof(CRGB);
+    }
+    pattern.data_size = file_size > ext.data_offset ? file_size - ext.data_offset : 0;
+    pattern.palette = nullptr;
+    pattern.palette_step = CACHED_PATTERN_NO_STEP;
+    pattern.remap = nullptr;
+    pattern.timeline = nullptr;
+    pattern.spans = nullptr;
+    pattern.spans_invalid = false;
+    pattern.remap_path = "";
+    pattern.filepath = filepath;
+    pattern.fs = &SD;
+    cached_pattern_display_name(filepath, pattern.name, sizeof(pattern.name));
+}
+
+bool cached_pattern_open(cached_pattern_t& pattern, const char *filepath) {
+    File file = SD.open(filepath);
+    if (!file) {
+        return false;
+    }
+    cached_pattern_header_t header;
+    cached_pattern_ext_header_t ext;
+    read_headers(file, header, ext);
+    cached_pattern_setup(pattern, filepath, header, ext, file.size());
+    file.close();
+    // Look for a remap table next to the pattern
+    if (!(ext.flags & CACHED_PATTERN_FLAG_REMAP)) {
+        String map_path = filepath;
+        int dot_index = map_path.lastIndexOf('.');
+        if (dot_index != -1) {
+            map_path.remove(dot_index);
+        }
+        map_path += ".map";
+        if (SD.exists(map_path.c_str())) {
+            pattern.remap_path = map_path;
+        }
+    }
+    return true;
+}
+
+void cached_pattern_close(cached_pattern_t& pattern) {
+    // Drop the cached frames of the pattern
+    for (uint32_t i = 0; i < CACHED_FRAME_SLOTS; i++) {
+        if (cached_frames[i].pattern == &pattern) {
+            cached_frames[i].pattern = nullptr;
+        }
+    }
+    delete[] pattern.palette;
+    pattern.palette = nullptr;
+    delete[] pattern.remap;
+    pattern.remap = nullptr;
+    delete[] pattern.timeline;
+    pattern.timeline = nullptr;
+    delete[] pattern.spans;
+    pattern.spans = nullptr;
+    release_file(pattern);
+}
+
+void cached_pattern_set_fs(cached_pattern_t& pattern, FS *fs) {
+    release_file(pattern);
+    pattern.fs = fs;
+}
+
+void cached_pattern_close_idle_files() {
+    const uint32_t now = millis();
+    for (uint32_t i = 0; i < CACHED_FILE_HANDLES; i++) {
+        cached_file_t *handle = &cached_files[i];
+        if (handle->pattern != nullptr && now - handle->last_use_ms > CACHED_FILE_IDLE_MS) {
+            handle->file.close();
+            handle->pattern = nullptr;
+        }
+    }
+}
+
+const char *cached_pattern_check(const cached_pattern_t& pattern) {
+    const bool remapped = pattern.remap_path.length() > 0 || (pattern.ext.flags & CACHED_PATTERN_FLAG_REMAP);
+    if (pattern.header.animation_steps == 0 || cached_pattern_period_ms(pattern) == 0) {
+        return "no animation steps or null period";
+    }
+    if (pattern.header.magic == CACHED_PATTERN_MAGIC_EXT && pattern.ext.ext_size < sizeof(uint16_t)) {
+        return "truncated extended header";
+    }
+    if ((pattern.ext.flags & CACHED_PATTERN_FLAG_PALETTE) &&
+        (pattern.ext.palette_size == 0 || pattern.ext.palette_size > 256)) {
+        return "invalid palette size";
+    }
+    const uint64_t file_size = (uint64_t)pattern.ext.data_offset + pattern.data_size;
+    if ((pattern.ext.flags & CACHED_PATTERN_FLAG_HOLD) &&
+        (pattern.ext.ext_size < offsetof(cached_pattern_ext_header_t, timeline_offset) + sizeof(uint32_t) ||
+         (uint64_t)pattern.ext.timeline_offset + pattern.header.animation_steps * sizeof(uint16_t) > file_size)) {
+        return "missing hold table";
+    }
+    if (pattern.ext.flags & CACHED_PATTERN_FLAG_SEGMENTS) {
+        if (remapped) {
+            return "a pattern can't have both a segment table and a remap table";
+        }
+        if (pattern.ext.ext_size < offsetof(cached_pattern_ext_header_t, num_segments) + sizeof(uint16_t) ||
+            pattern.ext.num_segments == 0 ||
+            (uint64_t)pattern.ext.segments_offset + pattern.ext.num_segments * sizeof(cached_pattern_segment_t) > file_size) {
+            return "missing segment table";
+        }
+    } else if (!remapped && pattern.header.num_pixels != leds_in_topology()) {
+        return "number of pixels does not match the LED topology, and there is no remap table";
+    }
+    if (pattern.data_size < (uint64_t)pattern.step_size * pattern.header.animation_steps) {
+        return "file is shorter than its animation steps";
+    }
+    return nullptr;
+}
+
+void cached_pattern_display_name(const char *filepath, char *name, size_t size) {
+    // Keep the file name, without the directory and the extension
+    const char *start = strrchr(filepath, '/');
+    start = start ? start + 1 : filepath;
+    const char *end = strrchr(start, '.');
+    if (end == nullptr) {
+        end = start + strlen(start);
+    }
+    // Remove any leading numbers, spaces or underscores
+    while (start < end && (isdigit(*start) || *start == ' ' || *start == '_')) {
+        start++;
+    }
+    // Replace the underscores with spaces and capitalize the first letter of each word
+    size_t length = 0;
+    for (const char *c = start; c < end && length < size - 1; c++) {
+        char ch = *c == '_' ? ' ' : tolower(*c);
+        if (length == 0 || name[length - 1] == ' ') {
+            ch = toupper(ch);
+        }
+        name[length++] = ch;
+    }
+    name[length] = '\0';
+}
+
+// Growable array of manifest entries
+typedef struct {
+    pattern_manifest_entry_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+} entry_list_t;
+
+static pattern_manifest_entry_t *entry_list_add(entry_list_t& list) {
+    if (list.count == list.capacity) {
+        uint32_t capacity = list.capacity ? list.capacity * 2 : 32;
+        pattern_manifest_entry_t *entries = new pattern_manifest_entry_t[capacity];
+        if (list.count > 0) {
+            memcpy(entries, list.entries, list.count * sizeof(pattern_manifest_entry_t));
+        }
+        delete[] list.entries;
+        list.entries = entries;
+        list.capacity = capacity;
+    }
+    pattern_manifest_entry_t *entry = &list.entries[list.count++];
+    memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const pattern_manifest_entry_t *)a)->filename, ((const pattern_manifest_entry_t *)b)->filename);
+}
+
+static pattern_manifest_entry_t *find_entry(pattern_manifest_entry_t *entries, uint32_t count, const char *filename) {
+    pattern_manifest_entry_t key;
+    snprintf(key.filename, sizeof(key.filename), "%s", filename);
+    return (pattern_manifest_entry_t *)bsearch(&key, entries, count, sizeof(key), compare_entries);
+}
+
+// Update a FNV-1a hash
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619;
+    }
+    return hash;
+}
+
+// List the patterns available on the SD card.
+// Only the directory is read: the headers and names of the files that did not change since the
+// last boot come from the manifest, and the files themselves are opened on first use.
 void load_cached_patterns() {
     Serial.println("Scanning SD card for cached patterns...");
-    // First, collect all .bin filenames
-    String filenames[MAX_CACHED_PATTERN_NUMBER];
-    uint32_t num_files = 0;
-    
+    const uint32_t start_ms = millis();
+
+    // Release the resources of the previously loaded patterns
+    for (uint32_t i = 0; i < num_cached_patterns; i++) {
+        cached_pattern_close(cached_patterns[i]);
+    }
+    delete[] cached_patterns;
+    cached_patterns = nullptr;
+    num_cached_patterns = 0;
+
+    // Collect the .bin and .map files, and sign the directory with their names, sizes and dates
+    entry_list_t files = {};
+    entry_list_t maps = {};
+    uint32_t signature = 2166136261;
     File root = SD.open("/");
     while (true) {
         File file = root.openNextFile();
         if (!file) {
             break;  // no more files
         }
-        if (!file.isDirectory()) {
-            const char* name = file.name();
-            // simple *.bin match with a filter to remove .files
-            const char* ext = strrchr(name, '.');
-            if (ext && strcasecmp(ext, ".bin") == 0 && name[0] != '.') {
-                if (num_files < MAX_CACHED_PATTERN_NUMBER) {
-                    Serial.print("  Found pattern file: ");
-                    Serial.println(name);
-                    filenames[num_files++] = String(name);
-                } else {
-                    Serial.println("Warning: maximum cached pattern number reached during scanning");
-                    break;
-                }
-            }
+        const char* name = file.name();
+        // simple *.bin / *.map match with a filter to remove .files
+        const char* ext = strrchr(name, '.');
+        const bool is_bin = ext && strcasecmp(ext, ".bin") == 0;
+        const bool is_map = ext && strcasecmp(ext, ".map") == 0;
+        if (file.isDirectory() || name[0] == '.' || !(is_bin || is_map)) {
+            continue;
         }
-        file.close();
+        if (strlen(name) >= CACHED_PATTERN_FILENAME_LENGTH) {
+            Serial.print("Warning: ignoring pattern file with a name too long: ");
+            Serial.println(name);
+            continue;
+        }
+        pattern_manifest_entry_t *entry = entry_list_add(is_bin ? files : maps);
+        strcpy(entry->filename, name);
+        entry->size = file.size();
+        entry->mtime = pattern_manifest_mtime(file);
+        signature = fnv1a(signature, entry->filename, strlen(entry->filename));
+        signature = fnv1a(signature, &entry->size, sizeof(entry->size));
+        signature = fnv1a(signature, &entry->mtime, sizeof(entry->mtime));
     }
     root.close();
-    
-    // Sort filenames alphabetically
-    for (uint32_t i = 0; i < num_files - 1; i++) {
-        for (uint32_t j = i + 1; j < num_files; j++) {
-            if (filenames[i].compareTo(filenames[j]) > 0) {
-                String temp = filenames[i];
-                filenames[i] = filenames[j];
-                filenames[j] = temp;
+
+    uint32_t num_manifest_entries = 0;
+    uint32_t manifest_signature = 0;
+    pattern_manifest_entry_t *manifest = pattern_manifest_load(&num_manifest_entries, &manifest_signature);
+    uint32_t num_parsed = 0;
+    if (manifest != nullptr && manifest_signature == signature && num_manifest_entries == files.count) {
+        // Nothing changed, the manifest has everything
+        delete[] files.entries;
+        files.entries = manifest;
+        manifest = nullptr;
+    } else {
+        // Reuse what we can from the manifest, and parse the new or modified files
+        qsort(files.entries, files.count, sizeof(pattern_manifest_entry_t), compare_entries);
+        for (uint32_t i = 0; i < files.count; i++) {
+            pattern_manifest_entry_t& entry = files.entries[i];
+            const pattern_manifest_entry_t *known = find_entry(manifest, num_manifest_entries, entry.filename);
+            if (known != nullptr && known->size == entry.size && known->mtime == entry.mtime) {
+                entry = *known;
+                continue;
             }
-        }
-    }
-    
-    // Now load files in alphabetical order
-    num_cached_patterns = 0;
-    for (uint32_t i = 0; i < num_files; i++) {
-        File file = SD.open(filenames[i].c_str());
-        if (file) {
-            Serial.print("Loaded cached pattern file: ");
-            Serial.println(filenames[i]);
-            cached_pattern_t& pattern = cached_patterns[num_cached_patterns++];
-            pattern.filepath = filenames[i];
-            pattern.file = file;
-            file.read(&pattern.header, sizeof(pattern.header));
+            cached_pattern_t pattern;
+            if (!cached_pattern_open(pattern, entry.filename)) {
+                continue;
+            }
+            Serial.print("Parsed cached pattern file: ");
+            Serial.println(entry.filename);
             Serial.printf("\tmagic: %X\n", pattern.header.magic);
             Serial.printf("\tcolor_ordering: %d\n", pattern.header.color_ordering);
             Serial.printf("\tnum_pixels: %d\n", pattern.header.num_pixels);
             Serial.printf("\tanimation_steps: %d\n", pattern.header.animation_steps);
             Serial.printf("\tanimation_period_s: %d\n", pattern.header.animation_period_s);
+            if (pattern.ext.flags & CACHED_PATTERN_FLAG_PALETTE) {
+                Serial.printf("\tpalette_size: %d%s\n", pattern.ext.palette_size,
+                              (pattern.ext.flags & CACHED_PATTERN_FLAG_STEP_PALETTE) ? " (per step)" : "");
+            }
+            entry.header = pattern.header;
+            entry.ext = pattern.ext;
+            strcpy(entry.name, pattern.name);
+            cached_pattern_close(pattern);
+            num_parsed++;
+        }
+        if (!pattern_manifest_save(files.entries, files.count, signature)) {
+            Serial.println("Warning: could not write the pattern manifest");
+        }
+    }
+    delete[] manifest;
+
+    // Now set up the patterns, in alphabetical order, as long as they can be played
+    cached_patterns = new cached_pattern_t[min(files.count, (uint32_t)MAX_CACHED_LED_PATTERNS)];
+    for (uint32_t i = 0; i < files.count; i++) {
+        const pattern_manifest_entry_t& entry = files.entries[i];
+        if (num_cached_patterns == MAX_CACHED_LED_PATTERNS) {
+            Serial.printf("Skipping cached pattern %s: more than %u patterns\n", entry.filename,
+                          (unsigned)MAX_CACHED_LED_PATTERNS);
+            continue;
+        }
+        cached_pattern_t& pattern = cached_patterns[num_cached_patterns];
+        cached_pattern_setup(pattern, entry.filename, entry.header, entry.ext, entry.size);
+        strcpy(pattern.name, entry.name);
+        // Pair the pattern with its remap table, if there is one
+        if (!(entry.ext.flags & CACHED_PATTERN_FLAG_REMAP)) {
+            for (uint32_t j = 0; j < maps.count; j++) {
+                const char *map_ext = strrchr(maps.entries[j].filename, '.');
+                const char *bin_ext = strrchr(entry.filename, '.');
+                if (map_ext - maps.entries[j].filename == bin_ext - entry.filename &&
+                    strncmp(maps.entries[j].filename, entry.filename, bin_ext - entry.filename) == 0) {
+                    pattern.remap_path = maps.entries[j].filename;
+                }
+            }
+        }
+        const char *error = cached_pattern_check(pattern);
+        if (error != nullptr) {
+            Serial.printf("Skipping cached pattern %s: %s\n", entry.filename, error);
+            continue;
         }
+        num_cached_patterns++;
     }
+    delete[] files.entries;
+    delete[] maps.entries;
+    Serial.printf("Loaded %u cached patterns (%u parsed) in %u ms\n", (unsigned)num_cached_patterns, (unsigned)num_parsed,
+                  (unsigned)(millis() - start_ms));
 }
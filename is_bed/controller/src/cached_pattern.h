@@ -24,17 +24,159 @@ struct [[gnu::packed]] cached_pattern_header_t {
     uint16_t animation_period_s;
 };
 
+// Magic number of the patterns that have an extended header following the base header.
+// Files with any other magic are plain RGB patterns: the steps directly follow the base header.
+#define CACHED_PATTERN_MAGIC_EXT 0x4C46
+
+// Each pixel is stored as an 8-bit index in a palette of up to 256 colors.
+#define CACHED_PATTERN_FLAG_PALETTE (1 << 0)
+// Each step starts with its own palette, instead of a single palette for the whole file.
+#define CACHED_PATTERN_FLAG_STEP_PALETTE (1 << 1)
+// Blend linearly between consecutive steps instead of holding each step until the next one.
+// The last step blends into the first one.
+#define CACHED_PATTERN_FLAG_INTERPOLATE (1 << 2)
+// The file embeds a remap table at remap_offset: one uint16_t per file pixel, giving its index in
+// the LED topology (strings in led_strings[] order), or CACHED_PATTERN_UNMAPPED to drop the pixel.
+// The same table can also be provided next to a pattern file "name.bin", as a raw "name.map" file.
+#define CACHED_PATTERN_FLAG_REMAP (1 << 3)
+// The steps are keyframes of variable duration. The file embeds a hold table at timeline_offset:
+// one uint16_t per step, giving how long the step lasts in arbitrary units. The animation period
+// is spread over the sum of the holds.
+#define CACHED_PATTERN_FLAG_HOLD (1 << 4)
+// The file only covers some segments of the topology, listed in a segment table at segments_offset
+// (num_segments cached_pattern_segment_t). The pixels of a step are those of the listed segments,
+// one after the other in table order. The LEDs of the other segments are left black.
+#define CACHED_PATTERN_FLAG_SEGMENTS (1 << 5)
+
+// Remap table entry for a file pixel that has no physical LED
+#define CACHED_PATTERN_UNMAPPED 0xFFFF
+
+// Extension of the header, present when the magic is CACHED_PATTERN_MAGIC_EXT.
+//
+// File layout:
+//   cached_pattern_header_t
+//   cached_pattern_ext_header_t (ext_size bytes)
+//   palette, if FLAG_PALETTE is set and FLAG_STEP_PALETTE is not (palette_size CRGB)
+//   remap table, if FLAG_REMAP is set (num_pixels uint16_t, at remap_offset)
+//   hold table, if FLAG_HOLD is set (animation_steps uint16_t, at timeline_offset)
+//   segment table, if FLAG_SEGMENTS is set (num_segments cached_pattern_segment_t, at segments_offset)
+//   ... padding up to data_offset ...
+//   step 0: [palette if FLAG_STEP_PALETTE] [num_pixels CRGB, or num_pixels indices if FLAG_PALETTE]
+//   step 1: ...
+struct [[gnu::packed]] cached_pattern_ext_header_t {
+    // The size of the extended header in bytes. Fields unknown to this firmware are skipped.
+    uint16_t ext_size;
+    // Format flags (CACHED_PATTERN_FLAG_*)
+    uint16_t flags;
+    // The number of colors in the palette(s), up to 256
+    uint16_t palette_size;
+    // Offset in bytes, from the start of the file, of the first animation step
+    uint32_t data_offset;
+    // Offset in bytes, from the start of the file, of the remap table
+    uint32_t remap_offset;
+    // Offset in bytes, from the start of the file, of the hold table
+    uint32_t timeline_offset;
+    // Offset in bytes, from the start of the file, of the segment table
+    uint32_t segments_offset;
+    // The number of entries in the segment table
+    uint16_t num_segments;
+    // The animation period in ms, for periods that are not whole seconds. 0 to use animation_period_s.
+    uint32_t period_ms;
+};
+
+// Entry of the segment table
+struct [[gnu::packed]] cached_pattern_segment_t {
+    // Index of the string in led_strings[]
+    uint8_t string_index;
+    // Index of the segment in the string
+    uint8_t segment_index;
+};
+
+// A run of consecutive LEDs of the topology covered by a segment scoped pattern
+typedef struct {
+    // Index of the first LED in the topology
+    uint32_t topology_offset;
+    uint32_t num_leds;
+} cached_pattern_span_t;
+
+// Marker for "no step loaded"
+#define CACHED_PATTERN_NO_STEP 0xFFFFFFFF
+
+// Maximum length of a pattern file name, including the terminating null
+#define CACHED_PATTERN_FILENAME_LENGTH 64
+// Maximum length of the display name of a pattern, including the terminating null
+#define CACHED_PATTERN_NAME_LENGTH 32
+
 typedef struct {
     cached_pattern_header_t header;
+    // The extended header. For plain RGB patterns, it is filled with the implied values.
+    cached_pattern_ext_header_t ext;
     // Size of the image in bytes
     uint32_t data_size;
+    // Size of one animation step in bytes (including its palette, if any)
+    uint32_t step_size;
+    // The palette for palette indexed patterns (256 entries), allocated on first use
+    CRGB *palette;
+    // The step the palette was loaded for (0 for a file wide palette)
+    uint32_t palette_step;
+    // The path of the remap table file, if the pattern is remapped by a "name.map" file
+    String remap_path;
+    // The remap table (num_pixels entries), allocated on first use
+    uint16_t *remap;
+    // For keyframe patterns, the start of each step in hold units followed by the total duration
+    // (animation_steps + 1 entries), allocated on first use
+    uint32_t *timeline;
+    // For segment scoped patterns, where the pixels go in the topology (ext.num_segments entries),
+    // allocated on first use
+    cached_pattern_span_t *spans;
+    // The segment table was found not to match the LED topology. The pattern then plays black,
+    // without reading the table again.
+    bool spans_invalid;
+    // The name to display for the pattern, derived from the file name
+    char name[CACHED_PATTERN_NAME_LENGTH];
     String filepath;
-    File file;
+    // The filesystem the steps are read from: the SD card, or the flash store if the pattern is mirrored there
+    FS *fs;
 } cached_pattern_t;
 
+// Set up a cached pattern from already parsed headers, without opening the file
+void cached_pattern_setup(cached_pattern_t& pattern, const char *filepath, const cached_pattern_header_t& header,
+                          const cached_pattern_ext_header_t& ext, uint32_t file_size);
+
+// Parse the header of a cached pattern file. Returns false if the file can't be opened.
+// The file itself is only kept open while the pattern is being played.
+bool cached_pattern_open(cached_pattern_t& pattern, const char *filepath);
+
+// Release the file and the buffers of a cached pattern
+void cached_pattern_close(cached_pattern_t& pattern);
+
+// Read the steps of a cached pattern from another filesystem, which has the same file
+void cached_pattern_set_fs(cached_pattern_t& pattern, FS *fs);
+
+// Close the pattern files that have not been read recently
+void cached_pattern_close_idle_files();
+
+// Check that a cached pattern can be played on the LED topology.
+// Returns nullptr if it can, or a description of the problem.
+const char *cached_pattern_check(const cached_pattern_t& pattern);
+
+// The animation period of a cached pattern, in ms
+uint32_t cached_pattern_period_ms(const cached_pattern_t& pattern);
+
+// Find the step to show at a position in the animation cycle (as a fraction of 2^32),
+// and how far it is to the next step in 1/256th of the step
+uint32_t cached_pattern_locate(cached_pattern_t& pattern, uint32_t phase, fract8 *fraction);
+
+// Get an animation step of a cached pattern, with one pixel per LED of the topology.
+// Frames are cached and evicted least recently used first, so the frames returned by the
+// last two calls stay valid.
+const CRGB *cached_pattern_frame(cached_pattern_t& pattern, uint32_t step);
+
+// Derive the name to display for a pattern from its file name
+void cached_pattern_display_name(const char *filepath, char *name, size_t size);
+
 // The cached patterns available on the system
-#define MAX_CACHED_PATTERN_NUMBER 64
-extern cached_pattern_t cached_patterns[MAX_CACHED_PATTERN_NUMBER];
+extern cached_pattern_t *cached_patterns;
 extern uint32_t num_cached_patterns;
 
-#endif // CACHED_PATTERN_H
\ No newline at end of file
+#endif // CACHED_PATTERN_H
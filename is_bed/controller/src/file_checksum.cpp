@@ -0,0 +1,20 @@
+#include "file_checksum.h"
+
+uint32_t file_checksum_add(uint32_t checksum, uint64_t offset, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++) {
+        // Each 32-bit word of the file is weighted by an odd factor that depends on its position
+        const uint64_t position = offset + i;
+        const uint32_t weight = (uint32_t)(position >> 2) * 2 + 1;
+        checksum += ((uint32_t)bytes[i] << ((position & 3) * 8)) * weight;
+    }
+    return checksum;
+}
+
+uint64_t file_hash_add(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
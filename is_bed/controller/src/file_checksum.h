@@ -0,0 +1,38 @@
+#ifndef FILE_CHECKSUM_H
+#define FILE_CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Checksum of an empty file
+#define FILE_CHECKSUM_EMPTY 0
+// Hash of an empty file
+#define FILE_HASH_EMPTY 0xCBF29CE484222325ull
+
+/**
+ * Add a part of a file to its checksum.
+ *
+ * The checksum is a sum of the bytes weighted by their position, so the parts of a
+ * file can be added in any order. A part that was added as zeros can later be added
+ * again with its real content, without removing the zeros first.
+ *
+ * @param checksum the checksum of the other parts of the file
+ * @param offset the position of the part in the file
+ * @param data the content of the part
+ * @param size the size of the part
+ * @return the checksum including the part
+ */
+uint32_t file_checksum_add(uint32_t checksum, uint64_t offset, const void *data, size_t size);
+
+/**
+ * Add the next part of a file to its hash, a 64-bit FNV-1a. Unlike the checksum, the hash
+ * identifies the content of a file, but the parts must be added in order.
+ *
+ * @param hash the hash of the file up to this part
+ * @param data the content of the part
+ * @param size the size of the part
+ * @return the hash including the part
+ */
+uint64_t file_hash_add(uint64_t hash, const void *data, size_t size);
+
+#endif // FILE_CHECKSUM_H
@@ -0,0 +1,321 @@
+#include "lcd_link.h"
+#include "led_array.h"
+#include "led_pattern.h"
+#include "led_preview.h"
+#include <SerialTransfer.h>
+#include <is_bed_state_sync.h>
+#include <is_bed_link.h>
+#include <is_bed_message.h>
+
+is_bed_lcd_state_t lcd_state;
+
+static SerialTransfer transfer;
+// Data transfer struct (version 1), and the state of a version 2 LCD, which is its version 1 frame
+static is_bed_controller_to_lcd_t to_lcd_msg;
+static is_bed_lcd_v2_state_t from_lcd_msg;
+// Protocol version spoken with the LCD: 1 until it says hello, and what it can do
+static uint8_t protocol_version = 1;
+static uint8_t capabilities = 0;
+// Our state, kept up to date on the LCD in version 2
+static is_bed_controller_state_t controller_state;
+static is_bed_state_sender_t controller_state_sender;
+static uint32_t preview_sent_ms = 0;
+// Our side of the link, and the counters of the LCD side (version 4)
+static is_bed_link_t link;
+static is_bed_link_stats_t lcd_link_stats;
+// Last pattern that we did output to the LCD (version 1)
+static uint8_t to_lcd_pattern_index = 0;
+// Next pattern catalog entry to send, while the LCD waits for the catalog (version 2)
+static bool catalog_requested = false;
+static uint8_t catalog_next_index = 0;
+// Current set of patterns, for the LCD to know when the pattern indexes change
+static uint8_t pattern_set = 0;
+
+//
+// Static function prototypes
+//
+static uint16_t begin_message();
+static void count_link_error();
+static void lcd_state_from_frame(const is_bed_lcd_to_controller_t& frame, uint8_t frame_pattern_set);
+static void apply_lcd_state();
+
+void lcd_link_begin(Stream& port) {
+    transfer.begin(port);
+    is_bed_state_sender_init(controller_state_sender, is_bed_controller_state_layout);
+    is_bed_link_init(link, millis());
+}
+
+void lcd_link_send(uint8_t update_progress) {
+    if (protocol_version < 2) {
+        // Version 1: everything in a single frame, with one pattern of the catalog
+        const uint8_t pattern_index = to_lcd_pattern_index;
+        to_lcd_pattern_index = (to_lcd_pattern_index + 1) % num_led_patterns;
+        to_lcd_msg.pattern_index = pattern_index;
+        led_patterns[pattern_index].name.toCharArray(to_lcd_msg.pattern_name, sizeof(to_lcd_msg.pattern_name));
+        to_lcd_msg.pattern_type = pattern_type(&led_patterns[pattern_index]);
+        led_preview_zone_colors(to_lcd_msg.zone_color);
+        uint16_t send_size = transfer.txObj(to_lcd_msg, 0, sizeof(to_lcd_msg));
+        transfer.sendData(send_size);
+        return;
+    }
+
+    // The next chunk of the catalog, if the LCD asked for it
+    uint16_t send_size;
+    if (catalog_requested) {
+        is_bed_catalog_t catalog;
+        catalog.pattern_set = pattern_set;
+        catalog.num_patterns = num_led_patterns;
+        catalog.first_index = catalog_next_index;
+        catalog.count = min(num_led_patterns - min((uint32_t)catalog_next_index, num_led_patterns),
+                            (uint32_t)IS_BED_CATALOG_MAX_ENTRIES);
+        send_size = transfer.txObj(catalog, begin_message(), sizeof(catalog));
+        for (uint32_t i = catalog.first_index; i < catalog.first_index + catalog.count; i++) {
+            is_bed_catalog_entry_t entry;
+            entry.type = pattern_type(&led_patterns[i]);
+            led_patterns[i].name.toCharArray(entry.name, sizeof(entry.name));
+            send_size = transfer.txObj(entry, send_size, sizeof(entry));
+        }
+        transfer.sendData(send_size, IS_BED_MESSAGE_CATALOG);
+        catalog_next_index += catalog.count;
+        catalog_requested = catalog_next_index < num_led_patterns;
+    }
+
+    // Preview of the output: a color per segment if the LCD can show it, a color per zone otherwise
+    const uint32_t now = millis();
+    if (now - preview_sent_ms >= IS_BED_PREVIEW_INTERVAL_MS) {
+        if (capabilities & IS_BED_CAPABILITY_SEGMENT_PREVIEW) {
+            preview_sent_ms = now;
+            led_preview_displayed_patterns();
+            send_size = transfer.txObj(led_preview, begin_message(), sizeof(led_preview));
+            send_size = transfer.txObj(led_preview_colors, send_size,
+                                       led_preview_num_segments() * sizeof(led_preview_colors[0]));
+            transfer.sendData(send_size, IS_BED_MESSAGE_SEGMENT_PREVIEW);
+        } else if (capabilities & IS_BED_CAPABILITY_PREVIEW) {
+            preview_sent_ms = now;
+            is_bed_preview_t preview;
+            led_preview_zone_colors(preview.zone_color);
+            send_size = transfer.txObj(preview, begin_message(), sizeof(preview));
+            transfer.sendData(send_size, IS_BED_MESSAGE_PREVIEW);
+        }
+    }
+
+    // Our state, if the LCD does not have it yet
+    controller_state.update_progress = (capabilities & IS_BED_CAPABILITY_UPDATE_PROGRESS) ? update_progress : IS_BED_UPDATE_NONE;
+    controller_state.pattern_set = pattern_set;
+    controller_state.num_palettes = num_led_palettes();
+    uint8_t message[IS_BED_STATE_MESSAGE_MAX_SIZE];
+    const uint8_t message_size = is_bed_state_message(controller_state_sender, &controller_state, message, false);
+    if (message_size > 0) {
+        send_size = transfer.txObj(message, begin_message(), message_size);
+        transfer.sendData(send_size, IS_BED_MESSAGE_STATE);
+    }
+
+    // A ping, with our counters
+    is_bed_ping_t ping;
+    if (protocol_version >= 4 && is_bed_link_ping(link, millis(), ping)) {
+        send_size = transfer.txObj(ping, begin_message(), sizeof(ping));
+        transfer.sendData(send_size, IS_BED_MESSAGE_PING);
+        send_size = transfer.txObj(link.stats, begin_message(), sizeof(link.stats));
+        transfer.sendData(send_size, IS_BED_MESSAGE_LINK_STATS);
+    }
+}
+
+void lcd_link_receive() {
+    while (true) {
+        const uint8_t size = transfer.available();
+        if (size == 0) {
+            count_link_error();
+            break;
+        }
+        // From version 4, the messages start with a link header, except the version 1 frames and hello.
+        // The message is read in place, it stays in the receive buffer until the next frame.
+        is_bed_message_t message;
+        if (!is_bed_message_parse(transfer.currentPacketID(), transfer.packet.rxBuff, size, protocol_version >= 4,
+                                  message)) {
+            continue;
+        }
+        if (message.header != nullptr && !is_bed_link_receive(link, millis(), *message.header)) {
+            continue;
+        }
+        switch (message.type) {
+        case IS_BED_MESSAGE_V1:
+            // A version 1 LCD learns the patterns from our frames, its pattern indexes are always current.
+            // Some LCDs add the pattern set after their frame: it is ignored, our frames no longer carry it.
+            if (message.size == sizeof(is_bed_lcd_to_controller_t) || message.size == sizeof(is_bed_lcd_v2_state_t)) {
+                lcd_state_from_frame(is_bed_message_view<is_bed_lcd_to_controller_t>(message), pattern_set);
+                apply_lcd_state();
+            }
+            break;
+        case IS_BED_MESSAGE_HELLO: {
+            const is_bed_hello_t& lcd_hello = is_bed_message_view<is_bed_hello_t>(message);
+            protocol_version = min(lcd_hello.version, (uint8_t)IS_BED_PROTOCOL_VERSION);
+            capabilities = lcd_hello.capabilities;
+            led_preview_lit_flashes = capabilities & IS_BED_CAPABILITY_PATTERN_CLOCK;
+            Serial.printf("LCD speaks protocol version %u\n", protocol_version);
+            if (protocol_version < 2) {
+                break;
+            }
+            is_bed_link_hello(link);
+            // Answer, and start over with the whole state. The LCD asks for the catalog.
+            is_bed_hello_t hello;
+            hello.version = IS_BED_PROTOCOL_VERSION;
+            hello.capabilities = IS_BED_CAPABILITY_PREVIEW | IS_BED_CAPABILITY_UPDATE_PROGRESS | IS_BED_CAPABILITY_PATTERN_CLOCK;
+            uint16_t send_size = transfer.txObj(hello, 0, sizeof(hello));
+            transfer.sendData(send_size, IS_BED_MESSAGE_HELLO);
+            is_bed_state_sender_init(controller_state_sender, protocol_version >= 3 ? is_bed_controller_state_layout
+                                                                                    : is_bed_controller_v2_state_layout);
+            // Only the state of a version 5 LCD has the phases
+            if (protocol_version < 5) {
+                for (uint32_t i = 0; i < NUM_ZONES; i++) {
+                    lcd_state.zones[i].phase = 0;
+                }
+            }
+            catalog_requested = false;
+            break;
+        }
+        case IS_BED_MESSAGE_CATALOG_REQUEST:
+            catalog_requested = true;
+            catalog_next_index = is_bed_message_view<is_bed_catalog_request_t>(message).first_index;
+            break;
+        case IS_BED_MESSAGE_STATE: {
+            // Only the fields that changed are in the message, the others keep their value
+            is_bed_state_header_t header;
+            const bool zone_state = protocol_version >= 3;
+            const is_bed_state_layout_t& layout = protocol_version >= 5 ? is_bed_lcd_state_layout
+                                                  : zone_state            ? is_bed_lcd_v3_state_layout
+                                                                          : is_bed_lcd_v2_state_layout;
+            if (!is_bed_state_apply(layout, zone_state ? (void *)&lcd_state : (void *)&from_lcd_msg, message.payload,
+                                    message.size, &header)) {
+                break;
+            }
+            is_bed_ack_t ack = {header.sequence};
+            uint16_t send_size = transfer.txObj(ack, begin_message(), sizeof(ack));
+            transfer.sendData(send_size, IS_BED_MESSAGE_ACK);
+            // A heartbeat has no fields
+            if (header.changed != 0) {
+                if (!zone_state) {
+                    lcd_state_from_frame(from_lcd_msg.frame, from_lcd_msg.pattern_set);
+                }
+                apply_lcd_state();
+            }
+            break;
+        }
+        case IS_BED_MESSAGE_ACK:
+            is_bed_state_ack(controller_state_sender, is_bed_message_view<is_bed_ack_t>(message));
+            break;
+        case IS_BED_MESSAGE_PING: {
+            // The pong goes out of the send buffer, apart from the receive buffer
+            const is_bed_ping_t& ping = is_bed_message_view<is_bed_ping_t>(message);
+            uint16_t send_size = transfer.txObj(ping, begin_message(), sizeof(ping));
+            transfer.sendData(send_size, IS_BED_MESSAGE_PONG);
+            break;
+        }
+        case IS_BED_MESSAGE_PONG:
+            is_bed_link_pong(link, millis(), is_bed_message_view<is_bed_ping_t>(message));
+            break;
+        case IS_BED_MESSAGE_LINK_STATS:
+            // Kept for the "link" command
+            lcd_link_stats = is_bed_message_view<is_bed_link_stats_t>(message);
+            break;
+        case IS_BED_MESSAGE_TIME_REQUEST: {
+            // Answer right away with the clock of the patterns, see led_refresh()
+            is_bed_time_t time;
+            time.request = is_bed_message_view<is_bed_time_request_t>(message);
+            time.controller_ms = millis();
+            uint16_t send_size = transfer.txObj(time, begin_message(), sizeof(time));
+            transfer.sendData(send_size, IS_BED_MESSAGE_TIME);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+void lcd_link_disconnected() {
+    protocol_version = 1;
+    led_preview_lit_flashes = false;
+}
+
+void lcd_link_patterns_swapped() {
+    to_lcd_pattern_index = 0;
+    // The catalog being sent is stale, the LCD asks for the new one when it sees the new pattern set
+    catalog_requested = false;
+    pattern_set++;
+}
+
+void lcd_link_print_stats() {
+    char text[256];
+    is_bed_link_format(link.stats, text, sizeof(text));
+    Serial.printf("Controller side of the link (LCD speaks version %u):\n%s", protocol_version, text);
+    if (protocol_version >= 4) {
+        is_bed_link_format(lcd_link_stats, text, sizeof(text));
+        Serial.printf("LCD side of the link:\n%s", text);
+    }
+}
+
+// Start a message to the LCD: write the link header if the LCD speaks version 4.
+// Returns where the payload goes.
+static uint16_t begin_message() {
+    if (protocol_version < 4) {
+        return 0;
+    }
+    is_bed_link_header_t header;
+    is_bed_link_send(link, millis(), header);
+    return transfer.txObj(header, 0, sizeof(header));
+}
+
+// SerialTransfer drops the frames it rejects, only its status tells why
+static void count_link_error() {
+    if (transfer.status == CRC_ERROR) {
+        is_bed_link_error(link, true);
+    } else if (transfer.status == PAYLOAD_ERROR || transfer.status == STOP_BYTE_ERROR ||
+               transfer.status == STALE_PACKET_ERROR) {
+        is_bed_link_error(link, false);
+    }
+}
+
+// Give the settings of a version 1 frame, or of the state of a version 2 LCD, to all the zones. They keep
+// their palette. The pattern indexes refer to frame_pattern_set.
+static void lcd_state_from_frame(const is_bed_lcd_to_controller_t& frame, uint8_t frame_pattern_set) {
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        is_bed_zone_state_t& zone = lcd_state.zones[i];
+        zone.selected_pattern_index = frame.selected_pattern_index;
+        zone.displayed_pattern_index = frame.displayed_pattern_index;
+        zone.color = frame.selected_color;
+        zone.palette_index = led_zones[i].palette_index;
+        zone.frequency = frame.frequency;
+        zone.brightness = frame.zone_brightness[i];
+        zone.phase = 0;
+    }
+    lcd_state.pattern_set = frame_pattern_set;
+}
+
+// Apply the state of the LCD to the zones
+static void apply_lcd_state() {
+    // The pattern indexes are ignored while the LCD still uses those of the previous pattern set
+    const bool same_pattern_set = lcd_state.pattern_set == pattern_set;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        const is_bed_zone_state_t& state = lcd_state.zones[i];
+        led_zone_t *zone = &led_zones[i];
+        // Change the selected and displayed patterns
+        if (same_pattern_set && state.selected_pattern_index < num_led_patterns) {
+            zone->led_pattern_index = state.selected_pattern_index;
+        }
+        if (same_pattern_set && state.displayed_pattern_index < num_led_patterns) {
+            zone->ui_pattern_index = state.displayed_pattern_index;
+        }
+        // Change the single color and the palette. The palette is only composed again when they change.
+        const CRGB color(state.color.r, state.color.g, state.color.b);
+        const uint32_t palette_index = state.palette_index < num_led_palettes() ? state.palette_index : zone->palette_index;
+        if (color != zone->single_color || palette_index != zone->palette_index) {
+            led_zone_set_palette(zone, palette_index, color);
+        }
+        // Change the frequency/period, avoiding a division by zero
+        led_zone_set_period(zone, 10000 / max(state.frequency, (uint8_t)1));
+        // Update the brightness
+        zone->brightness = state.brightness;
+        // Shift the cached patterns in their cycle
+        zone->phase_offset = (uint32_t)state.phase << 24;
+    }
+}
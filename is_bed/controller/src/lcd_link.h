@@ -0,0 +1,36 @@
+#ifndef LCD_LINK_H
+#define LCD_LINK_H
+
+#include <Arduino.h>
+#include <is_bed_protocol.h>
+#include <stdint.h>
+
+// The link with the LCD, in the protocol version the LCD speaks (see is_bed_protocol.h). The LCD state
+// it receives is applied to the zones right away.
+// It only depends on the pattern and zone tables, so that it also builds on the host (see host/link_harness).
+
+// The state of the LCD, with the settings of each zone. Before version 3, it is built from the frames of
+// the LCD, whose settings apply to all the zones.
+extern is_bed_lcd_state_t lcd_state;
+
+// Start talking to the LCD over a serial port. The LCD speaks version 1 until it says hello.
+void lcd_link_begin(Stream& port);
+
+// Send what changed to the LCD. update_progress is the progress of the pattern update in percent,
+// or IS_BED_UPDATE_NONE.
+void lcd_link_send(uint8_t update_progress);
+
+// Handle the messages received from the LCD
+void lcd_link_receive();
+
+// The LCD was disconnected: the next one speaks version 1 until it says hello
+void lcd_link_disconnected();
+
+// The patterns were replaced. The LCD learns the new catalog, and from version 2 its pattern indexes are ignored
+// until then.
+void lcd_link_patterns_swapped();
+
+// Print the counters of both sides of the link on the serial port
+void lcd_link_print_stats();
+
+#endif // LCD_LINK_H
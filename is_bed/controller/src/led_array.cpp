@@ -23,6 +23,9 @@ led_zone_t led_zones[] = {
         .single_color = default_single_color,
         .palette_index = default_palette_index,
         .update_period_ms = default_update_period_ms,
+        .speed = 256,
+        .phase_offset = 0,
+        .pattern_clock = 0,
         .max_brightness = 128,
         .brightness = default_brightness,
     },
@@ -33,6 +36,9 @@ led_zone_t led_zones[] = {
         .single_color = default_single_color,
         .palette_index = default_palette_index,
         .update_period_ms = default_update_period_ms,
+        .speed = 256,
+        .phase_offset = 0,
+        .pattern_clock = 0,
         .max_brightness = 170,
         .brightness = default_brightness,
     },
@@ -43,6 +49,9 @@ led_zone_t led_zones[] = {
         .single_color = default_single_color,
         .palette_index = default_palette_index,
         .update_period_ms = default_update_period_ms,
+        .speed = 256,
+        .phase_offset = 0,
+        .pattern_clock = 0,
         .max_brightness = 170,
         .brightness = default_brightness,
     },
@@ -53,6 +62,9 @@ led_zone_t led_zones[] = {
         .single_color = default_single_color,
         .palette_index = default_palette_index,
         .update_period_ms = default_update_period_ms,
+        .speed = 256,
+        .phase_offset = 0,
+        .pattern_clock = 0,
         .max_brightness = 255,
         .brightness = default_brightness,
     },
@@ -297,13 +309,60 @@ led_string_t led_strings[] = {
     },
     {
         .name = "Headboard",
-        .num_segments = sizeof(headboard_segments) / sizeof(headboard_segments[0]),
+        .num_leds = leds_in_string(headboard_segments),
+        .num_segments = segments_in_string(headboard_segments),
         .segments = headboard_segments,
         .channel = 5,
     },
 };
 
 void led_array_init() {
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        led_zone_set_palette(&led_zones[i], led_zones[i].palette_index, led_zones[i].single_color);
+    }
+}
+
+void led_zone_set_period(led_zone_t *zone, uint32_t period_ms) {
+    zone->update_period_ms = period_ms;
+    // Cached patterns play at their own period for the default period
+    uint32_t speed = (uint32_t)default_update_period_ms * 256 / max(period_ms, (uint32_t)1);
+    zone->speed = constrain(speed, (uint32_t)1, (uint32_t)0xFFFF);
+}
+
+void led_zone_set_palette(led_zone_t *zone, uint32_t palette_index, CRGB color) {
+    zone->palette_index = palette_index;
+    zone->single_color = color;
+    zone->palette = *composed_palette(&led_palettes[palette_index], color);
+}
+
+void led_segment_render(uint32_t string_index, uint32_t segment_index, uint32_t pattern_index, uint32_t time_ms,
+                        uint32_t previous_time_ms, CRGB *leds) {
+    const led_segment_t *segment = &led_strings[string_index].segments[segment_index];
+    const led_zone_t *zone = &led_zones[segment->zone];
+    led_pattern_t& pattern = led_patterns[pattern_index];
+    led_pattern_params_t params;
+    params.time_ms = time_ms;
+    params.previous_time_ms = previous_time_ms;
+    params.display_only = pattern_index != zone->led_pattern_index;
+    params.period_ms = zone->update_period_ms;
+    params.pattern_clock = zone->pattern_clock;
+    params.phase_offset = zone->phase_offset;
+    params.palette = &zone->palette;
+    params.single_color = zone->single_color;
+    params.cached_pattern = pattern.cached_pattern;
+    params.string_index = string_index;
+    params.segment_index = segment_index;
+    params.num_leds = segment->num_leds;
+    params.leds = leds;
+    pattern.update(params);
+}
+
+uint32_t leds_in_topology() {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < num_strings; i++) {
+        total += led_strings[i].num_leds;
+    }
+    return total;
 }
 
 void led_array_save() {
@@ -71,8 +71,16 @@ typedef struct
     uint8_t color_ordering;
     // The index of the palette currently used by the zone
     uint32_t palette_index;
+    // That palette, composed with the single color if it asks for it (see led_zone_set_palette())
+    CRGBPalette16 palette;
     // The period of the pattern update in milliseconds
     uint32_t update_period_ms;
+    // The playback speed of cached patterns, in 1/256th (256 plays them at their own period)
+    uint16_t speed;
+    // The offset of cached patterns in their cycle, as a fraction of 2^32. The LCD sets it from version 5.
+    uint32_t phase_offset;
+    // The zone clock, in 1/256th of a ms. It runs at the playback speed.
+    uint64_t pattern_clock;
     // The maximum allowed brightness for the zone. Used to limit the total power draw.
     uint8_t max_brightness;
     // The brightness of the zone (0->255), will be rescaled by the max_brightness before outputting to the LEDs.
@@ -97,6 +105,16 @@ extern CRGB leds_crgb[max_leds_per_channel];
 void led_array_init();
 void led_array_save();
 void led_array_load();
+// Total number of LEDs of all the strings
+uint32_t leds_in_topology();
+// Set the pattern period of a zone, and the matching cached pattern playback speed
+void led_zone_set_period(led_zone_t *zone, uint32_t period_ms);
+// Set the palette and single color of a zone. The palette is composed here rather than for each frame.
+void led_zone_set_palette(led_zone_t *zone, uint32_t palette_index, CRGB color);
+// Render the pixels of a segment with a pattern and the settings of its zone. display_only is set if the pattern
+// is not the one the zone plays on the LEDs.
+void led_segment_render(uint32_t string_index, uint32_t segment_index, uint32_t pattern_index, uint32_t time_ms,
+                        uint32_t previous_time_ms, CRGB *leds);
 
 // Static function to count total number of LEDs addressed by the pattern.
 template <std::size_t N>
@@ -6,10 +6,6 @@
 led_pattern_t led_patterns[MAX_LED_PATTERNS];
 uint32_t num_led_patterns = 0;
 
-// The time at which the last strobe happened, both for real and on the LCD
-static uint32_t last_strobe_time_ms = 0;
-static uint32_t last_display_strobe_time_ms = 0;
-
 // Set all the LEDs to the palette color, regardless of time
 void static_pattern(led_pattern_params_t p) {
     for (uint32_t i = 0; i < p.num_leds; i++) {
@@ -54,19 +50,9 @@ void blink_pattern(led_pattern_params_t p) {
 
 // Strobe all the LEDs on a palette
 void strobe_pattern(led_pattern_params_t p) {
-    // Figure out if enough time elapsed since last strobe
-    uint32_t& last_time_ms = p.display_only ? last_display_strobe_time_ms : last_strobe_time_ms;
-    uint32_t time_since_last_strobe_ms = p.time_ms - last_time_ms;
-    bool on = false;
-    // If this is far enough from the last strobe, turn on
-    if (time_since_last_strobe_ms >= p.period_ms) {
-        last_time_ms = p.time_ms;
-        on = true;
-    }
-    // If this is the same time as the last strobe, keep on
-    if (time_since_last_strobe_ms == 0) {
-        on = true;
-    }
+    // Flash for one update at the start of each period. This only depends on the times given, so each zone
+    // strobes at its own period.
+    const bool on = p.time_ms / p.period_ms != p.previous_time_ms / p.period_ms;
     // Set the LEDs
     for (uint32_t i = 0; i < p.num_leds; i++) {
         if (on) {
@@ -80,55 +66,45 @@ void strobe_pattern(led_pattern_params_t p) {
 void cached_pattern(led_pattern_params_t p) {
     led_string_t *led_string = &led_strings[p.string_index];
     cached_pattern_t& pattern = *(p.cached_pattern);
-    const uint32_t period_ms = pattern.header.animation_period_s * 1000;
-    const uint32_t step = (p.time_ms * p.cached_pattern->header.animation_steps / period_ms) % pattern.header.animation_steps;
+    const uint32_t steps = pattern.header.animation_steps;
+    // Position in the cycle, as a fraction of 2^32, rounded up so that the steps start exactly on time.
+    // The zone clock already includes the speed, so the position only depends on the current time
+    // and never needs the intermediate steps.
+    const uint64_t period_ms = cached_pattern_period_ms(pattern);
+    const uint64_t cycle_time = p.pattern_clock % (period_ms << 8);
+    const uint32_t phase = ((cycle_time << 24) + period_ms - 1) / period_ms + p.phase_offset;
+    fract8 fraction;
+    const uint32_t step = cached_pattern_locate(pattern, phase, &fraction);
 
-    // Seek to offset where to start reading LED data
-    uint64_t pos = sizeof(cached_pattern_header_t);
-    pos += pattern.header.num_pixels * step * sizeof(CRGB);
+    // Offset, in pixels, of the segment within the topology
+    uint32_t pixel_offset = led_string->segments[p.segment_index].string_offset;
     for (uint32_t i = 0; i < p.string_index; i++) {
-        pos += led_strings[i].num_leds * sizeof(CRGB);
-    }
-    for (uint32_t i = 0; i < p.segment_index; i++) {
-        pos += led_string->segments[i].num_leds * sizeof(CRGB);
+        pixel_offset += led_strings[i].num_leds;
     }
-    pattern.file.seek(pos);
 
-    // Read LED data for segment.
-    for (uint32_t i = 0; i < p.num_leds; i++) {
-        pattern.file.read(&p.leds[i], sizeof(CRGB));
+    // Copy the LED data of the segment, blending with the next step if the pattern asks for it
+    const CRGB *frame = cached_pattern_frame(pattern, step);
+    if ((pattern.ext.flags & CACHED_PATTERN_FLAG_INTERPOLATE) && fraction != 0) {
+        const CRGB *next_frame = cached_pattern_frame(pattern, (step + 1) % steps);
+        blend(frame + pixel_offset, next_frame + pixel_offset, p.leds, p.num_leds, fraction);
+    } else {
+        memcpy(p.leds, frame + pixel_offset, p.num_leds * sizeof(CRGB));
     }
 }
 
 // Add a cached patterns to the patterns array
 void add_cached_patterns() {
     for (uint32_t i = 0; i < num_cached_patterns; i++) {
-        if (num_led_patterns < MAX_LED_PATTERNS) {
-            // We use the filename to name the pattern, but we have to do some sanitizing.
-            // Remove the file extension
-            String name = cached_patterns[i].filepath;
-            Serial.print("Adding cached pattern: " + name);
-            name = name.substring(name.lastIndexOf('/') + 1);
-            int dot_index = name.lastIndexOf('.');
-            if (dot_index != -1) {
-                name.remove(dot_index);
-            }
-            // Replace the underscores with spaces and adjust the case
-            name.replace('_', ' ');
-            name.toLowerCase();
-            // Remove any leading numbers or spaces
-            while (name.length() > 0 && (isdigit(name.charAt(0)) || name.charAt(0) == ' ')) {
-                name.remove(0, 1);
-            }
-            // Capitalize the first letter of each word
-            for (unsigned int j = 0; j < name.length(); j++) {
-                if (j == 0 || name.charAt(j - 1) == ' ') {
-                    name.setCharAt(j, toupper(name.charAt(j)));
-                }
-            }
-            Serial.println(" -> " + name);
+        // Keep the slots of the built-in patterns
+        if (num_led_patterns >= MAX_LED_PATTERNS - NUM_BUILTIN_LED_PATTERNS) {
+            Serial.printf("Warning: no room left for cached pattern %s\n", cached_patterns[i].filepath.c_str());
+        } else {
+            Serial.print("Adding cached pattern: ");
+            Serial.print(cached_patterns[i].filepath);
+            Serial.print(" -> ");
+            Serial.println(cached_patterns[i].name);
             // Now we can fill the struct
-            led_patterns[num_led_patterns].name = name;
+            led_patterns[num_led_patterns].name = cached_patterns[i].name;
             led_patterns[num_led_patterns].cached_pattern = &cached_patterns[i];
             led_patterns[num_led_patterns].update = cached_pattern;
             num_led_patterns++;
@@ -19,8 +19,14 @@ extern void add_static_pattern();
 typedef struct {
     // The current time, in ms
     uint32_t time_ms;
+    // The time of the previous update of the zone, in ms
+    uint32_t previous_time_ms;
     // The period to use for the pattern, in ms
     uint32_t period_ms;
+    // The zone clock, in 1/256th of a ms, for cached patterns. It runs at the zone playback speed.
+    uint64_t pattern_clock;
+    // The offset of cached patterns in their cycle, as a fraction of 2^32
+    uint32_t phase_offset;
     // The palette to use to render the LEDs, if the pattern wants to use a palette
     const CRGBPalette16 *palette;
     // The single color to use, if the pattern wants a single color
@@ -42,6 +48,14 @@ typedef struct {
 // An LED pattern function
 typedef void (*led_pattern_func_t)(led_pattern_params_t params);
 
+// The pattern functions
+void static_pattern(led_pattern_params_t p);
+void rotate_pattern(led_pattern_params_t p);
+void fade_pattern(led_pattern_params_t p);
+void blink_pattern(led_pattern_params_t p);
+void strobe_pattern(led_pattern_params_t p);
+void cached_pattern(led_pattern_params_t p);
+
 // This struct is used to describe an LED pattern, which will drive a string of LEDs
 typedef struct
 {
@@ -53,8 +67,14 @@ typedef struct
     led_pattern_func_t update;
 } led_pattern_t;
 
-// The maximum number of LED patterns supported
+// The maximum number of LED patterns supported. The pattern indexes of the LCD protocol are 8 bit,
+// and the LCD keeps a table of the same size (see lcd/src/ui/pattern_slider.h).
 #define MAX_LED_PATTERNS 64
+// The built-in patterns (strobe and static), added after the cached patterns
+#define NUM_BUILTIN_LED_PATTERNS 2
+// The maximum number of cached patterns, the other slots being kept for the built-in patterns.
+// The pattern files after that, in alphabetical order, are skipped.
+#define MAX_CACHED_LED_PATTERNS (MAX_LED_PATTERNS - NUM_BUILTIN_LED_PATTERNS)
 // A table of all the LED patterns available
 extern led_pattern_t led_patterns[];
 extern uint32_t num_led_patterns;
@@ -0,0 +1,131 @@
+#include "led_preview.h"
+#include "led_pattern.h"
+#include <Arduino.h>
+
+is_bed_segment_preview_t led_preview;
+uint16_t led_preview_colors[IS_BED_PREVIEW_MAX_SEGMENTS];
+bool led_preview_lit_flashes = false;
+// Index of the first segment of each zone in the colors
+static uint8_t first_segment[NUM_ZONES];
+
+//
+// Static function prototypes
+//
+static bool shown_lit(uint32_t pattern_index);
+
+void led_preview_init() {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        uint32_t count = 0;
+        for (uint32_t j = 0; j < num_strings; j++) {
+            for (uint32_t k = 0; k < led_strings[j].num_segments; k++) {
+                count += led_strings[j].segments[k].zone == i;
+            }
+        }
+        count = min(count, IS_BED_PREVIEW_MAX_SEGMENTS - total);
+        first_segment[i] = total;
+        led_preview.num_segments[i] = count;
+        total += count;
+    }
+}
+
+uint32_t led_preview_num_segments() {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        total += led_preview.num_segments[i];
+    }
+    return total;
+}
+
+void led_preview_segment(uint8_t zone, uint8_t zone_segment, const CRGB *leds, uint32_t num_leds) {
+    if (zone_segment >= led_preview.num_segments[zone] || num_leds == 0) {
+        return;
+    }
+    uint32_t total_red = 0;
+    uint32_t total_green = 0;
+    uint32_t total_blue = 0;
+    for (uint32_t i = 0; i < num_leds; i++) {
+        total_red += leds[i].red;
+        total_green += leds[i].green;
+        total_blue += leds[i].blue;
+    }
+    led_preview_colors[first_segment[zone] + zone_segment] =
+        is_bed_rgb565(total_red / num_leds, total_green / num_leds, total_blue / num_leds);
+}
+
+bool led_preview_from_leds(const led_zone_t *zone) {
+    return zone->ui_pattern_index == zone->led_pattern_index && !shown_lit(zone->ui_pattern_index);
+}
+
+void led_preview_displayed_patterns() {
+    static uint32_t previous_ms = 0;
+    const uint32_t now = millis();
+    uint8_t zone_segment[NUM_ZONES] = {};
+    for (uint32_t i = 0; i < num_strings; i++) {
+        const led_string_t *led_string = &led_strings[i];
+        for (uint32_t j = 0; j < led_string->num_segments; j++) {
+            const led_segment_t *segment = &led_string->segments[j];
+            const led_zone_t *zone = &led_zones[segment->zone];
+            if (!led_preview_from_leds(zone)) {
+                // The patterns that flash are lit at the start of their period, right after the update before it
+                if (shown_lit(zone->ui_pattern_index)) {
+                    led_segment_render(i, j, zone->ui_pattern_index, 0, UINT32_MAX, leds_crgb);
+                } else {
+                    led_segment_render(i, j, zone->ui_pattern_index, now, previous_ms, leds_crgb);
+                }
+                led_preview_segment(segment->zone, zone_segment[segment->zone], leds_crgb, segment->num_leds);
+            }
+            zone_segment[segment->zone]++;
+        }
+    }
+    previous_ms = now;
+}
+
+void led_preview_zone_colors(color_rgb_t zone_color[]) {
+    // Compute the average color of the LEDs in each string.
+    const uint32_t num_leds = 16;
+    static uint32_t previous_ms = 0;
+    uint32_t now = millis();
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        CRGB leds[num_leds];
+        led_pattern_params_t params;
+        params.time_ms = now;
+        params.previous_time_ms = previous_ms;
+        params.display_only = true;
+        params.period_ms = led_zones[i].update_period_ms;
+        params.pattern_clock = led_zones[i].pattern_clock;
+        params.phase_offset = led_zones[i].phase_offset;
+        params.palette = &led_zones[i].palette;
+        params.single_color = led_zones[i].single_color;
+        params.cached_pattern = led_patterns[led_zones[i].ui_pattern_index].cached_pattern;
+        params.string_index = 0;
+        params.segment_index = 0;
+        params.num_leds = num_leds;
+        params.leds = leds;
+        led_patterns[led_zones[i].ui_pattern_index].update(params);
+        uint32_t total_red = 0;
+        uint32_t total_green = 0;
+        uint32_t total_blue = 0;
+        for (uint32_t j = 0; j < num_leds; j++) {
+            CRGB color = leds[j];
+            total_red += color.red;
+            total_green += color.green;
+            total_blue += color.blue;
+        }
+        // Don't use the brightness scaling. That will make sure that the display always shows the pattern even if the
+        // zones are currently dimmed.
+        zone_color[i].r = total_red / num_leds;
+        zone_color[i].g = total_green / num_leds;
+        zone_color[i].b = total_blue / num_leds;
+    }
+    previous_ms = now;
+}
+
+// Whether a pattern flashes and is shown lit, for the LCD to animate it
+static bool shown_lit(uint32_t pattern_index) {
+    if (!led_preview_lit_flashes) {
+        return false;
+    }
+    const is_bed_pattern_type_t type = pattern_type(&led_patterns[pattern_index]);
+    return type == IS_BED_PATTERN_BLINK || type == IS_BED_PATTERN_STROBE;
+}
@@ -0,0 +1,42 @@
+#ifndef LED_PREVIEW_H
+#define LED_PREVIEW_H
+
+#include "led_array.h"
+#include <is_bed_protocol.h>
+#include <stdint.h>
+
+// Preview of the output for the LCD: a color per segment, or a color per zone for the LCDs that can't show
+// segments. The zones for which the LCD displays another pattern than the one on the LEDs show that pattern.
+// The LCDs that follow the pattern clock animate the patterns that flash themselves: these are shown lit.
+
+// The segment preview (see is_bed_segment_preview_t), and the colors of its segments in zone order,
+// updated as the LEDs are refreshed
+extern is_bed_segment_preview_t led_preview;
+extern uint16_t led_preview_colors[IS_BED_PREVIEW_MAX_SEGMENTS];
+
+// Whether the LCD animates the patterns that flash itself (see IS_BED_CAPABILITY_PATTERN_CLOCK)
+extern bool led_preview_lit_flashes;
+
+// Count the segments of each zone. The zones that don't fit in IS_BED_PREVIEW_MAX_SEGMENTS lose their last
+// segments. Must be called after led_array_init().
+void led_preview_init();
+
+// Total number of segments of the preview
+uint32_t led_preview_num_segments();
+
+// Set the preview color of a segment, from its pixels. zone_segment is the index of the segment among
+// those of its zone.
+void led_preview_segment(uint8_t zone, uint8_t zone_segment, const CRGB *leds, uint32_t num_leds);
+
+// Whether the preview of a zone is taken from its LEDs as they are refreshed. It is rendered apart when the
+// LCD displays another pattern, or when the pattern flashes and is shown lit.
+bool led_preview_from_leds(const led_zone_t *zone);
+
+// Set the preview colors of the zones that are not taken from the LEDs. Renders into leds_crgb,
+// so it must not be called during an LED refresh.
+void led_preview_displayed_patterns();
+
+// Compute the color to display for each zone, the average color of the pattern the LCD displays
+void led_preview_zone_colors(color_rgb_t zone_color[]);
+
+#endif // LED_PREVIEW_H
@@ -1,14 +1,17 @@
 #include "led_array.h"
 #include "led_pattern.h"
+#include "led_preview.h"
+#include "lcd_link.h"
 #include "cached_pattern.h"
 #include "usb_update.h"
+#include "sd_benchmark.h"
+#include "pattern_store.h"
 #include <Arduino.h>
 #include <OctoWS2811.h>
 #include <Wire.h>
 #include <SD.h>
 #include <MTP_Teensy.h>
 #include <USBHost_t36.h>
-#include <SerialTransfer.h>
 #include <is_bed_protocol.h>
 #include <FastLED.h>
 
@@ -35,23 +38,21 @@ OctoWS2811 leds(max_leds_per_channel, display_memory, drawing_memory, config, nu
 USBHost usb_host;
 // USB serial port over USB host
 USBSerial_BigBuffer usb_host_serial(usb_host);  // BigBuffer helps avoid drops if you burst data
-SerialTransfer lcd_transfer;
 // Mass storage device over USB host
 USBDrive usb_drive(usb_host);
 USBFilesystem usb_filesystem(usb_host);
-// Data transfer structs
-is_bed_controller_to_lcd_t to_lcd_msg;
-is_bed_lcd_to_controller_t from_lcd_msg;
 
 // Function prototypes
 static void led_refresh();
-static void compute_display_colors(color_rgb_t zone_color[]);
+static void handle_serial_commands();
+static void benchmark_background();
+static void swap_patterns();
+static uint32_t find_pattern(const String& name);
 
 // Last time the LEDs were refreshed
 unsigned long last_tick = 0;
-
-// Last pattern that we did output to the LCD
-uint8_t to_lcd_pattern_index = 0;
+// Time of the last LED refresh, to advance the zone clocks
+uint32_t last_refresh_ms = 0;
 
 // Was the SD card initialized?
 bool sd_initialized = false;
@@ -76,6 +77,7 @@ void setup() {
 
     // Initialize the led array descriptors
     led_array_init();
+    led_preview_init();
 
     // Start the LEDs
     leds.begin();
@@ -83,9 +85,16 @@ void setup() {
     // Add the patterns fron the SD Card
     if (SD.begin(SD_ChipSelect)) {
         Serial.println("SD Card initialized");
+        // Finish or drop a pattern update interrupted by a reset
+        usb_update_recover();
         // Load the cached patterns from the SD card
         Serial.println("Loading patterns from SD card");
         load_cached_patterns();
+        // Mirror the selected patterns in the flash store, if there is one. The files are copied
+        // in the background, the patterns are read from the SD card meanwhile.
+        if (pattern_store_begin()) {
+            pattern_store_mirror_start();
+        }
         add_cached_patterns();
 
         // Start MTP
@@ -101,7 +110,7 @@ void setup() {
 
     // USB host
     usb_host.begin();
-    lcd_transfer.begin(usb_host_serial);
+    lcd_link_begin(usb_host_serial);
 
     // We are done. Don't change the LEDs yet, we will do that when 
     // we detect connection to the LCD.
@@ -116,6 +125,13 @@ void loop() {
     constexpr unsigned long PERIOD_MS = 1000 / LED_REFRESH_RATE_HZ;
     if (now - last_tick >= PERIOD_MS) {
         last_tick = now;
+        // Swap in the patterns of a finished update between two frames
+        if (usb_update_state() == USB_UPDATE_READY) {
+            swap_patterns();
+        } else if (usb_update_state() == USB_UPDATE_FAILED) {
+            Serial.println("Error copying .bin files to SD card, keeping the current patterns");
+            usb_update_cancel();
+        }
         // Refresh the LEDs
         led_refresh();
         // Send data to the LCD
@@ -126,52 +142,15 @@ void loop() {
                 usb_device_connected = true;
                 digitalWrite(STATUS_RED, LOW);
             }
-            // Prepare data
-            to_lcd_msg.pattern_index = to_lcd_pattern_index;
-            led_patterns[to_lcd_pattern_index].name.toCharArray(to_lcd_msg.pattern_name, sizeof(to_lcd_msg.pattern_name));
-            to_lcd_msg.pattern_type = pattern_type(&led_patterns[to_lcd_pattern_index]);
-            to_lcd_pattern_index = (to_lcd_pattern_index + 1) % num_led_patterns;
-            compute_display_colors(to_lcd_msg.zone_color);
-            // Send data
-            uint16_t send_size = lcd_transfer.txObj(to_lcd_msg, 0, sizeof(to_lcd_msg));
-            lcd_transfer.sendData(send_size);
+            lcd_link_send(usb_update_state() == USB_UPDATE_RUNNING ? usb_update_progress() : IS_BED_UPDATE_NONE);
+        } else {
+            lcd_link_disconnected();
         }
 
     }
 
     // Listen for messages from the LCD
-    while (lcd_transfer.available()) {
-        lcd_transfer.rxObj(from_lcd_msg);
-        // Change the selected pattern
-        for (uint32_t i = 0; i < NUM_ZONES; i++) {
-            if (from_lcd_msg.selected_pattern_index < num_led_patterns) {
-                led_zones[i].led_pattern_index = from_lcd_msg.selected_pattern_index;
-            }
-        }
-        // Change the displayed pattern
-        for (uint32_t i = 0; i < NUM_ZONES; i++) {
-            if (from_lcd_msg.displayed_pattern_index < num_led_patterns) {
-                led_zones[i].ui_pattern_index = from_lcd_msg.displayed_pattern_index;
-            }
-        }
-        // Change the single color
-        for (uint32_t i = 0; i < NUM_ZONES; i++) {
-            led_zones[i].single_color.r = from_lcd_msg.selected_color.r;
-            led_zones[i].single_color.g = from_lcd_msg.selected_color.g;
-            led_zones[i].single_color.b = from_lcd_msg.selected_color.b;
-        }
-        // Change the frequency/period
-        for (uint32_t i = 0; i < NUM_ZONES; i++) {
-            if (from_lcd_msg.frequency == 0) {
-                from_lcd_msg.frequency = 1; // Avoid division by zero
-            }
-            led_zones[i].update_period_ms = 10000 / from_lcd_msg.frequency;
-        }
-        // Update the brightness
-        for (uint32_t i = 0; i < NUM_ZONES; i++) {
-            led_zones[i].brightness = from_lcd_msg.zone_brightness[i];
-        }
-    }
+    lcd_link_receive();
 
     // Check if we see a USB mass storage device
     if (usb_filesystem && !usb_device_connected) {
@@ -181,31 +160,13 @@ void loop() {
         digitalWrite(STATUS_RED, LOW);
         // Device is present. Let's look for the right files
         Serial.println("Looking for .bin files on USB drive...");
-        if (usb_has_bins()) {
+        if (sd_initialized && usb_has_bins()) {
             Serial.println("Found .bin files on USB drive");
-            // Remove all existing patterns
-            Serial.println("Removing existing .bin files from SD card");
-            sd_remove_bins();
-            // Copy the new files
+            // Copy the new files in the background, the current patterns are swapped out once they are all there
             Serial.println("Copying .bin files from USB drive to SD card");
-            if (copy_bins_from_usb_to_sd()) {
-                Serial.println("Successfully copied .bin files to SD card");
-            } else {
+            if (!usb_update_start(USB_UPDATE_TRANSCODE)) {
                 Serial.println("Error copying .bin files to SD card");
             }
-            // Reload the cached patterns from the SD card
-            Serial.println("Reloading patterns");
-            num_led_patterns = 0;
-            for (uint32_t i = 0; i < NUM_ZONES; i++) {
-                led_zones[i].led_pattern_index = 0;
-                led_zones[i].ui_pattern_index = 0;
-            }
-            if (sd_initialized) {
-                load_cached_patterns();
-                add_cached_patterns();
-            }
-            add_strobe_pattern();
-            add_static_pattern();
         }
         digitalWrite(STATUS_RED, LOW);
     }
@@ -215,37 +176,141 @@ void loop() {
         if (usb_device_connected) {
             Serial.println("USB device disconnected");
         }
+        if (usb_update_state() == USB_UPDATE_RUNNING) {
+            Serial.println("USB drive removed, pattern update abandoned");
+            usb_update_cancel();
+        }
         digitalWrite(STATUS_RED, HIGH);
         usb_device_connected = false;
     }
 
     // Update MTP
     if (sd_initialized) {
+        // Don't keep stale handles around while the host edits the SD card
+        cached_pattern_close_idle_files();
         MTP.loop();
     }
+
+    // Copy a bit more of the pattern update
+    if (usb_update_state() == USB_UPDATE_RUNNING) {
+        usb_update_step();
+    }
+
+    // Copy a bit more of the flash mirror
+    pattern_store_mirror_step();
+
+    // Debug commands from the USB serial port
+    handle_serial_commands();
+}
+
+// Replace the patterns with those of a finished USB update.
+// The zones keep playing the same patterns if they are still there.
+static void swap_patterns() {
+    Serial.println("Successfully copied .bin files to SD card");
+    String selected_names[NUM_ZONES];
+    String displayed_names[NUM_ZONES];
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        selected_names[i] = led_patterns[led_zones[i].led_pattern_index].name;
+        displayed_names[i] = led_patterns[led_zones[i].ui_pattern_index].name;
+    }
+    // Stop reading the old files before they are replaced
+    pattern_store_mirror_cancel();
+    num_led_patterns = 0;
+    for (uint32_t i = 0; i < num_cached_patterns; i++) {
+        cached_pattern_close(cached_patterns[i]);
+    }
+    if (!usb_update_commit()) {
+        Serial.println("Error swapping in the new .bin files");
+    }
+    // Reload the cached patterns from the SD card
+    Serial.println("Reloading patterns");
+    load_cached_patterns();
+    // Mirror the new patterns in the background, they are read from the SD card meanwhile
+    pattern_store_mirror_start();
+    add_cached_patterns();
+    add_strobe_pattern();
+    add_static_pattern();
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        led_zones[i].led_pattern_index = find_pattern(selected_names[i]);
+        led_zones[i].ui_pattern_index = find_pattern(displayed_names[i]);
+    }
+    lcd_link_patterns_swapped();
+}
+
+// Find a pattern by name. Returns 0 if there is no such pattern.
+static uint32_t find_pattern(const String& name) {
+    for (uint32_t i = 0; i < num_led_patterns; i++) {
+        if (led_patterns[i].name == name) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Maximum length of a serial command
+#define SERIAL_COMMAND_LENGTH 32
+char serial_command[SERIAL_COMMAND_LENGTH];
+uint32_t serial_command_length = 0;
+
+// Read and run the commands typed on the USB serial port
+//   bench     SD card benchmark
+//   bench bg  SD card benchmark, with MTP and USB host servicing between the reads
+//   link      Counters of the link with the LCD, on both sides
+static void handle_serial_commands() {
+    while (Serial.available()) {
+        char c = Serial.read();
+        if (c != '\n' && c != '\r') {
+            if (serial_command_length < SERIAL_COMMAND_LENGTH - 1) {
+                serial_command[serial_command_length++] = c;
+            }
+            continue;
+        }
+        serial_command[serial_command_length] = '\0';
+        serial_command_length = 0;
+        if (strcmp(serial_command, "bench") == 0 || strcmp(serial_command, "bench bg") == 0) {
+            if (!sd_initialized) {
+                Serial.println("No SD card");
+                continue;
+            }
+            sd_benchmark_run(strcmp(serial_command, "bench") == 0 ? nullptr : benchmark_background);
+        } else if (strcmp(serial_command, "link") == 0) {
+            lcd_link_print_stats();
+        } else if (serial_command[0] != '\0') {
+            Serial.print("Unknown command: ");
+            Serial.println(serial_command);
+        }
+    }
+}
+
+// The traffic that competes with the pattern reads in the main loop
+static void benchmark_background() {
+    usb_host.Task();
+    MTP.loop();
 }
 
 // Refresh the LEDs
 static void led_refresh() {
     uint32_t now = millis();
+    const uint32_t previous_ms = last_refresh_ms;
+    // Advance the zone clocks at their playback speed
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        led_zones[i].pattern_clock += (uint64_t)(now - last_refresh_ms) * led_zones[i].speed;
+    }
+    last_refresh_ms = now;
+    // Index of the next segment of each zone in the preview
+    uint8_t zone_segment[NUM_ZONES] = {};
     for (uint32_t i = 0; i < num_strings; i++) {
         led_string_t *led_string = &led_strings[i];
         for (uint32_t j = 0; j < led_string->num_segments; j++) {
             led_segment_t *segment = &led_string->segments[j];
             led_zone_t *zone = &led_zones[segment->zone];
-            led_pattern_params_t params;
-            led_pattern_t& pattern = led_patterns[zone->led_pattern_index];
-            params.time_ms = now;
-            params.display_only = false;
-            params.period_ms = zone->update_period_ms;
-            params.palette = composed_palette(&led_palettes[zone->palette_index], zone->single_color);
-            params.single_color = zone->single_color;
-            params.cached_pattern = pattern.cached_pattern;
-            params.string_index = i;
-            params.segment_index = j;
-            params.num_leds = segment->num_leds;
-            params.leds = leds_crgb + segment->string_offset;
-            pattern.update(params);
+            led_segment_render(i, j, zone->led_pattern_index, now, previous_ms, leds_crgb + segment->string_offset);
+            // The preview shows these pixels, unless it is rendered apart for the zone
+            if (led_preview_from_leds(zone)) {
+                led_preview_segment(segment->zone, zone_segment[segment->zone], leds_crgb + segment->string_offset,
+                                    segment->num_leds);
+            }
+            zone_segment[segment->zone]++;
             for (uint32_t k = segment->string_offset; k < segment->string_offset + segment->num_leds; k++) {
                 uint32_t color_u32 = 0x000000;
                 // Apply gamma correction.
@@ -296,40 +361,3 @@ static void led_refresh() {
         led_beat_counter = 0;
     }
 }
-
-// Compute the colors to display for each zone on the LCD for the current selected pattern
-static void compute_display_colors(color_rgb_t zone_color[]) {
-    // Compute the average color of the LEDs in each string.
-    const uint32_t num_leds = 16;
-    uint32_t now = millis();
-    for (uint32_t i = 0; i < NUM_ZONES; i++) {
-        CRGB leds[num_leds];
-        led_pattern_params_t params;
-        params.time_ms = now;
-        params.display_only = true;
-        params.period_ms = led_zones[i].update_period_ms;
-        params.palette = composed_palette(&led_palettes[led_zones[i].palette_index], led_zones[i].single_color);
-        params.single_color = led_zones[i].single_color;
-        params.cached_pattern = led_patterns[led_zones[i].ui_pattern_index].cached_pattern;
-        params.string_index = 0;
-        params.segment_index = 0;
-        params.num_leds = num_leds;
-        params.leds = leds;
-        led_patterns[led_zones[i].ui_pattern_index].update(params);
-        uint32_t total_red = 0;
-        uint32_t total_green = 0;
-        uint32_t total_blue = 0;
-        for (uint32_t j = 0; j < num_leds; j++) {
-            CRGB color = leds[j];
-            total_red += color.red;
-            total_green += color.green;
-            total_blue += color.blue;
-        }
-        // Don't use the brightness scaling. That will make sure that the display always shows the pattern even if the
-        // zones are currently dimmed.
-        zone_color[i].r = total_red / num_leds;
-        zone_color[i].g = total_green / num_leds;
-        zone_color[i].b = total_blue / num_leds;
-    }
-
-}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "pattern_manifest.h"
+#include "file_checksum.h"
+#include <SD.h>
+
+pattern_manifest_entry_t *pattern_manifest_load(uint32_t *num_entries, uint32_t *signature) {
+    File file = SD.open(PATTERN_MANIFEST_PATH);
+    if (!file) {
+        return nullptr;
+    }
+    pattern_manifest_header_t header;
+    if (file.read(&header, sizeof(header)) != sizeof(header) ||
+        header.magic != PATTERN_MANIFEST_MAGIC ||
+        header.version != PATTERN_MANIFEST_VERSION ||
+        header.entry_size != sizeof(pattern_manifest_entry_t) ||
+        file.size() != sizeof(header) + (uint64_t)header.num_entries * sizeof(pattern_manifest_entry_t)) {
+        Serial.println("Ignoring invalid pattern manifest");
+        file.close();
+        return nullptr;
+    }
+    pattern_manifest_entry_t *entries = new pattern_manifest_entry_t[header.num_entries];
+    const size_t entries_size = header.num_entries * sizeof(pattern_manifest_entry_t);
+    if (file.read(entries, entries_size) != entries_size) {
+        delete[] entries;
+        file.close();
+        return nullptr;
+    }
+    file.close();
+    if (file_checksum_add(FILE_CHECKSUM_EMPTY, sizeof(header), entries, entries_size) != header.checksum) {
+        Serial.println("Ignoring corrupted pattern manifest");
+        delete[] entries;
+        return nullptr;
+    }
+    // Make sure the strings are terminated, whatever is on the card
+    for (uint32_t i = 0; i < header.num_entries; i++) {
+        entries[i].filename[CACHED_PATTERN_FILENAME_LENGTH - 1] = '\0';
+        entries[i].name[CACHED_PATTERN_NAME_LENGTH - 1] = '\0';
+    }
+    *num_entries = header.num_entries;
+    *signature = header.signature;
+    return entries;
+}
+
+uint32_t pattern_manifest_mtime(File& file) {
+    DateTimeFields tm;
+    if (!file.getModifyTime(tm)) {
+        return 0;
+    }
+    uint32_t date = (tm.year - 80) << 9 | (tm.mon + 1) << 5 | tm.mday;
+    uint32_t time = tm.hour << 11 | tm.min << 5 | tm.sec / 2;
+    return date << 16 | time;
+}
+
+bool pattern_manifest_save(const pattern_manifest_entry_t *entries, uint32_t num_entries, uint32_t signature) {
+    const size_t entries_size = num_entries * sizeof(pattern_manifest_entry_t);
+    pattern_manifest_header_t header = {
+        .magic = PATTERN_MANIFEST_MAGIC,
+        .version = PATTERN_MANIFEST_VERSION,
+        .entry_size = sizeof(pattern_manifest_entry_t),
+        .num_entries = num_entries,
+        .signature = signature,
+        .checksum = file_checksum_add(FILE_CHECKSUM_EMPTY, sizeof(pattern_manifest_header_t), entries, entries_size),
+    };
+    // FILE_WRITE appends to existing files, so start from scratch
+    SD.remove(PATTERN_MANIFEST_TEMP_PATH);
+    File file = SD.open(PATTERN_MANIFEST_TEMP_PATH, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    bool success = file.write(&header, sizeof(header)) == sizeof(header);
+    success = success && file.write(entries, entries_size) == entries_size;
+    success = success && file.size() == sizeof(header) + entries_size;
+    file.close();
+    if (!success) {
+        SD.remove(PATTERN_MANIFEST_TEMP_PATH);
+        return false;
+    }
+    // Only replace the previous manifest with a complete one. Without any manifest, the patterns
+    // are just parsed again.
+    SD.remove(PATTERN_MANIFEST_PATH);
+    return SD.rename(PATTERN_MANIFEST_TEMP_PATH, PATTERN_MANIFEST_PATH);
+}
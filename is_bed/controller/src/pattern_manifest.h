@@ -0,0 +1,51 @@
+#ifndef PATTERN_MANIFEST_H
+#define PATTERN_MANIFEST_H
+
+#include "cached_pattern.h"
+#include <stdint.h>
+
+// The manifest caches, on the SD card, what load_cached_patterns() learns about each pattern
+// file, so that files that did not change don't have to be opened again at boot.
+#define PATTERN_MANIFEST_PATH "/.is_bed_manifest"
+// The manifest is written there first, then renamed, so that a partial manifest is never read
+#define PATTERN_MANIFEST_TEMP_PATH "/.is_bed_manifest.new"
+#define PATTERN_MANIFEST_MAGIC 0x464D4253
+#define PATTERN_MANIFEST_VERSION 2
+
+// Manifest file header. It is followed by num_entries entries, sorted by filename.
+struct [[gnu::packed]] pattern_manifest_header_t {
+    uint32_t magic;
+    uint16_t version;
+    // Size of an entry, to detect layout changes
+    uint16_t entry_size;
+    uint32_t num_entries;
+    // Signature of the SD card directory the manifest was built from
+    uint32_t signature;
+    // Checksum of the entries (see file_checksum_add())
+    uint32_t checksum;
+};
+
+// Manifest entry for one pattern file
+struct [[gnu::packed]] pattern_manifest_entry_t {
+    char filename[CACHED_PATTERN_FILENAME_LENGTH];
+    // Size of the file in bytes
+    uint32_t size;
+    // Modification time of the file, in FAT date (high 16 bits) and time (low 16 bits) format
+    uint32_t mtime;
+    cached_pattern_header_t header;
+    cached_pattern_ext_header_t ext;
+    // The name to display for the pattern
+    char name[CACHED_PATTERN_NAME_LENGTH];
+};
+
+// Read the manifest from the SD card. Returns the entries (to release with delete[]), or nullptr
+// if there is no valid manifest, or if its checksum does not match.
+pattern_manifest_entry_t *pattern_manifest_load(uint32_t *num_entries, uint32_t *signature);
+
+// Modification time of a file, in the format of the manifest entries
+uint32_t pattern_manifest_mtime(File& file);
+
+// Write the manifest to the SD card
+bool pattern_manifest_save(const pattern_manifest_entry_t *entries, uint32_t num_entries, uint32_t signature);
+
+#endif // PATTERN_MANIFEST_H
@@ -0,0 +1,311 @@
+#include "pattern_store.h"
+#include "cached_pattern.h"
+#include <LittleFS.h>
+
+// Space kept free on the flash for the filesystem metadata of each file
+#define PATTERN_STORE_FILE_OVERHEAD 4096
+// Bytes copied by each pattern_store_mirror_step(). Small enough to keep up with the LED refresh.
+#define PATTERN_STORE_COPY_CHUNK_SIZE 2048
+// Maximum size of the selection file
+#define PATTERN_STORE_SELECTION_SIZE 4096
+
+// Phase of the mirror
+typedef enum {
+    // No mirror running
+    MIRROR_IDLE,
+    // Listing the flash files, one per step, to find the stale ones
+    MIRROR_LIST,
+    // Removing the stale files, one per step
+    MIRROR_REMOVE,
+    // Copying the missing files, one chunk per step
+    MIRROR_COPY,
+} mirror_phase_t;
+
+static LittleFS_QSPIFlash flash_store;
+static bool flash_store_ready = false;
+
+// State of the mirror between two steps
+static struct {
+    mirror_phase_t phase;
+    // Whether each cached pattern is to be mirrored (num_cached_patterns entries)
+    bool *selected;
+    // The flash root, while it is listed
+    File root;
+    // The files to remove, one per line, and where the next one starts
+    String stale;
+    int stale_start;
+    // The pattern being copied or checked, and its files while it is copied
+    uint32_t pattern_index;
+    File source;
+    File destination;
+    uint8_t *buffer;
+    uint32_t start_ms;
+    uint32_t num_mirrored;
+    uint32_t num_copied;
+    uint64_t bytes_copied;
+} mirror;
+
+//
+// Static function prototypes
+//
+static bool in_selection(const char *selection, const char *filename);
+static bool same_file(File& a, File& b);
+static void list_step();
+static void remove_step();
+static void copy_step();
+static bool start_copy(const char *filepath);
+static bool finish_copy();
+static void close_copy();
+static void finish_mirror();
+
+bool pattern_store_begin() {
+    flash_store_ready = flash_store.begin();
+    if (flash_store_ready) {
+        Serial.printf("Flash pattern store: %u KB used of %u KB\n", (unsigned)(flash_store.usedSize() / 1024),
+                      (unsigned)(flash_store.totalSize() / 1024));
+    } else {
+        Serial.println("No flash pattern store");
+    }
+    return flash_store_ready;
+}
+
+FS *pattern_store_fs() {
+    return flash_store_ready ? &flash_store : nullptr;
+}
+
+void pattern_store_mirror_start() {
+    pattern_store_mirror_cancel();
+    if (!flash_store_ready) {
+        return;
+    }
+    mirror.start_ms = millis();
+    mirror.num_mirrored = 0;
+    mirror.num_copied = 0;
+    mirror.bytes_copied = 0;
+
+    // Read the list of patterns to mirror, if there is one
+    char *selection = nullptr;
+    File selection_file = SD.open(PATTERN_STORE_SELECTION_PATH);
+    if (selection_file) {
+        const uint32_t size = min(selection_file.size(), (uint64_t)PATTERN_STORE_SELECTION_SIZE);
+        selection = new char[size + 1];
+        selection[selection_file.read(selection, size)] = '\0';
+        selection_file.close();
+    }
+    mirror.selected = new bool[num_cached_patterns];
+    for (uint32_t i = 0; i < num_cached_patterns; i++) {
+        mirror.selected[i] = selection == nullptr || in_selection(selection, cached_patterns[i].filepath.c_str());
+    }
+    delete[] selection;
+
+    // Find the flash files that are not selected anymore, or that don't match the SD card.
+    // They are removed after the directory has been listed.
+    mirror.stale = "";
+    mirror.stale_start = 0;
+    mirror.root = flash_store.open("/");
+    mirror.phase = MIRROR_LIST;
+}
+
+bool pattern_store_mirror_step() {
+    switch (mirror.phase) {
+    case MIRROR_LIST:
+        list_step();
+        break;
+    case MIRROR_REMOVE:
+        remove_step();
+        break;
+    case MIRROR_COPY:
+        copy_step();
+        break;
+    case MIRROR_IDLE:
+        break;
+    }
+    return mirror.phase != MIRROR_IDLE;
+}
+
+void pattern_store_mirror_cancel() {
+    if (mirror.phase == MIRROR_IDLE) {
+        return;
+    }
+    if (mirror.destination) {
+        // Don't leave a partial copy, the next mirror would not know it is one. The flash files are all
+        // in the root, by their name.
+        const String filepath = mirror.destination.name();
+        close_copy();
+        flash_store.remove(filepath.c_str());
+    }
+    mirror.root.close();
+    mirror.stale = "";
+    delete[] mirror.selected;
+    mirror.selected = nullptr;
+    mirror.phase = MIRROR_IDLE;
+    Serial.println("Flash pattern store: mirror stopped");
+}
+
+//
+// Static functions
+//
+// Check if a file name is one of the lines of the selection
+static bool in_selection(const char *selection, const char *filename) {
+    const size_t length = strlen(filename);
+    const char *line = selection;
+    while (*line != '\0') {
+        while (*line == ' ' || *line == '/') {
+            line++;
+        }
+        size_t line_length = strcspn(line, "\r\n");
+        while (line_length > 0 && line[line_length - 1] == ' ') {
+            line_length--;
+        }
+        if (line_length == length && strncmp(line, filename, length) == 0) {
+            return true;
+        }
+        line += strcspn(line, "\n");
+        if (*line == '\n') {
+            line++;
+        }
+    }
+    return false;
+}
+
+// Check if two files have the same size and modification time
+static bool same_file(File& a, File& b) {
+    DateTimeFields a_time;
+    DateTimeFields b_time;
+    if (a.size() != b.size() || !a.getModifyTime(a_time) || !b.getModifyTime(b_time)) {
+        return false;
+    }
+    return memcmp(&a_time, &b_time, sizeof(DateTimeFields)) == 0;
+}
+
+// Check one flash file against the selection and the SD card
+static void list_step() {
+    File file = mirror.root.openNextFile();
+    if (!file) {
+        mirror.root.close();
+        mirror.phase = MIRROR_REMOVE;
+        return;
+    }
+    const char *name = file.name();
+    bool keep = false;
+    for (uint32_t i = 0; i < num_cached_patterns && !keep; i++) {
+        if (mirror.selected[i] && cached_patterns[i].filepath == name) {
+            File sd_file = SD.open(name);
+            keep = sd_file && same_file(sd_file, file);
+        }
+    }
+    if (!keep) {
+        mirror.stale += name;
+        mirror.stale += '\n';
+    }
+}
+
+// Remove one stale flash file
+static void remove_step() {
+    const int end = mirror.stale.indexOf('\n', mirror.stale_start);
+    if (end < 0) {
+        mirror.stale = "";
+        mirror.pattern_index = 0;
+        mirror.phase = MIRROR_COPY;
+        return;
+    }
+    flash_store.remove(mirror.stale.substring(mirror.stale_start, end).c_str());
+    mirror.stale_start = end + 1;
+}
+
+// Copy a chunk of the pattern being mirrored, or find the next pattern to mirror.
+// A pattern is only read from the flash store once its copy is complete.
+static void copy_step() {
+    if (mirror.destination) {
+        const size_t read = mirror.source.read(mirror.buffer, PATTERN_STORE_COPY_CHUNK_SIZE);
+        if (read > 0) {
+            if (mirror.destination.write(mirror.buffer, read) == read) {
+                return;
+            }
+        } else if (finish_copy()) {
+            cached_pattern_set_fs(cached_patterns[mirror.pattern_index], &flash_store);
+            mirror.num_mirrored++;
+            mirror.pattern_index++;
+            return;
+        }
+        const char *filepath = cached_patterns[mirror.pattern_index].filepath.c_str();
+        Serial.printf("Error copying %s to the flash store\n", filepath);
+        close_copy();
+        flash_store.remove(filepath);
+        mirror.pattern_index++;
+        return;
+    }
+    // Skip the patterns that are not selected
+    while (mirror.pattern_index < num_cached_patterns && !mirror.selected[mirror.pattern_index]) {
+        mirror.pattern_index++;
+    }
+    if (mirror.pattern_index == num_cached_patterns) {
+        finish_mirror();
+        return;
+    }
+    cached_pattern_t& pattern = cached_patterns[mirror.pattern_index];
+    const char *filepath = pattern.filepath.c_str();
+    if (flash_store.exists(filepath)) {
+        cached_pattern_set_fs(pattern, &flash_store);
+        mirror.num_mirrored++;
+        mirror.pattern_index++;
+    } else if (!start_copy(filepath)) {
+        mirror.pattern_index++;
+    }
+}
+
+// Open the files to copy a pattern to the flash store, if it fits
+static bool start_copy(const char *filepath) {
+    mirror.source = SD.open(filepath);
+    if (!mirror.source) {
+        return false;
+    }
+    const uint64_t free_size = flash_store.totalSize() - flash_store.usedSize();
+    if (mirror.source.size() + PATTERN_STORE_FILE_OVERHEAD > free_size) {
+        Serial.printf("No room left in the flash store for %s\n", filepath);
+        mirror.source.close();
+        return false;
+    }
+    mirror.destination = flash_store.open(filepath, FILE_WRITE);
+    if (!mirror.destination) {
+        Serial.printf("Error copying %s to the flash store\n", filepath);
+        mirror.source.close();
+        return false;
+    }
+    mirror.buffer = new uint8_t[PATTERN_STORE_COPY_CHUNK_SIZE];
+    return true;
+}
+
+// Close a complete copy, keeping the modification time of the SD file. Returns false if the copy is short.
+static bool finish_copy() {
+    DateTimeFields time;
+    if (mirror.source.getModifyTime(time)) {
+        mirror.destination.setModifyTime(time);
+    }
+    const uint64_t size = mirror.source.size();
+    const bool ok = mirror.destination.size() == size;
+    close_copy();
+    if (ok) {
+        mirror.num_copied++;
+        mirror.bytes_copied += size;
+    }
+    return ok;
+}
+
+// Close the files of the copy in progress
+static void close_copy() {
+    mirror.destination.close();
+    mirror.source.close();
+    delete[] mirror.buffer;
+    mirror.buffer = nullptr;
+}
+
+// Release the state of a finished mirror
+static void finish_mirror() {
+    delete[] mirror.selected;
+    mirror.selected = nullptr;
+    mirror.phase = MIRROR_IDLE;
+    Serial.printf("Flash pattern store: %u patterns mirrored, %u copied (%u KB) in %u ms\n",
+                  (unsigned)mirror.num_mirrored, (unsigned)mirror.num_copied, (unsigned)(mirror.bytes_copied / 1024),
+                  (unsigned)(millis() - mirror.start_ms));
+}
@@ -0,0 +1,34 @@
+#ifndef PATTERN_STORE_H
+#define PATTERN_STORE_H
+
+#include <FS.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Optional copy of cached patterns on a QSPI NOR flash chip, which has a much lower
+// latency than the SD card for the small per step reads of the player.
+// The SD card stays the reference: flash files are only mirrors of SD files.
+
+// List of the patterns to mirror on the SD card, one file name per line. Without it,
+// the patterns are mirrored in order for as long as they fit.
+#define PATTERN_STORE_SELECTION_PATH "/flash_patterns.txt"
+
+// Start the flash store. Returns false if there is no flash chip.
+bool pattern_store_begin();
+
+// The filesystem of the flash store, or nullptr if there is no flash chip
+FS *pattern_store_fs();
+
+// Start bringing the flash store in sync with the selected cached patterns. The work is done in small
+// pieces by pattern_store_mirror_step(), so the patterns keep playing meanwhile, from the SD card until
+// their mirror is complete. Must be called after load_cached_patterns().
+void pattern_store_mirror_start();
+
+// Do a bounded amount of work on the mirror: list or remove one flash file, or copy at most
+// PATTERN_STORE_COPY_CHUNK_SIZE bytes. Returns true while the mirror is not finished.
+bool pattern_store_mirror_step();
+
+// Stop the mirror, removing the file being copied. Must be called before the cached patterns are closed.
+void pattern_store_mirror_cancel();
+
+#endif // PATTERN_STORE_H
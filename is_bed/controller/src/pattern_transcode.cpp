@@ -0,0 +1,278 @@
+#include "pattern_transcode.h"
+#include "cached_pattern.h"
+#include "file_checksum.h"
+
+// Largest step that can be transcoded, in bytes of RGB pixels. Two steps are kept in RAM.
+#define TRANSCODE_MAX_STEP_SIZE 8192
+// The steps start on a multiple of this, from the start of the file
+#define TRANSCODE_ALIGNMENT 512
+// Size of the color lookup table used to build the palette (a power of two, at least twice 256)
+#define TRANSCODE_PALETTE_SLOTS 512
+// Marker for an empty slot of the lookup table
+#define TRANSCODE_NO_COLOR 0xFFFFFFFF
+
+// A palette under construction, with an open addressing hash table to find the colors
+struct transcode_palette_t {
+    uint32_t keys[TRANSCODE_PALETTE_SLOTS];
+    uint8_t indices[TRANSCODE_PALETTE_SLOTS];
+    CRGB colors[256];
+    uint16_t size;
+};
+
+//
+// Static function prototypes
+//
+static void scan_step(pattern_transcode_t& t);
+static void start_writing(pattern_transcode_t& t);
+static void write_step(pattern_transcode_t& t);
+static void finish_writing(pattern_transcode_t& t);
+static bool write_hold(pattern_transcode_t& t);
+static bool write_data(pattern_transcode_t& t, uint64_t offset, const void *data, size_t size);
+static int palette_index(transcode_palette_t& palette, const uint8_t *rgb, bool add);
+static bool write_zeros(File& file, uint32_t count);
+
+pattern_transcode_result_t pattern_transcode(File& source, File& destination, pattern_transcode_report_t *report) {
+    pattern_transcode_t transcode;
+    pattern_transcode_result_t result = pattern_transcode_begin(transcode, source, destination);
+    while (result == PATTERN_TRANSCODE_RUNNING) {
+        result = pattern_transcode_run(transcode, UINT32_MAX);
+    }
+    pattern_transcode_end(transcode, report);
+    return result;
+}
+
+pattern_transcode_result_t pattern_transcode_begin(pattern_transcode_t& t, File& source, File& destination) {
+    t = {};
+    t.source = &source;
+    t.destination = &destination;
+    t.result = PATTERN_TRANSCODE_SKIPPED;
+
+    // Only plain RGB patterns are transcoded, possibly with an extended header that just asks for interpolation
+    t.source_data_offset = sizeof(cached_pattern_header_t);
+    source.seek(0);
+    if (source.read(&t.header, sizeof(t.header)) != sizeof(t.header)) {
+        return t.result;
+    }
+    if (t.header.magic == CACHED_PATTERN_MAGIC_EXT) {
+        uint16_t ext_size = 0;
+        source.read(&ext_size, sizeof(ext_size));
+        source.seek(sizeof(t.header));
+        source.read(&t.source_ext, min((size_t)ext_size, sizeof(t.source_ext)));
+        if (ext_size < offsetof(cached_pattern_ext_header_t, remap_offset) ||
+            (t.source_ext.flags & ~CACHED_PATTERN_FLAG_INTERPOLATE) != 0) {
+            return t.result;
+        }
+        t.source_data_offset = t.source_ext.data_offset;
+    }
+    t.num_pixels = t.header.num_pixels;
+    t.steps = t.header.animation_steps;
+    t.step_size = t.num_pixels * sizeof(CRGB);
+    if (t.steps == 0 || t.step_size == 0 || t.step_size > TRANSCODE_MAX_STEP_SIZE ||
+        source.size() < t.source_data_offset + (uint64_t)t.step_size * t.steps || !source.seek(t.source_data_offset)) {
+        return t.result;
+    }
+
+    // First pass: build the palette and count the keyframes.
+    // Interpolated patterns keep all their steps, as keyframes would blend over the whole hold.
+    t.merge = !(t.source_ext.flags & CACHED_PATTERN_FLAG_INTERPOLATE);
+    t.indexed = true;
+    t.step_data = new uint8_t[t.step_size];
+    t.previous = new uint8_t[t.step_size];
+    t.palette = new transcode_palette_t;
+    memset(t.palette->keys, 0xFF, sizeof(t.palette->keys));
+    t.palette->size = 0;
+    t.result = PATTERN_TRANSCODE_RUNNING;
+    return t.result;
+}
+
+pattern_transcode_result_t pattern_transcode_run(pattern_transcode_t& t, uint32_t max_bytes) {
+    uint32_t bytes = 0;
+    while (t.result == PATTERN_TRANSCODE_RUNNING && bytes < max_bytes) {
+        if (t.step < t.steps) {
+            if (t.writing) {
+                write_step(t);
+            } else {
+                scan_step(t);
+            }
+            bytes += t.step_size;
+        } else if (t.writing) {
+            finish_writing(t);
+        } else {
+            start_writing(t);
+        }
+    }
+    return t.result;
+}
+
+void pattern_transcode_end(pattern_transcode_t& t, pattern_transcode_report_t *report) {
+    delete[] t.step_data;
+    t.step_data = nullptr;
+    delete[] t.previous;
+    t.previous = nullptr;
+    if (report != nullptr) {
+        const bool done = t.result == PATTERN_TRANSCODE_DONE;
+        report->source_size = t.source->size();
+        report->size = done ? t.destination->size() : t.source->size();
+        report->palette_size = done && t.indexed ? t.palette->size : 0;
+        report->steps = t.steps;
+        report->keyframes = done ? t.keyframes : t.steps;
+    }
+    delete t.palette;
+    t.palette = nullptr;
+}
+
+//
+// Static functions
+//
+// First pass, for one step: count the keyframes and add the colors to the palette
+static void scan_step(pattern_transcode_t& t) {
+    if (t.source->read(t.step_data, t.step_size) != t.step_size) {
+        t.result = PATTERN_TRANSCODE_SKIPPED;
+        return;
+    }
+    t.bytes_read += t.step_size;
+    if (t.step == 0 || !t.merge || t.hold == 0xFFFF || memcmp(t.step_data, t.previous, t.step_size) != 0) {
+        t.keyframes++;
+        t.hold = 0;
+    }
+    t.hold++;
+    for (uint32_t i = 0; i < t.num_pixels && t.indexed; i++) {
+        t.indexed = palette_index(*t.palette, t.step_data + i * sizeof(CRGB), true) >= 0;
+    }
+    uint8_t *swap = t.previous;
+    t.previous = t.step_data;
+    t.step_data = swap;
+    t.step++;
+}
+
+// Between the passes: decide on the layout and write everything up to the first step
+static void start_writing(pattern_transcode_t& t) {
+    t.held = t.keyframes < t.steps;
+    if (!t.indexed && !t.held) {
+        t.result = PATTERN_TRANSCODE_SKIPPED;
+        return;
+    }
+    t.ext.ext_size = sizeof(t.ext);
+    t.ext.flags = t.source_ext.flags;
+    t.ext.period_ms = t.source_ext.period_ms;
+    uint32_t offset = sizeof(t.header) + sizeof(t.ext);
+    if (t.indexed) {
+        t.ext.flags |= CACHED_PATTERN_FLAG_PALETTE;
+        t.ext.palette_size = t.palette->size;
+        offset += t.palette->size * sizeof(CRGB);
+    }
+    const uint32_t palette_end = offset;
+    if (t.held) {
+        t.ext.flags |= CACHED_PATTERN_FLAG_HOLD;
+        t.ext.timeline_offset = offset;
+        offset += t.keyframes * sizeof(uint16_t);
+    }
+    t.ext.data_offset = (offset + TRANSCODE_ALIGNMENT - 1) / TRANSCODE_ALIGNMENT * TRANSCODE_ALIGNMENT;
+
+    cached_pattern_header_t new_header = t.header;
+    new_header.magic = CACHED_PATTERN_MAGIC_EXT;
+    new_header.animation_steps = t.keyframes;
+    bool ok = write_data(t, 0, &new_header, sizeof(new_header)) &&
+              write_data(t, sizeof(new_header), &t.ext, sizeof(t.ext));
+    if (ok && t.indexed) {
+        ok = write_data(t, sizeof(new_header) + sizeof(t.ext), t.palette->colors, t.palette->size * sizeof(CRGB));
+    }
+    // The hold table is filled as the keyframes end
+    ok = ok && write_zeros(*t.destination, t.ext.data_offset - palette_end);
+    ok = ok && t.source->seek(t.source_data_offset);
+    t.data_end = t.ext.data_offset;
+    t.writing = true;
+    t.step = 0;
+    t.keyframe = 0;
+    t.hold = 0;
+    if (!ok) {
+        t.result = PATTERN_TRANSCODE_ERROR;
+    }
+}
+
+// Second pass, for one step: write it if it starts a keyframe
+static void write_step(pattern_transcode_t& t) {
+    const uint32_t step = t.step++;
+    bool ok = t.source->read(t.step_data, t.step_size) == t.step_size;
+    t.bytes_read += t.step_size;
+    if (ok && step > 0 && t.merge && t.hold < 0xFFFF && memcmp(t.step_data, t.previous, t.step_size) == 0) {
+        t.hold++;
+        return;
+    }
+    if (step > 0 && t.held) {
+        ok = ok && write_hold(t);
+        t.keyframe++;
+    }
+    t.hold = 1;
+    if (t.indexed) {
+        // The indices go in the previous step buffer, which is about to be replaced
+        for (uint32_t i = 0; i < t.num_pixels; i++) {
+            t.previous[i] = palette_index(*t.palette, t.step_data + i * sizeof(CRGB), false);
+        }
+        ok = ok && write_data(t, t.data_end, t.previous, t.num_pixels);
+        t.data_end += t.num_pixels;
+    } else {
+        ok = ok && write_data(t, t.data_end, t.step_data, t.step_size);
+        t.data_end += t.step_size;
+    }
+    uint8_t *swap = t.previous;
+    t.previous = t.step_data;
+    t.step_data = swap;
+    if (!ok) {
+        t.result = PATTERN_TRANSCODE_ERROR;
+    }
+}
+
+// After the second pass: write the hold of the last keyframe
+static void finish_writing(pattern_transcode_t& t) {
+    const bool ok = !t.held || write_hold(t);
+    t.destination->flush();
+    t.result = ok ? PATTERN_TRANSCODE_DONE : PATTERN_TRANSCODE_ERROR;
+}
+
+// Write the hold of the current keyframe in the hold table, and come back to the end of the steps.
+// The table was written as zeros, which don't count in the checksum.
+static bool write_hold(pattern_transcode_t& t) {
+    uint16_t value = t.hold;
+    const uint32_t offset = t.ext.timeline_offset + t.keyframe * sizeof(uint16_t);
+    return t.destination->seek(offset) && write_data(t, offset, &value, sizeof(value)) &&
+           t.destination->seek(t.data_end);
+}
+
+// Write to the destination, at its current position, and add what is written to the checksum
+static bool write_data(pattern_transcode_t& t, uint64_t offset, const void *data, size_t size) {
+    t.checksum = file_checksum_add(t.checksum, offset, data, size);
+    return t.destination->write(data, size) == size;
+}
+
+// Find the index of a color in the palette, adding it if asked to.
+// Returns -1 if the color is not found, or if the palette is full.
+static int palette_index(transcode_palette_t& palette, const uint8_t *rgb, bool add) {
+    const uint32_t key = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+    uint32_t slot = (key * 2654435761u) >> 23;
+    while (palette.keys[slot] != TRANSCODE_NO_COLOR) {
+        if (palette.keys[slot] == key) {
+            return palette.indices[slot];
+        }
+        slot = (slot + 1) % TRANSCODE_PALETTE_SLOTS;
+    }
+    if (!add || palette.size == 256) {
+        return -1;
+    }
+    palette.keys[slot] = key;
+    palette.indices[slot] = palette.size;
+    palette.colors[palette.size] = CRGB(rgb[0], rgb[1], rgb[2]);
+    return palette.size++;
+}
+
+static bool write_zeros(File& file, uint32_t count) {
+    static const uint8_t zeros[64] = {};
+    while (count > 0) {
+        uint32_t size = min(count, (uint32_t)sizeof(zeros));
+        if (file.write(zeros, size) != size) {
+            return false;
+        }
+        count -= size;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef PATTERN_TRANSCODE_H
+#define PATTERN_TRANSCODE_H
+
+#include "cached_pattern.h"
+#include <FS.h>
+#include <stdint.h>
+
+// Result of a transcode
+typedef enum {
+    // The file was transcoded
+    PATTERN_TRANSCODE_DONE,
+    // The file can't be improved or is not a plain RGB pattern. Nothing was written.
+    PATTERN_TRANSCODE_SKIPPED,
+    // Reading or writing failed, the destination is incomplete
+    PATTERN_TRANSCODE_ERROR,
+    // The transcode is not finished yet, pattern_transcode_run() must be called again
+    PATTERN_TRANSCODE_RUNNING,
+} pattern_transcode_result_t;
+
+// What a transcode did
+typedef struct {
+    uint64_t source_size;
+    uint64_t size;
+    // Number of colors of the palette, 0 if the pixels are still RGB
+    uint16_t palette_size;
+    // Number of steps, and number of keyframes stored for them
+    uint32_t steps;
+    uint32_t keyframes;
+} pattern_transcode_report_t;
+
+// Palette under construction, private to pattern_transcode.cpp
+struct transcode_palette_t;
+
+// A transcode in progress. Only bytes_read is meant to be read by the caller.
+typedef struct {
+    File *source;
+    File *destination;
+    cached_pattern_header_t header;
+    // The extended header of the source, and the one being written
+    cached_pattern_ext_header_t source_ext;
+    cached_pattern_ext_header_t ext;
+    uint32_t source_data_offset;
+    uint32_t num_pixels;
+    uint32_t steps;
+    uint32_t step_size;
+    // Identical consecutive steps are merged into keyframes
+    bool merge;
+    // The pixels fit in a palette
+    bool indexed;
+    // Some steps are merged
+    bool held;
+    // True during the second pass over the source, the one that writes the destination
+    bool writing;
+    // Next step to read, keyframe being written, and duration of the current keyframe
+    uint32_t step;
+    uint32_t keyframes;
+    uint32_t keyframe;
+    uint32_t hold;
+    uint64_t data_end;
+    uint8_t *step_data;
+    uint8_t *previous;
+    transcode_palette_t *palette;
+    pattern_transcode_result_t result;
+    // Bytes of the source read so far, over both passes
+    uint64_t bytes_read;
+    // Checksum of what was written to the destination (see file_checksum_add())
+    uint32_t checksum;
+} pattern_transcode_t;
+
+// Rewrite a plain RGB cached pattern in the layout that is the fastest to play: palette indexed
+// when it has at most 256 colors, identical consecutive steps stored once as keyframes, and
+// the steps aligned on SD sectors.
+// The source is read twice, one step at a time, so the RAM used only depends on the step size.
+// The destination must be open for writing and empty.
+pattern_transcode_result_t pattern_transcode(File& source, File& destination, pattern_transcode_report_t *report);
+
+// Same as pattern_transcode(), split in small pieces of work so that it can run alongside the LEDs.
+// pattern_transcode_begin() returns PATTERN_TRANSCODE_RUNNING, or PATTERN_TRANSCODE_SKIPPED if the
+// source is not a plain RGB pattern. pattern_transcode_run() then reads at most max_bytes of the
+// source (but always a whole step) each time it is called, until it returns something else than
+// PATTERN_TRANSCODE_RUNNING. pattern_transcode_end() must be called in all cases to release the buffers.
+// The files must stay open, and must not be used by anything else, until the end.
+pattern_transcode_result_t pattern_transcode_begin(pattern_transcode_t& transcode, File& source, File& destination);
+pattern_transcode_result_t pattern_transcode_run(pattern_transcode_t& transcode, uint32_t max_bytes);
+void pattern_transcode_end(pattern_transcode_t& transcode, pattern_transcode_report_t *report);
+
+#endif // PATTERN_TRANSCODE_H
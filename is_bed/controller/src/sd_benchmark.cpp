@@ -0,0 +1,166 @@
+#include "sd_benchmark.h"
+#include "cached_pattern.h"
+#include <Arduino.h>
+#include <SD.h>
+
+// Number of pattern files to run the benchmark on
+#define BENCH_MAX_FILES 3
+// Size of the reads of the sequential test
+#define BENCH_SEQUENTIAL_READ_SIZE 4096
+// Maximum amount of data read sequentially from each file
+#define BENCH_SEQUENTIAL_MAX_BYTES (4 * 1024 * 1024)
+// Number of reads of the random test
+#define BENCH_RANDOM_READS 500
+// Latency histogram buckets: bucket 0 is below 16 us, then each bucket doubles,
+// and the last one holds everything above.
+#define BENCH_HISTOGRAM_BUCKETS 16
+
+// Statistics of one test
+typedef struct {
+    uint32_t reads;
+    uint32_t errors;
+    uint64_t bytes;
+    uint64_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t histogram[BENCH_HISTOGRAM_BUCKETS];
+    // Time spent in the background function, and its worst call
+    uint64_t background_us;
+    uint32_t background_max_us;
+} bench_stats_t;
+
+//
+// Static function prototypes
+//
+static void stats_reset(bench_stats_t& stats);
+static bool timed_read(File& file, uint64_t pos, uint8_t *buffer, uint32_t size, bench_stats_t& stats,
+                       void (*background)());
+static void stats_print(const char *test, const char *filename, const bench_stats_t& stats);
+
+void sd_benchmark_run(void (*background)()) {
+    Serial.printf("SD benchmark (%s)\n", background ? "with background traffic" : "idle");
+    if (num_cached_patterns == 0) {
+        Serial.println("No cached pattern to read");
+        return;
+    }
+    uint32_t buffer_size = BENCH_SEQUENTIAL_READ_SIZE;
+    for (uint32_t i = 0; i < num_cached_patterns; i++) {
+        buffer_size = max(buffer_size, cached_patterns[i].step_size);
+    }
+    uint8_t *buffer = new uint8_t[buffer_size];
+    bench_stats_t stats;
+
+    uint32_t num_files = 0;
+    for (uint32_t i = 0; i < num_cached_patterns && num_files < BENCH_MAX_FILES; i++) {
+        const cached_pattern_t& pattern = cached_patterns[i];
+        // A segment-scoped pattern may cover no pixel, and has no step to read
+        if (pattern.step_size == 0) {
+            continue;
+        }
+        // Through the file system the pattern is played from, the SD card or the flash store
+        const char *filename = pattern.filepath.c_str();
+        File file = pattern.fs->open(filename);
+        if (!file) {
+            Serial.printf("Could not open %s\n", filename);
+            continue;
+        }
+        num_files++;
+        Serial.printf("%s, from %s\n", filename, pattern.fs == &SD ? "the SD card" : "the flash store");
+        const uint64_t file_size = file.size();
+        const uint32_t num_steps = pattern.data_size / pattern.step_size;
+
+        // Whole file, in large chunks
+        stats_reset(stats);
+        for (uint64_t pos = 0; pos < file_size && pos < BENCH_SEQUENTIAL_MAX_BYTES; pos += BENCH_SEQUENTIAL_READ_SIZE) {
+            uint32_t size = min((uint64_t)BENCH_SEQUENTIAL_READ_SIZE, file_size - pos);
+            timed_read(file, pos, buffer, size, stats, background);
+        }
+        stats_print("sequential", filename, stats);
+
+        // One step after the other, as a single zone playing the pattern
+        stats_reset(stats);
+        for (uint32_t step = 0; step < num_steps; step++) {
+            uint64_t pos = pattern.ext.data_offset + (uint64_t)step * pattern.step_size;
+            timed_read(file, pos, buffer, pattern.step_size, stats, background);
+        }
+        stats_print("per step", filename, stats);
+
+        // Random steps, as several zones playing at different speeds
+        stats_reset(stats);
+        for (uint32_t j = 0; j < BENCH_RANDOM_READS && num_steps > 0; j++) {
+            uint32_t step = random(num_steps);
+            uint64_t pos = pattern.ext.data_offset + (uint64_t)step * pattern.step_size;
+            timed_read(file, pos, buffer, pattern.step_size, stats, background);
+        }
+        stats_print("random step", filename, stats);
+
+        file.close();
+    }
+    delete[] buffer;
+    Serial.println("SD benchmark done");
+}
+
+//
+// Static functions
+//
+static void stats_reset(bench_stats_t& stats) {
+    memset(&stats, 0, sizeof(stats));
+    stats.min_us = UINT32_MAX;
+}
+
+// Seek and read, and account for the time taken
+static bool timed_read(File& file, uint64_t pos, uint8_t *buffer, uint32_t size, bench_stats_t& stats,
+                       void (*background)()) {
+    if (background) {
+        uint32_t start_us = micros();
+        background();
+        uint32_t elapsed_us = micros() - start_us;
+        stats.background_us += elapsed_us;
+        stats.background_max_us = max(stats.background_max_us, elapsed_us);
+    }
+    uint32_t start_us = micros();
+    bool ok = file.seek(pos) && file.read(buffer, size) == size;
+    uint32_t elapsed_us = micros() - start_us;
+
+    stats.reads++;
+    if (!ok) {
+        stats.errors++;
+        return false;
+    }
+    stats.bytes += size;
+    stats.total_us += elapsed_us;
+    stats.min_us = min(stats.min_us, elapsed_us);
+    stats.max_us = max(stats.max_us, elapsed_us);
+    // Bucket from the number of significant bits: 0-15 us -> 0, 16-31 us -> 1, ...
+    uint32_t bits = elapsed_us ? 32 - __builtin_clz(elapsed_us) : 0;
+    uint32_t bucket = bits > 4 ? bits - 4 : 0;
+    stats.histogram[min(bucket, (uint32_t)BENCH_HISTOGRAM_BUCKETS - 1)]++;
+    return true;
+}
+
+static void stats_print(const char *test, const char *filename, const bench_stats_t& stats) {
+    uint32_t good_reads = stats.reads - stats.errors;
+    if (good_reads == 0) {
+        Serial.printf("%s %s: %lu reads, all failed\n", test, filename, stats.reads);
+        return;
+    }
+    uint32_t kb_per_s = stats.total_us ? stats.bytes * 1000000 / 1024 / stats.total_us : 0;
+    Serial.printf("%s %s: %lu reads (%lu errors), %lu KB in %lu ms, %lu KB/s\n", test, filename, stats.reads,
+                  stats.errors, (uint32_t)(stats.bytes / 1024), (uint32_t)(stats.total_us / 1000), kb_per_s);
+    Serial.printf("\tlatency: min %lu us, avg %lu us, max %lu us\n", stats.min_us,
+                  (uint32_t)(stats.total_us / good_reads), stats.max_us);
+    if (stats.background_us) {
+        Serial.printf("\tbackground: %lu ms total, worst call %lu us\n", (uint32_t)(stats.background_us / 1000),
+                      stats.background_max_us);
+    }
+    for (uint32_t i = 0; i < BENCH_HISTOGRAM_BUCKETS; i++) {
+        if (stats.histogram[i] == 0) {
+            continue;
+        }
+        if (i == BENCH_HISTOGRAM_BUCKETS - 1) {
+            Serial.printf("\t>= %6lu us: %lu\n", 16ul << (i - 1), stats.histogram[i]);
+        } else {
+            Serial.printf("\t<  %6lu us: %lu\n", 16ul << i, stats.histogram[i]);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef SD_BENCHMARK_H
+#define SD_BENCHMARK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Measure the SD card read performance on the cached pattern files, for the access
+ * patterns of the LED refresh: whole file sequential reads, one step after the other,
+ * and random steps. The throughput and a latency histogram of each test are printed
+ * on the serial port. The patterns mirrored in the flash store are read from there,
+ * as they are played.
+ *
+ * The benchmark blocks the main loop while it runs.
+ *
+ * @param background if not null, called between two reads to keep other traffic
+ *                   (MTP, USB host) active during the measures. Its own duration is
+ *                   reported separately.
+ */
+void sd_benchmark_run(void (*background)());
+
+#endif // SD_BENCHMARK_H
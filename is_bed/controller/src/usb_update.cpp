@@ -1,10 +1,90 @@
 #include "usb_update.h"
+#include "pattern_transcode.h"
+#include "pattern_manifest.h"
+#include "file_checksum.h"
 #include <SD.h>
 #include <USBHost_t36.h>
 
 // External USB filesystem object (should be defined in main.cpp)
 extern USBFilesystem usb_filesystem;
 
+// A pattern file of the USB drive
+typedef struct {
+    // What the SD card gets for the file
+    usb_update_journal_entry_t entry;
+    // The source hash of the entry is known
+    bool hashed;
+    // The file must be copied, as the SD card does not have it yet
+    bool copy;
+} usb_update_file_t;
+
+// The update in progress
+typedef struct {
+    usb_update_state_t state;
+    bool transcode;
+    // The pattern files of the USB drive, and the one being worked on
+    usb_update_file_t *files;
+    uint32_t num_files;
+    uint32_t files_capacity;
+    uint32_t file_index;
+    // True while the files are hashed, before they are compared with the SD card
+    bool hashing;
+    uint64_t hash;
+    // The file being hashed or copied
+    File source;
+    File destination;
+    // The transcode of the current file, if it is being transcoded
+    bool transcoding;
+    pattern_transcode_t transcoder;
+    // Size and checksum of what was written for the current file
+    uint64_t size;
+    uint32_t checksum;
+    // The current file, read back from the SD card to verify it, if it is being verified
+    bool verifying;
+    File staged;
+    uint32_t verify_checksum;
+    // Progress, in bytes read from the USB drive
+    uint64_t bytes_done;
+    uint64_t bytes_total;
+    // Value of bytes_done once the current file is done
+    uint64_t file_end;
+    // Sizes of the copied files, before and after transcoding
+    uint64_t total_source_size;
+    uint64_t total_size;
+    // When the current file was opened, and the time spent on it in usb_update_step(), for its copy rate
+    uint32_t file_start_ms;
+    uint32_t file_busy_us;
+    // Time spent on all the copied files
+    uint64_t total_busy_us;
+} usb_update_job_t;
+
+static usb_update_job_t job = {};
+
+// Buffer the files go through. It is in DMAMEM, as the tightly coupled RAM is kept for the LEDs,
+// and aligned on cache lines so that the drivers can move it by DMA without touching anything else.
+DMAMEM static uint8_t copy_buffer[USB_UPDATE_BUFFER_SIZE] __attribute__((aligned(32)));
+
+//
+// Static function prototypes
+//
+static bool is_pattern_file(File& entry);
+static usb_update_file_t *add_file(File& entry);
+static uint32_t work(uint32_t max_bytes);
+static void open_next_file();
+static void finish_hash();
+static void compare_files();
+static void finish_file(bool success);
+static void start_verify();
+static void finish_verify();
+static File create_file(const char *path, uint64_t size);
+static uint32_t rate(uint64_t bytes, uint64_t us);
+static bool commit_journal();
+static bool apply_journal();
+static bool write_list(FS& fs, const char *path, const char *temp_path, uint32_t magic, const void *entries,
+                       uint32_t num_entries, uint16_t entry_size);
+static uint8_t *read_list(FS& fs, const char *path, uint32_t magic, uint16_t entry_size, uint32_t *num_entries);
+static void remove_staged_files();
+
 // Helper function to check if a string ends with a given suffix
 static bool ends_with(const char *str, const char *suffix) {
     if (!str || !suffix)
@@ -64,118 +144,591 @@ bool usb_has_bins() {
     return found_bin;
 }
 
-bool sd_remove_bins() {
-    // Check if SD card is available
-    if (!SD.begin(BUILTIN_SDCARD)) {
+bool usb_update_start(bool transcode) {
+    if (job.state != USB_UPDATE_IDLE) {
         return false;
     }
     
-    // Open the root directory
-    File root = SD.open("/");
-    if (!root) {
+    // Check if USB filesystem is available
+    if (!usb_filesystem) {
         return false;
     }
     
-    if (!root.isDirectory()) {
-        root.close();
+    // List the pattern files of the USB drive
+    File usb_dir = usb_filesystem.open(PATTERN_FOLDER_NAME);
+    if (!usb_dir || !usb_dir.isDirectory()) {
         return false;
     }
-    
-    // Iterate through all files in root
+    job = {};
+    job.transcode = transcode;
     File entry;
-    bool success = true;
+    while ((entry = usb_dir.openNextFile())) {
+        if (is_pattern_file(entry)) {
+            add_file(entry);
+        }
+        entry.close();
+    }
+    usb_dir.close();
     
-    while ((entry = root.openNextFile())) {
-        // Only process files, not directories
-        if (!entry.isDirectory()) {
-            const char *name = entry.name();
-            
-            // Check if it ends with .bin
-            if (ends_with(name, ".bin")) {
-                entry.close();
-                
-                // Remove the file
-                if (!SD.remove(name)) {
-                    success = false;
-                }
-            } else {
-                entry.close();
+    // Reuse the hashes of the files that did not change since the last update
+    uint32_t num_synced = 0;
+    usb_update_journal_entry_t *synced = (usb_update_journal_entry_t *)read_list(
+        SD, USB_UPDATE_SYNC_PATH, USB_UPDATE_JOURNAL_MAGIC, sizeof(usb_update_journal_entry_t), &num_synced);
+    for (uint32_t i = 0; i < job.num_files; i++) {
+        usb_update_file_t& file = job.files[i];
+        for (uint32_t j = 0; j < num_synced && !file.hashed; j++) {
+            const usb_update_journal_entry_t& known = synced[j];
+            if (strncmp(known.filename, file.entry.filename, CACHED_PATTERN_FILENAME_LENGTH) == 0 &&
+                known.source_size == file.entry.source_size && known.source_mtime == file.entry.source_mtime) {
+                file.entry.source_hash = known.source_hash;
+                file.hashed = true;
             }
-        } else {
-            entry.close();
         }
+        // Count the worst case: the file is hashed, and then transcoded (read twice) or copied
+        job.bytes_total += file.entry.source_size * ((file.hashed ? 0 : 1) + (transcode ? 2 : 1));
     }
+    delete[] (uint8_t *)synced;
     
-    root.close();
-    return success;
+    // Start from an empty staging directory
+    remove_staged_files();
+    SD.mkdir(USB_UPDATE_STAGING_DIR);
+    job.hashing = true;
+    job.state = USB_UPDATE_RUNNING;
+    return true;
 }
 
-bool copy_bins_from_usb_to_sd() {
-    // Check if USB filesystem is available
-    if (!usb_filesystem) {
+usb_update_state_t usb_update_step() {
+    uint32_t bytes = 0;
+    while (job.state == USB_UPDATE_RUNNING && bytes < USB_UPDATE_CHUNK_SIZE) {
+        const uint32_t start_us = micros();
+        bytes += work(USB_UPDATE_CHUNK_SIZE - bytes);
+        job.file_busy_us += micros() - start_us;
+    }
+    return job.state;
+}
+
+usb_update_state_t usb_update_state() {
+    return job.state;
+}
+
+uint8_t usb_update_progress() {
+    if (job.state == USB_UPDATE_READY) {
+        return 100;
+    }
+    if (job.bytes_total == 0) {
+        return 0;
+    }
+    return min(job.bytes_done * 100 / job.bytes_total, (uint64_t)99);
+}
+
+bool usb_update_commit() {
+    if (job.state != USB_UPDATE_READY) {
         return false;
     }
     
-    // Check if SD card is available
-    if (!SD.begin(BUILTIN_SDCARD)) {
-        return false;
+    // Commit the update by writing the journal, then swap the patterns as it says
+    bool success = commit_journal() && apply_journal();
+    delete[] job.files;
+    job = {};
+    remove_staged_files();
+    return success;
+}
+
+void usb_update_cancel() {
+    if (job.transcoding) {
+        pattern_transcode_end(job.transcoder, nullptr);
+    }
+    job.source.close();
+    job.destination.close();
+    job.staged.close();
+    delete[] job.files;
+    job = {};
+    remove_staged_files();
+}
+
+void usb_update_recover() {
+    if (SD.exists(USB_UPDATE_JOURNAL_PATH)) {
+        Serial.println("Finishing an interrupted pattern update");
+        if (!apply_journal()) {
+            Serial.println("Error finishing the pattern update");
+        }
+    }
+    remove_staged_files();
+}
+
+//
+// Static functions
+//
+// Check if a directory entry is a pattern file to copy
+static bool is_pattern_file(File& entry) {
+    const char *name = entry.name();
+    return !entry.isDirectory() && ends_with(name, ".bin") && name[0] != '.' &&
+           strlen(name) < CACHED_PATTERN_FILENAME_LENGTH;
+}
+
+// Add a USB drive file to the files of the update
+static usb_update_file_t *add_file(File& entry) {
+    if (job.num_files == job.files_capacity) {
+        job.files_capacity = job.files_capacity ? job.files_capacity * 2 : 32;
+        usb_update_file_t *files = new usb_update_file_t[job.files_capacity];
+        memcpy(files, job.files, job.num_files * sizeof(usb_update_file_t));
+        delete[] job.files;
+        job.files = files;
+    }
+    usb_update_file_t *file = &job.files[job.num_files++];
+    memset(file, 0, sizeof(*file));
+    // Extract just the filename (remove path if present)
+    const char *name = entry.name();
+    const char *filename = strrchr(name, '/');
+    if (filename) {
+        filename++;  // Skip the '/'
+    } else {
+        filename = name;
+    }
+    strcpy(file->entry.filename, filename);
+    file->entry.source_size = entry.size();
+    file->entry.source_mtime = pattern_manifest_mtime(entry);
+    return file;
+}
+
+// Do one piece of work on the current file, reading at most max_bytes (and one buffer) from the
+// USB drive or from the staged file. Returns the number of bytes read.
+static uint32_t work(uint32_t max_bytes) {
+    const size_t buffer_size = min((size_t)USB_UPDATE_BUFFER_SIZE, (size_t)max_bytes);
+    if (job.verifying) {
+        // Read back a buffer of the staged file
+        const uint64_t offset = job.staged.position();
+        size_t bytes_read = job.staged.read(copy_buffer, buffer_size);
+        if (bytes_read == 0) {
+            finish_verify();
+            return 0;
+        }
+        job.verify_checksum = file_checksum_add(job.verify_checksum, offset, copy_buffer, bytes_read);
+        return bytes_read;
+    }
+    if (!job.source) {
+        open_next_file();
+        return 0;
+    }
+    if (job.hashing) {
+        // Hash a buffer
+        size_t bytes_read = job.source.read(copy_buffer, buffer_size);
+        if (bytes_read == 0) {
+            finish_hash();
+            return 0;
+        }
+        job.bytes_done += bytes_read;
+        job.hash = file_hash_add(job.hash, copy_buffer, bytes_read);
+        return bytes_read;
+    }
+    if (job.transcoding) {
+        // Transcode a few steps
+        const uint64_t start = job.transcoder.bytes_read;
+        pattern_transcode_result_t result = pattern_transcode_run(job.transcoder, max_bytes);
+        const uint32_t bytes_read = job.transcoder.bytes_read - start;
+        job.bytes_done += bytes_read;
+        if (result == PATTERN_TRANSCODE_RUNNING) {
+            return bytes_read;
+        }
+        job.size = job.transcoder.data_end;
+        job.checksum = job.transcoder.checksum;
+        pattern_transcode_report_t report;
+        pattern_transcode_end(job.transcoder, &report);
+        job.transcoding = false;
+        if (result == PATTERN_TRANSCODE_SKIPPED) {
+            // Nothing was written, copy the file as is instead
+            job.size = 0;
+            job.checksum = FILE_CHECKSUM_EMPTY;
+            job.source.seek(0);
+            return bytes_read;
+        }
+        if (result == PATTERN_TRANSCODE_DONE) {
+            Serial.printf("   Transcoded: %lu KB -> %lu KB (%lu colors, %lu keyframes for %lu steps)\n",
+                          (uint32_t)(report.source_size / 1024), (uint32_t)(report.size / 1024),
+                          (uint32_t)report.palette_size, report.keyframes, report.steps);
+            job.total_source_size += report.source_size;
+            job.total_size += report.size;
+        }
+        finish_file(result == PATTERN_TRANSCODE_DONE);
+        return bytes_read;
+    }
+    // Copy a buffer
+    size_t bytes_read = job.source.read(copy_buffer, buffer_size);
+    if (bytes_read == 0) {
+        job.total_source_size += job.source.size();
+        job.total_size += job.source.size();
+        finish_file(job.size == job.source.size());
+        return 0;
+    }
+    job.bytes_done += bytes_read;
+    job.checksum = file_checksum_add(job.checksum, job.size, copy_buffer, bytes_read);
+    job.size += bytes_read;
+    if (job.destination.write(copy_buffer, bytes_read) != bytes_read) {
+        Serial.println("   Error writing to the SD card");
+        finish_file(false);
+    }
+    return bytes_read;
+}
+
+// Open the next file to hash or to copy, or move on to the next phase if there is none left
+static void open_next_file() {
+    while (job.file_index < job.num_files &&
+           (job.hashing ? job.files[job.file_index].hashed : !job.files[job.file_index].copy)) {
+        job.file_index++;
+    }
+    if (job.file_index == job.num_files) {
+        if (job.hashing) {
+            compare_files();
+            return;
+        }
+        if (job.total_busy_us > 0) {
+            const uint32_t total_rate = rate(job.total_source_size, job.total_busy_us);
+            Serial.printf("   Copied %lu KB at %lu.%02lu MB/s\n", (uint32_t)(job.total_source_size / 1024),
+                          total_rate / 100, total_rate % 100);
+        }
+        if (job.transcode && job.total_source_size > 0) {
+            Serial.printf("   Patterns take %lu KB on the SD card instead of %lu KB (%lu%% saved)\n",
+                          (uint32_t)(job.total_size / 1024), (uint32_t)(job.total_source_size / 1024),
+                          (uint32_t)(100 - job.total_size * 100 / job.total_source_size));
+        }
+        job.state = USB_UPDATE_READY;
+        return;
     }
     
-    // Open the folder on USB
-    File usb_dir = usb_filesystem.open(PATTERN_FOLDER_NAME);
-    if (!usb_dir) {
-        return false;
+    usb_update_file_t& file = job.files[job.file_index];
+    job.source = usb_filesystem.open((String(PATTERN_FOLDER_NAME "/") + file.entry.filename).c_str());
+    if (!job.source) {
+        Serial.printf("   Error opening %s\n", file.entry.filename);
+        job.state = USB_UPDATE_FAILED;
+        return;
+    }
+    if (job.hashing) {
+        job.hash = FILE_HASH_EMPTY;
+        job.file_end = job.bytes_done + file.entry.source_size;
+        return;
     }
     
-    if (!usb_dir.isDirectory()) {
-        usb_dir.close();
-        return false;
+    Serial.print("   Copying file: ");
+    Serial.println(file.entry.filename);
+    job.size = 0;
+    job.checksum = FILE_CHECKSUM_EMPTY;
+    job.file_end = job.bytes_done + file.entry.source_size * (job.transcode ? 2 : 1);
+    job.file_start_ms = millis();
+    job.file_busy_us = 0;
+    job.destination = create_file((String(USB_UPDATE_STAGING_DIR "/") + file.entry.filename).c_str(),
+                                  file.entry.source_size);
+    if (!job.destination) {
+        finish_file(false);
+        return;
     }
+    if (job.transcode) {
+        job.transcoding = pattern_transcode_begin(job.transcoder, job.source, job.destination) == PATTERN_TRANSCODE_RUNNING;
+        if (!job.transcoding) {
+            pattern_transcode_end(job.transcoder, nullptr);
+            job.source.seek(0);
+        }
+    }
+}
+
+// Record the hash of the current file
+static void finish_hash() {
+    usb_update_file_t& file = job.files[job.file_index];
+    file.entry.source_hash = job.hash;
+    file.hashed = true;
+    job.source.close();
+    job.bytes_done = job.file_end;
+    job.file_index++;
+}
+
+// Once all the files are hashed, find the ones that the SD card does not have yet
+static void compare_files() {
+    job.hashing = false;
+    job.file_index = 0;
     
-    // Iterate through all .bin files and copy them
+    // A file is unchanged if the SD card still has what the last update made from the same source
+    uint32_t num_synced = 0;
+    usb_update_journal_entry_t *synced = (usb_update_journal_entry_t *)read_list(
+        SD, USB_UPDATE_SYNC_PATH, USB_UPDATE_JOURNAL_MAGIC, sizeof(usb_update_journal_entry_t), &num_synced);
+    uint32_t num_copies = 0;
+    uint64_t copy_size = 0;
+    // Some unchanged files have a new modification time, which the sync list must learn
+    bool new_mtimes = false;
+    for (uint32_t i = 0; i < job.num_files; i++) {
+        usb_update_file_t& file = job.files[i];
+        file.copy = true;
+        for (uint32_t j = 0; j < num_synced && file.copy; j++) {
+            const usb_update_journal_entry_t& known = synced[j];
+            if (strncmp(known.filename, file.entry.filename, CACHED_PATTERN_FILENAME_LENGTH) != 0 ||
+                known.source_size != file.entry.source_size || known.source_hash != file.entry.source_hash) {
+                continue;
+            }
+            File sd_file = SD.open((String("/") + file.entry.filename).c_str());
+            if (sd_file && sd_file.size() == known.size) {
+                file.entry.size = known.size;
+                file.entry.checksum = known.checksum;
+                file.copy = false;
+                new_mtimes = new_mtimes || known.source_mtime != file.entry.source_mtime;
+            }
+        }
+        if (file.copy) {
+            num_copies++;
+            copy_size += file.entry.source_size * (job.transcode ? 2 : 1);
+        }
+    }
+    delete[] (uint8_t *)synced;
+    
+    // Count the SD card patterns that are not on the USB drive anymore
+    uint32_t num_removed = 0;
+    File root = SD.open("/");
     File entry;
-    bool success = true;
-    uint8_t buffer[512];  // Buffer for copying data
+    while (root && (entry = root.openNextFile())) {
+        const char *name = entry.name();
+        bool on_usb_drive = false;
+        for (uint32_t i = 0; i < job.num_files && !on_usb_drive; i++) {
+            on_usb_drive = strcmp(job.files[i].entry.filename, name) == 0;
+        }
+        if (!entry.isDirectory() && ends_with(name, ".bin") && !on_usb_drive) {
+            num_removed++;
+        }
+        entry.close();
+    }
+    root.close();
     
-    while ((entry = usb_dir.openNextFile())) {
-        // Only process files, not directories
-        if (!entry.isDirectory()) {
-            const char *name = entry.name();
-            
-            // Check if it ends with .bin and doesn't start with '.'
-            if (ends_with(name, ".bin") && name[0] != '.') {
-                Serial.print("   Copying file: ");
-                Serial.println(name);
-                // Extract just the filename (remove path if present)
-                const char *filename = strrchr(name, '/');
-                if (filename) {
-                    filename++;  // Skip the '/'
-                } else {
-                    filename = name;
-                }
-                
-                // Create/open destination file on SD card
-                File dest = SD.open(filename, FILE_WRITE);
-                if (dest) {
-                    // Copy the file
-                    size_t bytes_read;
-                    while ((bytes_read = entry.read(buffer, sizeof(buffer))) > 0) {
-                        size_t bytes_written = dest.write(buffer, bytes_read);
-                        if (bytes_written != bytes_read) {
-                            success = false;
-                            break;
-                        }
-                    }
-                    
-                    dest.close();
-                } else {
-                    success = false;
-                }
+    Serial.printf("   %lu files to copy, %lu unchanged, %lu to remove\n", num_copies, job.num_files - num_copies,
+                  num_removed);
+    if (num_copies == 0 && num_removed == 0) {
+        Serial.println("   Patterns already up to date");
+        if (new_mtimes) {
+            // Keep the new hashes, so that the files are not hashed again by the next update
+            usb_update_journal_entry_t *entries = new usb_update_journal_entry_t[job.num_files];
+            for (uint32_t i = 0; i < job.num_files; i++) {
+                entries[i] = job.files[i].entry;
             }
+            write_list(SD, USB_UPDATE_SYNC_PATH, USB_UPDATE_SYNC_TEMP_PATH, USB_UPDATE_JOURNAL_MAGIC, entries,
+                       job.num_files, sizeof(usb_update_journal_entry_t));
+            delete[] entries;
+        }
+        delete[] job.files;
+        job = {};
+        remove_staged_files();
+        return;
+    }
+    job.bytes_total = job.bytes_done + copy_size;
+}
+
+// Close the files of the current copy, and verify what was written. An error stops the update.
+static void finish_file(bool success) {
+    // The destination was allocated for the size of the source, a transcoded file is smaller
+    if (success && !job.destination.truncate(job.size)) {
+        Serial.println("   Error writing to the SD card");
+        success = false;
+    }
+    job.source.close();
+    job.destination.close();
+    job.bytes_done = job.file_end;
+    if (success) {
+        start_verify();
+    } else {
+        job.state = USB_UPDATE_FAILED;
+    }
+}
+
+// Start reading back the staged file
+static void start_verify() {
+    const usb_update_journal_entry_t& entry = job.files[job.file_index].entry;
+    job.staged = SD.open((String(USB_UPDATE_STAGING_DIR "/") + entry.filename).c_str());
+    job.verify_checksum = FILE_CHECKSUM_EMPTY;
+    job.verifying = true;
+}
+
+// Check that the staged file is what was written
+static void finish_verify() {
+    usb_update_journal_entry_t& entry = job.files[job.file_index].entry;
+    const bool verified = job.staged && job.staged.size() == job.size && job.verify_checksum == job.checksum;
+    job.staged.close();
+    job.verifying = false;
+    if (!verified) {
+        Serial.printf("   Verification failed for %s\n", entry.filename);
+        job.state = USB_UPDATE_FAILED;
+        return;
+    }
+    entry.size = job.size;
+    entry.checksum = job.checksum;
+    const uint32_t elapsed_ms = millis() - job.file_start_ms;
+    // The rate over the elapsed time includes the LED refresh between the steps
+    const uint32_t elapsed_rate = rate(entry.source_size, elapsed_ms * 1000ull);
+    const uint32_t busy_rate = rate(entry.source_size, job.file_busy_us);
+    Serial.printf("   %lu KB in %lu ms: %lu.%02lu MB/s, %lu.%02lu MB/s while copying\n",
+                  (uint32_t)(entry.source_size / 1024), elapsed_ms, elapsed_rate / 100, elapsed_rate % 100,
+                  busy_rate / 100, busy_rate % 100);
+    job.total_busy_us += job.file_busy_us;
+    job.file_index++;
+}
+
+// Create a file of the SD card for writing, with all its clusters allocated in one contiguous run
+// so that the writes don't have to look for free clusters and the file is not fragmented.
+// The file is written as if it was empty, and must be truncated to what was written.
+static File create_file(const char *path, uint64_t size) {
+    FsFile file = SD.sdfs.open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!file) {
+        return File();
+    }
+    // Without a contiguous run of clusters big enough, the file is just allocated as it is written
+    file.preAllocate(size);
+    file.close();
+    return SD.open(path, FILE_WRITE_BEGIN);
+}
+
+// Transfer rate, in hundredths of MB/s
+static uint32_t rate(uint64_t bytes, uint64_t us) {
+    return us > 0 ? bytes * 100 / us : 0;
+}
+
+// Write the journal of the files the SD card must have. It is only complete once renamed.
+static bool commit_journal() {
+    usb_update_journal_entry_t *entries = new usb_update_journal_entry_t[job.num_files];
+    for (uint32_t i = 0; i < job.num_files; i++) {
+        entries[i] = job.files[i].entry;
+    }
+    bool success = write_list(SD, USB_UPDATE_JOURNAL_PATH, USB_UPDATE_JOURNAL_TEMP_PATH, USB_UPDATE_JOURNAL_MAGIC,
+                              entries, job.num_files, sizeof(usb_update_journal_entry_t));
+    delete[] entries;
+    return success;
+}
+
+// Make the .bin files of the SD card root directory match the journal: remove the files that are
+// not in it, and move the staged files in place. Files already moved by an interrupted earlier
+// attempt are left alone. The journal then becomes the sync list.
+static bool apply_journal() {
+    uint32_t num_entries = 0;
+    usb_update_journal_entry_t *entries = (usb_update_journal_entry_t *)read_list(
+        SD, USB_UPDATE_JOURNAL_PATH, USB_UPDATE_JOURNAL_MAGIC, sizeof(usb_update_journal_entry_t), &num_entries);
+    if (entries == nullptr) {
+        return false;
+    }
+
+    // Remove the old patterns that are not in the update. They are removed after the directory has been listed.
+    String stale;
+    File root = SD.open("/");
+    File entry;
+    while (root && (entry = root.openNextFile())) {
+        const char *name = entry.name();
+        bool in_update = false;
+        for (uint32_t i = 0; i < num_entries && !in_update; i++) {
+            in_update = strcmp(entries[i].filename, name) == 0;
+        }
+        if (!entry.isDirectory() && ends_with(name, ".bin") && !in_update) {
+            stale += name;
+            stale += '\n';
         }
         entry.close();
     }
+    root.close();
+    int start = 0;
+    int end;
+    while ((end = stale.indexOf('\n', start)) >= 0) {
+        SD.remove(stale.substring(start, end).c_str());
+        start = end + 1;
+    }
+
+    // Move the staged files in place of the old ones
+    bool success = true;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        const String staged_path = String(USB_UPDATE_STAGING_DIR "/") + entries[i].filename;
+        const String path = String("/") + entries[i].filename;
+        if (SD.exists(staged_path.c_str())) {
+            SD.remove(path.c_str());
+            if (!SD.rename(staged_path.c_str(), path.c_str())) {
+                success = false;
+            }
+        }
+    }
+    delete[] (uint8_t *)entries;
     
-    usb_dir.close();
-    return success;
+    // Keep the journal for the next update
+    SD.remove(USB_UPDATE_SYNC_PATH);
+    return SD.rename(USB_UPDATE_JOURNAL_PATH, USB_UPDATE_SYNC_PATH) && success;
+}
+
+// Write a file list. It is written under a temporary name first, so that a partial list is never read.
+static bool write_list(FS& fs, const char *path, const char *temp_path, uint32_t magic, const void *entries,
+                       uint32_t num_entries, uint16_t entry_size) {
+    const size_t entries_size = num_entries * entry_size;
+    usb_update_list_header_t header = {
+        .magic = magic,
+        .version = USB_UPDATE_LIST_VERSION,
+        .entry_size = entry_size,
+        .num_entries = num_entries,
+        .checksum = file_checksum_add(FILE_CHECKSUM_EMPTY, sizeof(usb_update_list_header_t), entries, entries_size),
+    };
+    // FILE_WRITE appends to existing files, so start from scratch
+    fs.remove(temp_path);
+    File file = fs.open(temp_path, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    bool success = file.write(&header, sizeof(header)) == sizeof(header);
+    success = success && file.write(entries, entries_size) == entries_size;
+    success = success && file.size() == sizeof(header) + entries_size;
+    file.close();
+    if (!success) {
+        fs.remove(temp_path);
+        return false;
+    }
+    fs.remove(path);
+    return fs.rename(temp_path, path);
+}
+
+// Read a file list. Returns the entries (to release with delete[] as uint8_t), or nullptr if there
+// is no valid list. The file names of the entries are terminated, whatever is on the disk.
+static uint8_t *read_list(FS& fs, const char *path, uint32_t magic, uint16_t entry_size, uint32_t *num_entries) {
+    File file = fs.open(path);
+    if (!file) {
+        return nullptr;
+    }
+    usb_update_list_header_t header;
+    if (file.read(&header, sizeof(header)) != sizeof(header) || header.magic != magic ||
+        header.version != USB_UPDATE_LIST_VERSION || header.entry_size != entry_size ||
+        file.size() != sizeof(header) + (uint64_t)header.num_entries * entry_size) {
+        file.close();
+        return nullptr;
+    }
+    const size_t entries_size = header.num_entries * entry_size;
+    uint8_t *entries = new uint8_t[entries_size];
+    bool success = file.read(entries, entries_size) == entries_size &&
+                   file_checksum_add(FILE_CHECKSUM_EMPTY, sizeof(header), entries, entries_size) == header.checksum;
+    file.close();
+    if (!success) {
+        delete[] entries;
+        return nullptr;
+    }
+    // All the lists start with the file name
+    for (uint32_t i = 0; i < header.num_entries; i++) {
+        entries[i * entry_size + CACHED_PATTERN_FILENAME_LENGTH - 1] = '\0';
+    }
+    *num_entries = header.num_entries;
+    return entries;
+}
+
+// Remove the staging directory and everything in it
+static void remove_staged_files() {
+    File staging_dir = SD.open(USB_UPDATE_STAGING_DIR);
+    if (!staging_dir) {
+        return;
+    }
+    String names;
+    File entry;
+    while ((entry = staging_dir.openNextFile())) {
+        names += entry.name();
+        names += '\n';
+        entry.close();
+    }
+    staging_dir.close();
+    int start = 0;
+    int end;
+    while ((end = names.indexOf('\n', start)) >= 0) {
+        SD.remove((String(USB_UPDATE_STAGING_DIR "/") + names.substring(start, end)).c_str());
+        start = end + 1;
+    }
+    SD.rmdir(USB_UPDATE_STAGING_DIR);
 }
@@ -1,10 +1,57 @@
 #ifndef USB_UPDATE_H
 #define USB_UPDATE_H
 
+#include "cached_pattern.h"
 #include <stdint.h>
 #include <stdbool.h>
 
 #define PATTERN_FOLDER_NAME "is_bed_patterns"
+// Transcode the patterns to the fastest layout to play while copying them
+#define USB_UPDATE_TRANSCODE true
+// Directory of the SD card where the new patterns are written while the current ones keep playing
+#define USB_UPDATE_STAGING_DIR "/.is_bed_update"
+// Size of the buffer the files go through. A multiple of the SD sector size, so that the USB drive
+// and the SD card both get large multi-sector transfers instead of one sector at a time.
+#define USB_UPDATE_BUFFER_SIZE 16384
+// Bytes read from the USB drive by each usb_update_step(): one buffer. Small enough to keep up with the LED refresh.
+#define USB_UPDATE_CHUNK_SIZE USB_UPDATE_BUFFER_SIZE
+// Once all the staged files are verified, the list of the files the SD card must have is written there.
+// Its presence commits the update: an update interrupted after that is finished at boot, while one
+// interrupted before is dropped.
+#define USB_UPDATE_JOURNAL_PATH USB_UPDATE_STAGING_DIR "/.journal"
+#define USB_UPDATE_JOURNAL_TEMP_PATH USB_UPDATE_STAGING_DIR "/.journal.new"
+#define USB_UPDATE_JOURNAL_MAGIC 0x4C4A4253
+// Once applied, the journal is kept there, as the list of what the SD card got from the USB drive.
+// The next update only hashes and copies the files that changed since. Nothing is written to the USB drive.
+#define USB_UPDATE_SYNC_PATH "/.is_bed_sync"
+#define USB_UPDATE_SYNC_TEMP_PATH "/.is_bed_sync.new"
+// Version 2 adds the modification time of the USB drive files to the journal entries
+#define USB_UPDATE_LIST_VERSION 2
+
+// Header of the journal. It is followed by num_entries entries.
+struct [[gnu::packed]] usb_update_list_header_t {
+    uint32_t magic;
+    uint16_t version;
+    // Size of an entry, to detect layout changes
+    uint16_t entry_size;
+    uint32_t num_entries;
+    // Checksum of the entries (see file_checksum_add())
+    uint32_t checksum;
+};
+
+// Journal entry for one file of the SD card
+struct [[gnu::packed]] usb_update_journal_entry_t {
+    char filename[CACHED_PATTERN_FILENAME_LENGTH];
+    // Size and checksum of the file, as verified after it was staged
+    uint32_t size;
+    uint32_t checksum;
+    // Size and hash (see file_hash_add()) of the USB drive file it was made from
+    uint32_t source_size;
+    uint64_t source_hash;
+    // Modification time of the USB drive file (see pattern_manifest_mtime()). The hash is reused by the
+    // next update as long as the size and modification time match.
+    uint32_t source_mtime;
+};
 
 /**
  * Check if a folder named "is_bed_patterns" exists on the USB drive
@@ -14,19 +61,71 @@
  */
 bool usb_has_bins();
 
+// State of the background pattern update
+typedef enum {
+    // No update
+    USB_UPDATE_IDLE,
+    // The patterns are being copied to the staging directory
+    USB_UPDATE_RUNNING,
+    // All the patterns are staged, usb_update_commit() can swap them in
+    USB_UPDATE_READY,
+    // The copy failed, usb_update_cancel() must be called
+    USB_UPDATE_FAILED,
+} usb_update_state_t;
+
 /**
- * Remove all .bin files from the SD card root directory.
- * 
- * @return true if successful (or no files to remove), false on error
+ * Start copying the .bin files from the "is_bed_patterns" folder on the USB drive
+ * to a staging directory on the SD card. The copy happens in small pieces in
+ * usb_update_step(), so the current patterns keep playing meanwhile.
+ *
+ * The files are first hashed, unless the journal of the last update already knows them.
+ * Only the files that are new or changed since the last update are then copied, and the
+ * SD card files that are not on the USB drive anymore are removed when the update is committed.
+ * The copy rate of each file is printed on the serial port.
+ *
+ * @param transcode if true, plain RGB patterns are rewritten in the layout that is
+ *                  the fastest to play (see pattern_transcode()), and the size
+ *                  savings are printed on the serial port
+ * @return true if the update started, false on error
  */
-bool sd_remove_bins();
+bool usb_update_start(bool transcode);
 
 /**
- * Copy all .bin files from the "is_bed_patterns" folder on the USB drive
- * to the root of the SD card.
- * 
+ * Do a bounded amount of work on the update: at most USB_UPDATE_CHUNK_SIZE bytes
+ * are read from the USB drive.
+ *
+ * @return the state of the update after this step. USB_UPDATE_IDLE if the SD card
+ *         turned out to have the same files as the USB drive already.
+ */
+usb_update_state_t usb_update_step();
+
+/**
+ * @return the state of the update
+ */
+usb_update_state_t usb_update_state();
+
+/**
+ * @return how much of the update is done, in percent
+ */
+uint8_t usb_update_progress();
+
+/**
+ * Replace the .bin files of the SD card root directory with the staged ones.
+ * The cached patterns must not be in use, as their files are removed.
+ *
  * @return true if successful, false on error
  */
-bool copy_bins_from_usb_to_sd();
+bool usb_update_commit();
+
+/**
+ * Finish an update that was committed but interrupted by a reset, or drop the staged
+ * files of an update that was not committed. Must be called before the patterns are loaded.
+ */
+void usb_update_recover();
+
+/**
+ * Abandon the update, and remove the staged files.
+ */
+void usb_update_cancel();
 
 #endif // USB_UPDATE_H
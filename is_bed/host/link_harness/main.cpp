@@ -0,0 +1,759 @@
+// Link harness
+//
+// Runs both sides of the controller/LCD link in one process: the controller side (lcd_link.cpp) and the
+// LCD side (controller_link.cpp), each with its own SerialTransfer, over an in-memory serial pipe and on
+// a virtual clock. The clock of the LCD starts LCD_CLOCK_OFFSET_MS ahead and drifts, for the LCD to follow
+// the pattern clock of the controller. The LCD side turns the knobs, the controller side plays a pattern
+// update every UPDATE_CYCLE_MS and then swaps its patterns.
+//
+// Usage:
+//   link_harness bench [options]
+//       Traffic, state latency and host CPU time per message on a clean link
+//   link_harness fuzz [options]
+//       Drops, duplicates, reorders, truncates and corrupts frames, and sends garbage between them.
+//       The link is then clean for QUIET_MS, after which both sides must agree on the state, the
+//       pattern catalog and the pattern set, and the LCD must follow the pattern clock within
+//       MAX_CLOCK_ERROR_MS. Exits with 1 if they don't.
+//
+// Options:
+//   --seconds <s>       Simulated time (default: 60 for bench, 30 for fuzz, plus the quiet time)
+//   --seed <n>          Seed of the random changes and damages (default: 1)
+//   --error-rate <p>    Fuzz: probability that a frame is damaged (default: 0.1)
+//   --latency-us <us>   Time a frame spends on the way, once all its bytes are sent (default: 1000)
+//   --byte-us <us>      Time a byte takes on the wire (default: 1)
+//   --step-us <us>      Period of the main loop of both sides (default: 500)
+//   --change-ms <ms>    Time between two knob changes on the LCD (default: 50)
+//   --drift-ppm <ppm>   How much faster the clock of the LCD runs, in parts per million (default: 50)
+//   --verbose           Print what the link prints on the serial port
+#include "lcd_link.h"
+#include "led_array.h"
+#include "led_pattern.h"
+#include "led_palette.h"
+#include "led_preview.h"
+#include "controller_link.h"
+#include <Arduino.h>
+#include <is_bed_link.h>
+#include <stdio.h>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+// Period of the LED refresh of the controller, which sends to the LCD
+#define CONTROLLER_TICK_MS 20
+// A pattern update runs for UPDATE_MS at the start of each cycle, then the patterns are swapped
+#define UPDATE_CYCLE_MS 10000
+#define UPDATE_MS 5000
+// Patterns of the controller, to get a catalog of several chunks
+#define NUM_HARNESS_PATTERNS 40
+// Fuzz: clean link at the end, for both sides to catch up
+#define QUIET_MS 5000
+// The LCD was powered on that long before the controller
+#define LCD_CLOCK_OFFSET_MS 123456
+// Fuzz: largest error of the pattern clock on the LCD at the end. Both clocks count whole ms.
+#define MAX_CLOCK_ERROR_MS 2
+
+// Damages a frame can get on the way
+typedef enum {
+    DAMAGE_DROP,
+    DAMAGE_DUPLICATE,
+    DAMAGE_REORDER,
+    DAMAGE_TRUNCATE,
+    DAMAGE_CORRUPT,
+    DAMAGE_GARBAGE,
+    NUM_DAMAGES,
+} damage_t;
+static const char *damage_names[NUM_DAMAGES] = {"dropped", "duplicated", "reordered", "truncated", "corrupted",
+                                                "after garbage"};
+
+// Options of the commands
+typedef struct {
+    uint32_t seconds;
+    uint64_t seed;
+    double error_rate;
+    uint32_t latency_us;
+    uint32_t byte_us;
+    uint32_t step_us;
+    uint32_t change_ms;
+    int32_t drift_ppm;
+    bool verbose;
+} harness_options_t;
+
+// A frame on the way, and when it arrives
+typedef struct {
+    uint64_t arrival_us;
+    std::vector<uint8_t> bytes;
+} frame_t;
+
+// One way of the link. SerialTransfer writes each frame whole, so the frames can be damaged one by one.
+typedef struct {
+    std::deque<frame_t> in_flight;
+    // Bytes that arrived and are not read yet
+    std::vector<uint8_t> arrived;
+    size_t read_index;
+    // When the wire is free for the next frame
+    uint64_t free_us;
+    // A frame held back, to be sent after the next one
+    bool holding;
+    std::vector<uint8_t> held;
+    // Frames and bytes sent, frames read whole by the other side, and the damages done
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t damages[NUM_DAMAGES];
+} pipe_t;
+
+// The serial port of one side: reads from one way, writes to the other
+class pipe_stream_t : public Stream {
+public:
+    pipe_stream_t(pipe_t& in, pipe_t& out) : in_(in), out_(out) {}
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override;
+
+private:
+    pipe_t& in_;
+    pipe_t& out_;
+};
+
+// A change whose arrival on the other side is awaited
+typedef struct {
+    bool waiting;
+    uint8_t value;
+    uint64_t time_us;
+} probe_t;
+
+// Latencies measured with the probes
+typedef struct {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+} latency_t;
+
+// Error of the pattern clock on the LCD, once synced
+typedef struct {
+    uint64_t synced_us;
+    uint64_t count;
+    uint64_t total_abs_ms;
+    uint32_t max_abs_ms;
+    int32_t last_ms;
+} clock_error_t;
+
+// Host CPU time spent in the link functions of one side
+typedef struct {
+    uint64_t send_ns;
+    uint64_t receive_ns;
+} cpu_time_t;
+
+//
+// Static prototypes
+//
+static int usage();
+static bool parse_options(int argc, char **argv, harness_options_t& options);
+static int run(const harness_options_t& options, bool fuzz);
+static void controller_init();
+static void controller_step(uint64_t now_us, bool connected);
+static void controller_swap_patterns();
+static void lcd_step(uint64_t now_us, const harness_options_t& options);
+static void lcd_turn_knob(uint64_t now_us);
+static uint64_t lcd_time_us(uint64_t now_us);
+static void measure_clock(uint64_t now_us);
+static bool check_convergence();
+static void pipe_send(pipe_t& pipe, const uint8_t *buf, size_t size);
+static void pipe_enqueue(pipe_t& pipe, const std::vector<uint8_t>& bytes);
+static void pipe_arrive(pipe_t& pipe);
+static void print_pipe(const char *name, const pipe_t& pipe, double seconds);
+static void add_latency(latency_t& latency, uint64_t us);
+static void print_latency(const char *name, const latency_t& latency);
+static uint64_t cpu_ns();
+static uint32_t random_next();
+
+// The two ways of the link, and the serial ports of both sides
+static pipe_t to_lcd_pipe;
+static pipe_t to_controller_pipe;
+static pipe_stream_t controller_port(to_controller_pipe, to_lcd_pipe);
+static pipe_stream_t lcd_port(to_lcd_pipe, to_controller_pipe);
+// Whether the frames get damaged, and how often
+static bool damaging = false;
+static double damage_rate = 0;
+static uint32_t pipe_latency_us = 0;
+static uint32_t pipe_byte_us = 0;
+static uint64_t random_state = 1;
+// The time of the simulation, which is that of the controller. The clock of the LCD runs apart from it.
+static uint64_t world_us = 0;
+static int32_t lcd_drift_ppm = 0;
+
+// Controller side: the pattern update, the pattern set the LCD must end up with, and the last refresh
+static uint8_t update_progress = IS_BED_UPDATE_NONE;
+static uint8_t expected_pattern_set = 0;
+static uint64_t last_tick_us = 0;
+static bool update_swapped = false;
+static cpu_time_t controller_cpu;
+
+// LCD side: the state the UI would send, and what it learned from the controller
+static is_bed_lcd_state_t ui_state;
+static is_bed_controller_state_t lcd_controller_state = {IS_BED_UPDATE_NONE, 0, 1};
+static char lcd_pattern_names[MAX_LED_PATTERNS][sizeof(is_bed_catalog_entry_t::name) + 1];
+static uint32_t lcd_num_patterns = 0;
+static char remembered_selected_names[NUM_ZONES][sizeof(lcd_pattern_names[0])];
+static char remembered_displayed_names[NUM_ZONES][sizeof(lcd_pattern_names[0])];
+static uint64_t lcd_previews = 0;
+static clock_error_t lcd_clock_error;
+static uint64_t last_change_us = 0;
+static uint32_t next_zone = 0;
+static cpu_time_t lcd_cpu;
+
+// Probes: a brightness per zone on the way to the controller, the update progress on the way to the LCD
+static probe_t brightness_probes[NUM_ZONES];
+static probe_t progress_probe;
+static latency_t to_controller_latency;
+static latency_t to_lcd_latency;
+
+//
+// LCD callbacks, as the UI of lcd/src/main.cpp would do
+//
+static void lcd_state_changed(const is_bed_controller_state_t& state) {
+    lcd_controller_state = state;
+    if (progress_probe.waiting && state.update_progress == progress_probe.value) {
+        add_latency(to_lcd_latency, world_us - progress_probe.time_us);
+        progress_probe.waiting = false;
+    }
+}
+
+static void lcd_catalog_invalidated() {
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        strcpy(remembered_selected_names[i], lcd_pattern_names[ui_state.zones[i].selected_pattern_index]);
+        strcpy(remembered_displayed_names[i], lcd_pattern_names[ui_state.zones[i].displayed_pattern_index]);
+    }
+}
+
+static void lcd_catalog_entry(uint8_t index, const is_bed_catalog_entry_t& entry) {
+    const size_t length = strnlen(entry.name, sizeof(entry.name));
+    memcpy(lcd_pattern_names[index], entry.name, length);
+    lcd_pattern_names[index][length] = '\0';
+}
+
+static uint8_t lcd_find_pattern(const char *name) {
+    for (uint32_t i = 0; i < lcd_num_patterns; i++) {
+        if (strcmp(lcd_pattern_names[i], name) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static void lcd_catalog_complete(uint8_t num_patterns) {
+    lcd_num_patterns = num_patterns;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        ui_state.zones[i].selected_pattern_index = lcd_find_pattern(remembered_selected_names[i]);
+        ui_state.zones[i].displayed_pattern_index = lcd_find_pattern(remembered_displayed_names[i]);
+    }
+}
+
+static void lcd_zone_preview(const color_rgb_t zone_color[]) {
+    lcd_previews++;
+}
+
+static void lcd_segment_preview(const is_bed_segment_preview_t& preview, const is_bed_preview_color_t *colors) {
+    lcd_previews++;
+}
+
+static void lcd_stats_received(const is_bed_link_stats_t& lcd, const is_bed_link_stats_t& controller) {
+}
+
+static const controller_link_callbacks_t lcd_callbacks = {
+    lcd_state_changed,
+    lcd_catalog_invalidated,
+    lcd_catalog_entry,
+    lcd_catalog_complete,
+    lcd_zone_preview,
+    lcd_segment_preview,
+    lcd_stats_received,
+};
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        return usage();
+    }
+    String command = argv[1];
+    if (command != "bench" && command != "fuzz") {
+        return usage();
+    }
+    const bool fuzz = command == "fuzz";
+    harness_options_t options = {
+        .seconds = fuzz ? 30u : 60u,
+        .seed = 1,
+        .error_rate = 0.1,
+        .latency_us = 1000,
+        .byte_us = 1,
+        .step_us = 500,
+        .change_ms = 50,
+        .drift_ppm = 50,
+        .verbose = false,
+    };
+    if (!parse_options(argc - 2, argv + 2, options)) {
+        return usage();
+    }
+    return run(options, fuzz);
+}
+
+static int usage() {
+    fprintf(stderr,
+            "Usage:\n"
+            "  link_harness bench [options]\n"
+            "  link_harness fuzz [options]\n"
+            "Options:\n"
+            "  --seconds <s> --seed <n> --error-rate <p> --latency-us <us> --byte-us <us>\n"
+            "  --step-us <us> --change-ms <ms> --drift-ppm <ppm> --verbose\n");
+    return 2;
+}
+
+static bool parse_options(int argc, char **argv, harness_options_t& options) {
+    for (int i = 0; i < argc; i++) {
+        String arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--seconds" && has_value) {
+            options.seconds = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && has_value) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--error-rate" && has_value) {
+            options.error_rate = strtod(argv[++i], nullptr);
+        } else if (arg == "--latency-us" && has_value) {
+            options.latency_us = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--byte-us" && has_value) {
+            options.byte_us = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--step-us" && has_value) {
+            options.step_us = max(strtoul(argv[++i], nullptr, 10), 1ul);
+        } else if (arg == "--change-ms" && has_value) {
+            options.change_ms = max(strtoul(argv[++i], nullptr, 10), 1ul);
+        } else if (arg == "--drift-ppm" && has_value) {
+            options.drift_ppm = strtol(argv[++i], nullptr, 10);
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static int run(const harness_options_t& options, bool fuzz) {
+    Serial.setQuiet(!options.verbose);
+    random_state = options.seed * 0x9E3779B97F4A7C15ull + 1;
+    damage_rate = fuzz ? options.error_rate : 0;
+    pipe_latency_us = options.latency_us;
+    pipe_byte_us = options.byte_us;
+    lcd_drift_ppm = options.drift_ppm;
+    host_set_time_us(0);
+    controller_init();
+    host_set_time_us(lcd_time_us(0));
+    controller_link_begin(lcd_port, MAX_LED_PATTERNS, lcd_callbacks);
+
+    const uint64_t damage_end_us = (uint64_t)options.seconds * 1000000;
+    const uint64_t end_us = damage_end_us + (fuzz ? (uint64_t)QUIET_MS * 1000 : 0);
+    for (uint64_t now_us = 0; now_us < end_us; now_us += options.step_us) {
+        world_us = now_us;
+        host_set_time_us(now_us);
+        damaging = fuzz && now_us < damage_end_us;
+        // The LCD is unplugged now and then while fuzzing
+        const bool connected = !damaging || (now_us / 1000) % 7919 >= 100;
+        controller_step(now_us, connected);
+        host_set_time_us(lcd_time_us(now_us));
+        lcd_step(now_us, options);
+        measure_clock(now_us);
+        for (uint32_t i = 0; i < NUM_ZONES; i++) {
+            probe_t& probe = brightness_probes[i];
+            if (probe.waiting && lcd_state.zones[i].brightness == probe.value) {
+                add_latency(to_controller_latency, now_us - probe.time_us);
+                probe.waiting = false;
+            }
+        }
+    }
+
+    const double seconds = end_us / 1e6;
+    printf("%s: %.1f s simulated, seed %llu, frame latency %u us, %u us per byte, loop period %u us\n",
+           fuzz ? "Fuzz" : "Bench", seconds, (unsigned long long)options.seed, options.latency_us, options.byte_us,
+           options.step_us);
+    print_pipe("Controller -> LCD", to_lcd_pipe, seconds);
+    print_pipe("LCD -> controller", to_controller_pipe, seconds);
+    printf("Previews shown by the LCD: %llu\n", (unsigned long long)lcd_previews);
+    print_latency("State latency LCD -> controller", to_controller_latency);
+    print_latency("State latency controller -> LCD", to_lcd_latency);
+    if (lcd_clock_error.count > 0) {
+        printf("Pattern clock on the LCD: synced after %.1f ms, error avg %.2f ms, max %u ms, %d ms at the end\n",
+               lcd_clock_error.synced_us / 1000.0, (double)lcd_clock_error.total_abs_ms / lcd_clock_error.count,
+               lcd_clock_error.max_abs_ms, lcd_clock_error.last_ms);
+    } else {
+        printf("Pattern clock on the LCD: never synced\n");
+    }
+    // Each side sends about as many frames as the other reads
+    const uint64_t to_lcd_frames = max(to_lcd_pipe.frames, (uint64_t)1);
+    const uint64_t to_controller_frames = max(to_controller_pipe.frames, (uint64_t)1);
+    printf("Host CPU per frame: controller send %llu ns (with the previews), receive %llu ns\n",
+           (unsigned long long)(controller_cpu.send_ns / to_lcd_frames),
+           (unsigned long long)(controller_cpu.receive_ns / to_controller_frames));
+    printf("                    LCD send %llu ns, receive %llu ns\n",
+           (unsigned long long)(lcd_cpu.send_ns / to_controller_frames),
+           (unsigned long long)(lcd_cpu.receive_ns / to_lcd_frames));
+    const uint64_t total_ns = controller_cpu.send_ns + controller_cpu.receive_ns + lcd_cpu.send_ns + lcd_cpu.receive_ns;
+    printf("Frames per host CPU second: %.0f\n", (to_lcd_pipe.frames + to_controller_pipe.frames) * 1e9 / max(total_ns, (uint64_t)1));
+    // The link prints its counters on the serial port, which is stderr
+    fflush(stdout);
+    Serial.setQuiet(false);
+    lcd_link_print_stats();
+
+    if (!fuzz) {
+        return 0;
+    }
+    if (!check_convergence()) {
+        printf("FAILED: the two sides disagree after %u ms of clean link\n", QUIET_MS);
+        return 1;
+    }
+    printf("Converged\n");
+    return 0;
+}
+
+// The zones, and a catalog of NUM_HARNESS_PATTERNS procedural patterns
+static void controller_init() {
+    led_array_init();
+    led_preview_init();
+    static const led_pattern_func_t updates[] = {rotate_pattern, fade_pattern, blink_pattern, static_pattern};
+    for (uint32_t i = 0; i < NUM_HARNESS_PATTERNS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Pattern %u", i);
+        led_patterns[i].name = name;
+        led_patterns[i].cached_pattern = nullptr;
+        led_patterns[i].update = updates[i % (sizeof(updates) / sizeof(updates[0]))];
+    }
+    num_led_patterns = NUM_HARNESS_PATTERNS;
+    lcd_link_begin(controller_port);
+}
+
+// The main loop of the controller: sends at each LED refresh, receives all the time
+static void controller_step(uint64_t now_us, bool connected) {
+    if (now_us - last_tick_us >= CONTROLLER_TICK_MS * 1000) {
+        last_tick_us = now_us;
+        // The pattern update, then the swap
+        const uint32_t cycle_ms = (now_us / 1000) % UPDATE_CYCLE_MS;
+        uint8_t progress = IS_BED_UPDATE_NONE;
+        if (cycle_ms < UPDATE_MS) {
+            progress = cycle_ms * 100 / UPDATE_MS;
+            update_swapped = false;
+        } else if (!update_swapped) {
+            controller_swap_patterns();
+            update_swapped = true;
+        }
+        if (progress != update_progress) {
+            update_progress = progress;
+            progress_probe = {true, progress, now_us};
+        }
+        const uint64_t start_ns = cpu_ns();
+        if (connected) {
+            lcd_link_send(update_progress);
+        } else {
+            lcd_link_disconnected();
+        }
+        controller_cpu.send_ns += cpu_ns() - start_ns;
+    }
+    const uint64_t start_ns = cpu_ns();
+    lcd_link_receive();
+    controller_cpu.receive_ns += cpu_ns() - start_ns;
+}
+
+// A new pattern set: the patterns move by one, and one is added or removed. The zones keep their patterns.
+static void controller_swap_patterns() {
+    String selected_names[NUM_ZONES];
+    String displayed_names[NUM_ZONES];
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        selected_names[i] = led_patterns[led_zones[i].led_pattern_index].name;
+        displayed_names[i] = led_patterns[led_zones[i].ui_pattern_index].name;
+    }
+    const led_pattern_t first = led_patterns[0];
+    for (uint32_t i = 1; i < num_led_patterns; i++) {
+        led_patterns[i - 1] = led_patterns[i];
+    }
+    led_patterns[num_led_patterns - 1] = first;
+    num_led_patterns = num_led_patterns == NUM_HARNESS_PATTERNS ? NUM_HARNESS_PATTERNS - 1 : NUM_HARNESS_PATTERNS;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        led_zones[i].led_pattern_index = 0;
+        led_zones[i].ui_pattern_index = 0;
+        for (uint32_t j = 0; j < num_led_patterns; j++) {
+            if (led_patterns[j].name == selected_names[i]) {
+                led_zones[i].led_pattern_index = j;
+            }
+            if (led_patterns[j].name == displayed_names[i]) {
+                led_zones[i].ui_pattern_index = j;
+            }
+        }
+    }
+    lcd_link_patterns_swapped();
+    expected_pattern_set++;
+}
+
+// The main loop of the LCD
+static void lcd_step(uint64_t now_us, const harness_options_t& options) {
+    uint64_t start_ns = cpu_ns();
+    controller_link_receive();
+    lcd_cpu.receive_ns += cpu_ns() - start_ns;
+    // No more changes once the fuzzing is over, for both sides to agree
+    if (now_us - last_change_us >= (uint64_t)options.change_ms * 1000 && now_us < (uint64_t)options.seconds * 1000000) {
+        last_change_us = now_us;
+        lcd_turn_knob(now_us);
+    }
+    start_ns = cpu_ns();
+    controller_link_update(ui_state);
+    lcd_cpu.send_ns += cpu_ns() - start_ns;
+}
+
+// The clock of the LCD at a time of the simulation
+static uint64_t lcd_time_us(uint64_t now_us) {
+    return now_us + (uint64_t)LCD_CLOCK_OFFSET_MS * 1000 + (int64_t)now_us * lcd_drift_ppm / 1000000;
+}
+
+// Compare the pattern clock seen by the LCD with the clock of the controller. The host clock must be that of
+// the LCD.
+static void measure_clock(uint64_t now_us) {
+    if (!controller_link_clock_synced()) {
+        return;
+    }
+    clock_error_t& error = lcd_clock_error;
+    if (error.count == 0) {
+        error.synced_us = now_us;
+    }
+    error.last_ms = (int32_t)(controller_link_pattern_ms() - (uint32_t)(now_us / 1000));
+    const uint32_t abs_ms = abs(error.last_ms);
+    error.count++;
+    error.total_abs_ms += abs_ms;
+    error.max_abs_ms = max(error.max_abs_ms, abs_ms);
+}
+
+// Change a setting of the next zone. The brightness always changes, and is awaited on the controller.
+static void lcd_turn_knob(uint64_t now_us) {
+    const uint32_t zone_index = next_zone;
+    next_zone = (next_zone + 1) % NUM_ZONES;
+    is_bed_zone_state_t& zone = ui_state.zones[zone_index];
+    switch (random_next() % 5) {
+    case 0:
+        if (controller_link_catalog_valid() && lcd_num_patterns > 0) {
+            zone.selected_pattern_index = random_next() % lcd_num_patterns;
+            zone.displayed_pattern_index = random_next() % lcd_num_patterns;
+        }
+        break;
+    case 1:
+        zone.color = {(uint8_t)random_next(), (uint8_t)random_next(), (uint8_t)random_next()};
+        break;
+    case 2:
+        zone.palette_index = random_next() % max(lcd_controller_state.num_palettes, (uint8_t)1);
+        break;
+    case 3:
+        zone.frequency = 1 + random_next() % 255;
+        break;
+    case 4:
+        zone.phase = random_next();
+        break;
+    }
+    zone.brightness += 1 + random_next() % 255;
+    brightness_probes[zone_index] = {true, zone.brightness, now_us};
+}
+
+// Both sides must agree on everything
+static bool check_convergence() {
+    bool converged = true;
+    if (!controller_link_connected()) {
+        printf("The LCD is not connected\n");
+        converged = false;
+    }
+    if (!controller_link_clock_synced() || abs(lcd_clock_error.last_ms) > MAX_CLOCK_ERROR_MS) {
+        printf("The LCD is %d ms off the pattern clock\n", lcd_clock_error.last_ms);
+        converged = false;
+    }
+    if (!controller_link_catalog_valid()) {
+        printf("The LCD does not have the current catalog\n");
+        converged = false;
+    }
+    if (lcd_num_patterns != num_led_patterns) {
+        printf("The LCD has %u patterns, the controller %u\n", lcd_num_patterns, num_led_patterns);
+        converged = false;
+    }
+    for (uint32_t i = 0; i < min(lcd_num_patterns, num_led_patterns); i++) {
+        if (led_patterns[i].name != lcd_pattern_names[i]) {
+            printf("Pattern %u is %s on the LCD, %s on the controller\n", i, lcd_pattern_names[i],
+                   led_patterns[i].name.c_str());
+            converged = false;
+        }
+    }
+    if (ui_state.pattern_set != expected_pattern_set || lcd_controller_state.pattern_set != expected_pattern_set) {
+        printf("Pattern set %u on the LCD, %u in the controller state it has, %u on the controller\n",
+               ui_state.pattern_set, lcd_controller_state.pattern_set, expected_pattern_set);
+        converged = false;
+    }
+    if (lcd_controller_state.update_progress != update_progress) {
+        printf("Update progress %u on the LCD, %u on the controller\n", lcd_controller_state.update_progress,
+               update_progress);
+        converged = false;
+    }
+    if (memcmp(&ui_state, &lcd_state, sizeof(ui_state)) != 0) {
+        printf("The controller has another LCD state than the LCD: pattern set %u/%u\n", lcd_state.pattern_set,
+               ui_state.pattern_set);
+        for (uint32_t i = 0; i < NUM_ZONES; i++) {
+            const is_bed_zone_state_t& got = lcd_state.zones[i];
+            const is_bed_zone_state_t& sent = ui_state.zones[i];
+            printf("  zone %s: patterns %u/%u %u/%u, color %02x%02x%02x/%02x%02x%02x, palette %u/%u, frequency %u/%u, "
+                   "brightness %u/%u, phase %u/%u\n",
+                   led_zones[i].name, got.selected_pattern_index, sent.selected_pattern_index,
+                   got.displayed_pattern_index, sent.displayed_pattern_index, got.color.r, got.color.g, got.color.b,
+                   sent.color.r, sent.color.g, sent.color.b, got.palette_index, sent.palette_index, got.frequency,
+                   sent.frequency, got.brightness, sent.brightness, got.phase, sent.phase);
+        }
+        converged = false;
+    }
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        if (led_zones[i].led_pattern_index != ui_state.zones[i].selected_pattern_index ||
+            led_zones[i].ui_pattern_index != ui_state.zones[i].displayed_pattern_index) {
+            printf("Zone %s plays pattern %u and displays %u, the LCD selected %u and displays %u\n",
+                   led_zones[i].name, led_zones[i].led_pattern_index, led_zones[i].ui_pattern_index,
+                   ui_state.zones[i].selected_pattern_index, ui_state.zones[i].displayed_pattern_index);
+            converged = false;
+        }
+        if (led_zones[i].phase_offset != (uint32_t)ui_state.zones[i].phase << 24) {
+            printf("Zone %s plays at phase %08x, the LCD set %u/256\n", led_zones[i].name, led_zones[i].phase_offset,
+                   ui_state.zones[i].phase);
+            converged = false;
+        }
+    }
+    return converged;
+}
+
+int pipe_stream_t::available() {
+    pipe_arrive(in_);
+    return in_.arrived.size() - in_.read_index;
+}
+
+int pipe_stream_t::read() {
+    if (available() == 0) {
+        return -1;
+    }
+    return in_.arrived[in_.read_index++];
+}
+
+int pipe_stream_t::peek() {
+    if (available() == 0) {
+        return -1;
+    }
+    return in_.arrived[in_.read_index];
+}
+
+size_t pipe_stream_t::write(const uint8_t *buf, size_t size) {
+    pipe_send(out_, buf, size);
+    return size;
+}
+
+// Send a frame, maybe damaged
+static void pipe_send(pipe_t& pipe, const uint8_t *buf, size_t size) {
+    std::vector<uint8_t> frame(buf, buf + size);
+    pipe.frames++;
+    pipe.bytes += size;
+    if (damaging && random_next() < damage_rate * 4294967296.0) {
+        const damage_t damage = (damage_t)(random_next() % NUM_DAMAGES);
+        pipe.damages[damage]++;
+        switch (damage) {
+        case DAMAGE_DROP:
+            return;
+        case DAMAGE_DUPLICATE:
+            pipe_enqueue(pipe, frame);
+            break;
+        case DAMAGE_REORDER:
+            if (!pipe.holding) {
+                pipe.holding = true;
+                pipe.held = frame;
+                return;
+            }
+            break;
+        case DAMAGE_TRUNCATE:
+            frame.resize(1 + random_next() % max(frame.size() - 1, (size_t)1));
+            break;
+        case DAMAGE_CORRUPT:
+            frame[random_next() % frame.size()] ^= 1 << (random_next() % 8);
+            break;
+        case DAMAGE_GARBAGE: {
+            std::vector<uint8_t> garbage(1 + random_next() % 16);
+            for (uint8_t& byte : garbage) {
+                byte = random_next();
+            }
+            pipe_enqueue(pipe, garbage);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    pipe_enqueue(pipe, frame);
+    if (pipe.holding) {
+        pipe.holding = false;
+        pipe_enqueue(pipe, pipe.held);
+    }
+}
+
+// Put bytes on the wire, after those already on it
+static void pipe_enqueue(pipe_t& pipe, const std::vector<uint8_t>& bytes) {
+    const uint64_t start_us = max(world_us, pipe.free_us);
+    pipe.free_us = start_us + bytes.size() * pipe_byte_us;
+    pipe.in_flight.push_back({pipe.free_us + pipe_latency_us, bytes});
+}
+
+// Make the frames that arrived readable
+static void pipe_arrive(pipe_t& pipe) {
+    if (pipe.read_index == pipe.arrived.size()) {
+        pipe.arrived.clear();
+        pipe.read_index = 0;
+    }
+    while (!pipe.in_flight.empty() && pipe.in_flight.front().arrival_us <= world_us) {
+        const std::vector<uint8_t>& bytes = pipe.in_flight.front().bytes;
+        pipe.arrived.insert(pipe.arrived.end(), bytes.begin(), bytes.end());
+        pipe.in_flight.pop_front();
+    }
+}
+
+static void print_pipe(const char *name, const pipe_t& pipe, double seconds) {
+    printf("%s: %llu frames (%.1f/s), %llu bytes (%.0f B/s)\n", name, (unsigned long long)pipe.frames,
+           pipe.frames / seconds, (unsigned long long)pipe.bytes, pipe.bytes / seconds);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < NUM_DAMAGES; i++) {
+        total += pipe.damages[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    printf("  damaged:");
+    for (uint32_t i = 0; i < NUM_DAMAGES; i++) {
+        printf(" %llu %s%s", (unsigned long long)pipe.damages[i], damage_names[i], i + 1 < NUM_DAMAGES ? "," : "\n");
+    }
+}
+
+static void add_latency(latency_t& latency, uint64_t us) {
+    latency.count++;
+    latency.total_us += us;
+    latency.max_us = max(latency.max_us, us);
+}
+
+static void print_latency(const char *name, const latency_t& latency) {
+    if (latency.count == 0) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    printf("%s: avg %.2f ms, max %.2f ms (%llu samples)\n", name, latency.total_us / 1000.0 / latency.count,
+           latency.max_us / 1000.0, (unsigned long long)latency.count);
+}
+
+static uint64_t cpu_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// xorshift64*, the same sequence for a seed on all hosts
+static uint32_t random_next() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (random_state * 0x2545F4914F6CDD1Dull) >> 32;
+}
@@ -0,0 +1,603 @@
+// Pattern baker
+//
+// Renders the controller's procedural patterns into cached pattern files (.bin)
+// laid out for the controller's LED topology (led_strings[] in led_array.cpp),
+// and validates existing cached pattern files against that topology.
+//
+// Usage:
+//   pattern_baker list
+//   pattern_baker bake <pattern> <output.bin> [options]
+//       --palette <name>   Palette to use (default: Rainbow)
+//       --color <RRGGBB>   Single color, also composed into palettes that ask for it (default: FF0000)
+//       --period <s>       Animation period in seconds, with up to ms resolution (default: 3)
+//       --steps <n>        Number of animation steps (default: 50 per second of period)
+//       --indexed          Store palette indexed pixels, with a file or per step palette
+//       --interpolate      Ask the controller to blend between steps
+//       --hold             Store identical consecutive steps once, as keyframes with a hold time
+//       --zone <name>      Only store the segments of a zone (can be repeated)
+//       --segment <name>   Only store a segment (can be repeated)
+//   pattern_baker validate <directory>
+//   pattern_baker mirror <directory> [--flash-kb <n>]
+//       Mirror the patterns of a directory into a RAM flash store of n KB (default: 16384) as the
+//       controller does at boot, check the mirrored frames against the directory, then check that a
+//       flash copy older than its file is replaced. Like the controller, writes the manifest there.
+#include "led_array.h"
+#include "led_pattern.h"
+#include "led_palette.h"
+#include "cached_pattern.h"
+#include "pattern_store.h"
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <SD.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+// The procedural patterns that can be baked
+typedef struct {
+    const char *name;
+    led_pattern_func_t update;
+} bakeable_pattern_t;
+
+static const bakeable_pattern_t bakeable_patterns[] = {
+    {"static", static_pattern},
+    {"rotate", rotate_pattern},
+    {"fade", fade_pattern},
+    {"blink", blink_pattern},
+    {"strobe", strobe_pattern},
+};
+static const uint32_t num_bakeable_patterns = sizeof(bakeable_patterns) / sizeof(bakeable_patterns[0]);
+
+// Options for the bake command
+typedef struct {
+    const bakeable_pattern_t *pattern;
+    const led_palette_t *palette;
+    CRGB color;
+    uint32_t period_ms;
+    uint32_t steps;
+    bool indexed;
+    bool interpolate;
+    bool hold;
+    // The segments to store, or all the topology if empty
+    std::vector<cached_pattern_segment_t> segments;
+} bake_options_t;
+
+//
+// Static prototypes
+//
+static int usage();
+static int list_command();
+static int bake_command(int argc, char **argv);
+static int validate_command(int argc, char **argv);
+static int mirror_command(int argc, char **argv);
+static uint32_t mirror(uint32_t *num_steps);
+static uint32_t check_mirror(FS *flash);
+static bool same_frames(cached_pattern_t &pattern);
+static bool add_segments(bake_options_t &options, bool zone, const char *name);
+static void render_step(const bake_options_t &options, uint32_t time_ms, uint32_t previous_time_ms, CRGB *frame);
+static void keep_segments(const bake_options_t &options, std::vector<CRGB> &frames, uint32_t &num_pixels);
+static bool write_pattern(const char *path, const bake_options_t &options, std::vector<CRGB> &frames, uint32_t num_pixels);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        return usage();
+    }
+    String command = argv[1];
+    if (command == "list") {
+        return list_command();
+    }
+    if (command == "bake") {
+        return bake_command(argc - 2, argv + 2);
+    }
+    if (command == "validate") {
+        return validate_command(argc - 2, argv + 2);
+    }
+    if (command == "mirror") {
+        return mirror_command(argc - 2, argv + 2);
+    }
+    return usage();
+}
+
+static int usage() {
+    fprintf(stderr,
+            "Usage:\n"
+            "  pattern_baker list\n"
+            "  pattern_baker bake <pattern> <output.bin> [--palette <name>] [--color <RRGGBB>]\n"
+            "                [--period <s>] [--steps <n>] [--indexed] [--interpolate] [--hold]\n"
+            "                [--zone <name>]... [--segment <name>]...\n"
+            "  pattern_baker validate <directory>\n"
+            "  pattern_baker mirror <directory> [--flash-kb <n>]\n");
+    return 2;
+}
+
+static int list_command() {
+    printf("Patterns:\n");
+    for (uint32_t i = 0; i < num_bakeable_patterns; i++) {
+        printf("  %s\n", bakeable_patterns[i].name);
+    }
+    printf("Palettes:\n");
+    for (uint32_t i = 0; i < num_led_palettes(); i++) {
+        printf("  %-16s %s\n", led_palettes[i].name, led_palettes[i].desc);
+    }
+    printf("Topology (%u LEDs):\n", leds_in_topology());
+    for (uint32_t i = 0; i < num_strings; i++) {
+        const led_string_t &string = led_strings[i];
+        printf("  %s: %u LEDs on channel %u\n", string.name, string.num_leds, string.channel);
+        for (uint32_t j = 0; j < string.num_segments; j++) {
+            const led_segment_t &segment = string.segments[j];
+            printf("    %-20s %3u LEDs at %3u, zone %s\n", segment.name, segment.num_leds,
+                   segment.string_offset, led_zones[segment.zone].name);
+        }
+    }
+    return 0;
+}
+
+static int bake_command(int argc, char **argv) {
+    if (argc < 2) {
+        return usage();
+    }
+    bake_options_t options = {
+        .pattern = nullptr,
+        .palette = &led_palettes[0],
+        .color = CRGB::Red,
+        .period_ms = 3000,
+        .steps = 0,
+        .indexed = false,
+        .interpolate = false,
+        .hold = false,
+        .segments = {},
+    };
+    for (uint32_t i = 0; i < num_bakeable_patterns; i++) {
+        if (strcasecmp(argv[0], bakeable_patterns[i].name) == 0) {
+            options.pattern = &bakeable_patterns[i];
+        }
+    }
+    if (options.pattern == nullptr) {
+        fprintf(stderr, "Unknown pattern: %s\n", argv[0]);
+        return 1;
+    }
+    for (uint32_t i = 0; i < num_led_palettes(); i++) {
+        if (strcasecmp(led_palettes[i].name, "Rainbow") == 0) {
+            options.palette = &led_palettes[i];
+        }
+    }
+    const char *output = argv[1];
+    for (int i = 2; i < argc; i++) {
+        String arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--palette" && has_value) {
+            const char *name = argv[++i];
+            options.palette = nullptr;
+            for (uint32_t j = 0; j < num_led_palettes(); j++) {
+                if (strcasecmp(led_palettes[j].name, name) == 0) {
+                    options.palette = &led_palettes[j];
+                }
+            }
+            if (options.palette == nullptr) {
+                fprintf(stderr, "Unknown palette: %s\n", name);
+                return 1;
+            }
+        } else if (arg == "--color" && has_value) {
+            options.color = CRGB((uint32_t)strtoul(argv[++i], nullptr, 16));
+        } else if (arg == "--period" && has_value) {
+            options.period_ms = strtod(argv[++i], nullptr) * 1000 + 0.5;
+        } else if (arg == "--steps" && has_value) {
+            options.steps = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--indexed") {
+            options.indexed = true;
+        } else if (arg == "--interpolate") {
+            options.interpolate = true;
+        } else if (arg == "--hold") {
+            options.hold = true;
+        } else if ((arg == "--zone" || arg == "--segment") && has_value) {
+            if (!add_segments(options, arg == "--zone", argv[++i])) {
+                fprintf(stderr, "Unknown %s: %s\n", arg.c_str() + 2, argv[i]);
+                return 1;
+            }
+        } else {
+            return usage();
+        }
+    }
+    if (options.steps == 0) {
+        options.steps = max(options.period_ms / 20, (uint32_t)1);
+    }
+    if (options.period_ms == 0 || options.period_ms > 0xFFFF * 1000 || options.steps == 0 || options.steps > 0xFFFF) {
+        fprintf(stderr, "Invalid period or number of steps\n");
+        return 1;
+    }
+
+    // Render all the steps
+    uint32_t num_pixels = leds_in_topology();
+    std::vector<CRGB> frames((size_t)num_pixels * options.steps);
+    const uint32_t start_ms = micros() / 1000;
+    // The time before the first step is not in the same period, so that the first step starts one
+    uint32_t previous_time_ms = UINT32_MAX;
+    for (uint32_t step = 0; step < options.steps; step++) {
+        uint32_t time_ms = (uint64_t)step * options.period_ms / options.steps;
+        render_step(options, time_ms, previous_time_ms, &frames[(size_t)num_pixels * step]);
+        previous_time_ms = time_ms;
+    }
+    const uint32_t render_ms = micros() / 1000 - start_ms;
+    if (!options.segments.empty()) {
+        keep_segments(options, frames, num_pixels);
+    }
+
+    if (!write_pattern(output, options, frames, num_pixels)) {
+        return 1;
+    }
+    printf("Baked %s (%s) into %s: %u pixels, %u steps over %g s, rendered in %u ms\n",
+           options.pattern->name, options.palette->name, output, num_pixels, options.steps,
+           options.period_ms / 1000.0, render_ms);
+    return 0;
+}
+
+// Add the segments of a zone, or a single segment, to the segments to store
+static bool add_segments(bake_options_t &options, bool zone, const char *name) {
+    bool found = false;
+    for (uint32_t i = 0; i < num_strings; i++) {
+        for (uint32_t j = 0; j < led_strings[i].num_segments; j++) {
+            const led_segment_t &segment = led_strings[i].segments[j];
+            const char *segment_name = zone ? led_zones[segment.zone].name : segment.name;
+            if (strcasecmp(segment_name, name) == 0) {
+                options.segments.push_back({(uint8_t)i, (uint8_t)j});
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+// Keep only the pixels of the segments to store, one segment after the other
+static void keep_segments(const bake_options_t &options, std::vector<CRGB> &frames, uint32_t &num_pixels) {
+    const uint32_t steps = frames.size() / num_pixels;
+    std::vector<CRGB> kept;
+    for (uint32_t step = 0; step < steps; step++) {
+        const CRGB *frame = &frames[(size_t)num_pixels * step];
+        for (const cached_pattern_segment_t &entry : options.segments) {
+            const led_segment_t &segment = led_strings[entry.string_index].segments[entry.segment_index];
+            uint32_t offset = segment.string_offset;
+            for (uint32_t i = 0; i < entry.string_index; i++) {
+                offset += led_strings[i].num_leds;
+            }
+            kept.insert(kept.end(), frame + offset, frame + offset + segment.num_leds);
+        }
+    }
+    num_pixels = kept.size() / steps;
+    frames.swap(kept);
+}
+
+// Render one step of the animation for the whole topology, the same way led_refresh() does
+static void render_step(const bake_options_t &options, uint32_t time_ms, uint32_t previous_time_ms, CRGB *frame) {
+    CRGB *string_leds = frame;
+    for (uint32_t i = 0; i < num_strings; i++) {
+        led_string_t *led_string = &led_strings[i];
+        for (uint32_t j = 0; j < led_string->num_segments; j++) {
+            led_segment_t *segment = &led_string->segments[j];
+            led_pattern_params_t params;
+            params.time_ms = time_ms;
+            params.previous_time_ms = previous_time_ms;
+            params.display_only = false;
+            params.period_ms = options.period_ms;
+            params.pattern_clock = (uint64_t)time_ms << 8;
+            params.phase_offset = 0;
+            params.palette = composed_palette(options.palette, options.color);
+            params.single_color = options.color;
+            params.cached_pattern = nullptr;
+            params.string_index = i;
+            params.segment_index = j;
+            params.num_leds = segment->num_leds;
+            params.leds = string_leds + segment->string_offset;
+            options.pattern->update(params);
+        }
+        string_leds += led_string->num_leds;
+    }
+}
+
+// Build a palette from a set of pixels. Returns false if there are more than 256 colors.
+static bool build_palette(const CRGB *pixels, size_t count, std::map<uint32_t, uint8_t> &palette) {
+    palette.clear();
+    for (size_t i = 0; i < count; i++) {
+        uint32_t key = pixels[i].r << 16 | pixels[i].g << 8 | pixels[i].b;
+        if (palette.count(key) == 0) {
+            if (palette.size() == 256) {
+                return false;
+            }
+            uint8_t index = palette.size();
+            palette[key] = index;
+        }
+    }
+    return true;
+}
+
+static void write_palette(FILE *f, const std::map<uint32_t, uint8_t> &palette, uint16_t palette_size) {
+    std::vector<CRGB> entries(palette_size, CRGB::Black);
+    for (const auto &entry : palette) {
+        entries[entry.second] = CRGB(entry.first);
+    }
+    fwrite(entries.data(), sizeof(CRGB), entries.size(), f);
+}
+
+static void write_indices(FILE *f, const CRGB *pixels, size_t count, const std::map<uint32_t, uint8_t> &palette) {
+    std::vector<uint8_t> indices(count);
+    for (size_t i = 0; i < count; i++) {
+        indices[i] = palette.at(pixels[i].r << 16 | pixels[i].g << 8 | pixels[i].b);
+    }
+    fwrite(indices.data(), 1, indices.size(), f);
+}
+
+// Merge the identical consecutive steps into keyframes, each held for the number of steps it covers
+static void merge_keyframes(std::vector<CRGB> &frames, uint32_t num_pixels, std::vector<uint16_t> &holds) {
+    const size_t frame_size = (size_t)num_pixels * sizeof(CRGB);
+    const uint32_t steps = frames.size() / num_pixels;
+    uint32_t num_keyframes = 0;
+    holds.clear();
+    for (uint32_t step = 0; step < steps; step++) {
+        const CRGB *pixels = &frames[(size_t)num_pixels * step];
+        if (num_keyframes > 0 && holds.back() < 0xFFFF &&
+            memcmp(pixels, &frames[(size_t)num_pixels * (num_keyframes - 1)], frame_size) == 0) {
+            holds.back()++;
+            continue;
+        }
+        memmove(&frames[(size_t)num_pixels * num_keyframes], pixels, frame_size);
+        holds.push_back(1);
+        num_keyframes++;
+    }
+    frames.resize((size_t)num_pixels * num_keyframes);
+}
+
+static bool write_pattern(const char *path, const bake_options_t &options, std::vector<CRGB> &frames, uint32_t num_pixels) {
+    std::vector<uint16_t> holds;
+    if (options.hold) {
+        merge_keyframes(frames, num_pixels, holds);
+    }
+    const uint32_t steps = frames.size() / num_pixels;
+    cached_pattern_header_t header = {
+        .magic = CACHED_PATTERN_MAGIC_EXT,
+        .color_ordering = WS2811_RGB,
+        .num_pixels = (uint16_t)num_pixels,
+        .animation_steps = (uint16_t)steps,
+        // Rounded to whole seconds for the firmwares that don't know about ext.period_ms
+        .animation_period_s = (uint16_t)max((options.period_ms + 500) / 1000, (uint32_t)1),
+    };
+    cached_pattern_ext_header_t ext = {
+        .ext_size = sizeof(cached_pattern_ext_header_t),
+        .flags = 0,
+        .palette_size = 0,
+        .data_offset = sizeof(cached_pattern_header_t) + sizeof(cached_pattern_ext_header_t),
+    };
+    ext.period_ms = options.period_ms;
+    if (options.interpolate) {
+        ext.flags |= CACHED_PATTERN_FLAG_INTERPOLATE;
+    }
+
+    // Pick the smallest palette layout that can represent the frames
+    std::map<uint32_t, uint8_t> palette;
+    if (options.indexed) {
+        if (build_palette(frames.data(), frames.size(), palette)) {
+            ext.flags |= CACHED_PATTERN_FLAG_PALETTE;
+            ext.palette_size = palette.size();
+            ext.data_offset += ext.palette_size * sizeof(CRGB);
+        } else {
+            uint16_t palette_size = 0;
+            for (uint32_t step = 0; step < steps; step++) {
+                if (!build_palette(&frames[(size_t)num_pixels * step], num_pixels, palette)) {
+                    fprintf(stderr, "Too many colors in step %u for a palette indexed pattern\n", step);
+                    return false;
+                }
+                palette_size = max<uint16_t>(palette_size, palette.size());
+            }
+            ext.flags |= CACHED_PATTERN_FLAG_PALETTE | CACHED_PATTERN_FLAG_STEP_PALETTE;
+            ext.palette_size = palette_size;
+        }
+    }
+    // The hold and segment tables go after the file wide palette
+    if (options.hold) {
+        ext.flags |= CACHED_PATTERN_FLAG_HOLD;
+        ext.timeline_offset = ext.data_offset;
+        ext.data_offset += steps * sizeof(uint16_t);
+    }
+    if (!options.segments.empty()) {
+        ext.flags |= CACHED_PATTERN_FLAG_SEGMENTS;
+        ext.segments_offset = ext.data_offset;
+        ext.num_segments = options.segments.size();
+        ext.data_offset += ext.num_segments * sizeof(cached_pattern_segment_t);
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == nullptr) {
+        perror(path);
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(&ext, sizeof(ext), 1, f);
+    if (options.indexed && !(ext.flags & CACHED_PATTERN_FLAG_STEP_PALETTE)) {
+        write_palette(f, palette, ext.palette_size);
+    }
+    fwrite(holds.data(), sizeof(uint16_t), holds.size(), f);
+    fwrite(options.segments.data(), sizeof(cached_pattern_segment_t), options.segments.size(), f);
+    if (!options.indexed) {
+        fwrite(frames.data(), sizeof(CRGB), frames.size(), f);
+    } else if (!(ext.flags & CACHED_PATTERN_FLAG_STEP_PALETTE)) {
+        write_indices(f, frames.data(), frames.size(), palette);
+    } else {
+        for (uint32_t step = 0; step < steps; step++) {
+            const CRGB *pixels = &frames[(size_t)num_pixels * step];
+            build_palette(pixels, num_pixels, palette);
+            write_palette(f, palette, ext.palette_size);
+            write_indices(f, pixels, num_pixels, palette);
+        }
+    }
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        perror(path);
+    }
+    return ok;
+}
+
+// Open the patterns of a directory with the controller's own loader, and check them against the topology
+static int validate_command(int argc, char **argv) {
+    if (argc != 1) {
+        return usage();
+    }
+    SD.setRoot(argv[0]);
+    File root = SD.open("/");
+    if (!root || !root.isDirectory()) {
+        fprintf(stderr, "Not a directory: %s\n", argv[0]);
+        return 1;
+    }
+    uint32_t num_patterns = 0;
+    uint32_t num_errors = 0;
+    while (File file = root.openNextFile()) {
+        const char *name = file.name();
+        const char *ext = strrchr(name, '.');
+        if (file.isDirectory() || !ext || strcasecmp(ext, ".bin") != 0 || name[0] == '.') {
+            continue;
+        }
+        num_patterns++;
+        cached_pattern_t pattern = {};
+        if (!cached_pattern_open(pattern, name)) {
+            printf("ERROR %s can't be opened\n", name);
+            num_errors++;
+            continue;
+        }
+        const uint16_t flags = pattern.ext.flags;
+        const char *error = cached_pattern_check(pattern);
+        if (error != nullptr) {
+            printf("ERROR %s %s\n", name, error);
+            num_errors++;
+        } else {
+            printf("OK    %s: %u pixels, %u steps over %g s, %s%s%s%s%s\n", name, pattern.header.num_pixels,
+                   pattern.header.animation_steps, cached_pattern_period_ms(pattern) / 1000.0,
+                   !(flags & CACHED_PATTERN_FLAG_PALETTE) ? "RGB" : (flags & CACHED_PATTERN_FLAG_STEP_PALETTE) ? "per step palette" : "palette",
+                   (flags & CACHED_PATTERN_FLAG_INTERPOLATE) ? ", interpolated" : "",
+                   (pattern.remap_path.length() > 0 || (flags & CACHED_PATTERN_FLAG_REMAP)) ? ", remapped" : "",
+                   (flags & CACHED_PATTERN_FLAG_HOLD) ? ", keyframes" : "",
+                   (flags & CACHED_PATTERN_FLAG_SEGMENTS) ? ", segments only" : "");
+        }
+        cached_pattern_close(pattern);
+    }
+    printf("%u pattern(s), %u error(s)\n", num_patterns, num_errors);
+    return num_errors == 0 ? 0 : 1;
+}
+
+// Mirror the patterns of a directory into the flash store, and check the result
+static int mirror_command(int argc, char **argv) {
+    if (argc != 1 && !(argc == 3 && strcmp(argv[1], "--flash-kb") == 0)) {
+        return usage();
+    }
+    LittleFS_QSPIFlash::setCapacity((argc == 3 ? strtoull(argv[2], nullptr, 10) : 16384) * 1024);
+    SD.setRoot(argv[0]);
+    if (!pattern_store_begin()) {
+        fprintf(stderr, "No flash store\n");
+        return 1;
+    }
+    FS *flash = pattern_store_fs();
+    load_cached_patterns();
+    uint32_t num_steps = 0;
+    uint32_t num_errors = mirror(&num_steps);
+    printf("Mirrored in %u steps\n", num_steps);
+    num_errors += check_mirror(flash);
+
+    // Make the first mirrored pattern look changed on the SD card since it was copied, by dating its
+    // flash copy back. The next mirror must copy it again, and only it.
+    cached_pattern_t *changed = nullptr;
+    for (uint32_t i = 0; i < num_cached_patterns && changed == nullptr; i++) {
+        if (cached_patterns[i].fs == flash) {
+            changed = &cached_patterns[i];
+        }
+    }
+    if (changed != nullptr) {
+        const String filepath = changed->filepath;
+        File file = flash->open(filepath.c_str(), FILE_WRITE);
+        DateTimeFields time = {};
+        file.getModifyTime(time);
+        time.year--;
+        file.setModifyTime(time);
+        file.close();
+        load_cached_patterns();
+        num_errors += mirror(&num_steps);
+        file = flash->open(filepath.c_str());
+        File sd_file = SD.open(filepath.c_str());
+        DateTimeFields sd_time = {};
+        sd_file.getModifyTime(sd_time);
+        file.getModifyTime(time);
+        if (!file || memcmp(&time, &sd_time, sizeof(DateTimeFields)) != 0) {
+            printf("ERROR %s: the outdated flash copy was not replaced\n", filepath.c_str());
+            num_errors++;
+        } else {
+            printf("OK    %s: the outdated flash copy was replaced\n", filepath.c_str());
+        }
+        num_errors += check_mirror(flash);
+    }
+    printf("%u pattern(s), %u error(s)\n", num_cached_patterns, num_errors);
+    return num_errors == 0 ? 0 : 1;
+}
+
+// Run a mirror to the end, the way loop() does. Returns 1 if it does not end.
+static uint32_t mirror(uint32_t *num_steps) {
+    pattern_store_mirror_start();
+    *num_steps = 0;
+    while (pattern_store_mirror_step()) {
+        if (++*num_steps > 100000000) {
+            printf("ERROR the mirror does not end\n");
+            pattern_store_mirror_cancel();
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Check that the mirrored patterns play the same frames from the flash store as from the directory, and
+// that the flash store only has their files. Returns the number of errors.
+static uint32_t check_mirror(FS *flash) {
+    uint32_t num_errors = 0;
+    uint32_t num_mirrored = 0;
+    for (uint32_t i = 0; i < num_cached_patterns; i++) {
+        cached_pattern_t &pattern = cached_patterns[i];
+        const char *filepath = pattern.filepath.c_str();
+        if (pattern.fs == &SD) {
+            // Not selected, or no room for it
+            if (flash->exists(filepath)) {
+                printf("ERROR %s: played from the SD card, but in the flash store\n", filepath);
+                num_errors++;
+            } else {
+                printf("SD    %s\n", filepath);
+            }
+            continue;
+        }
+        num_mirrored++;
+        if (!same_frames(pattern)) {
+            printf("ERROR %s: the flash copy does not play the same frames\n", filepath);
+            num_errors++;
+        } else {
+            printf("FLASH %s\n", filepath);
+        }
+    }
+    uint32_t num_files = 0;
+    File root = flash->open("/");
+    while (File file = root.openNextFile()) {
+        num_files++;
+    }
+    if (num_files != num_mirrored) {
+        printf("ERROR %u files in the flash store for %u mirrored patterns\n", num_files, num_mirrored);
+        num_errors++;
+    }
+    return num_errors;
+}
+
+// Compare the frames of a mirrored pattern with those of its file in the directory
+static bool same_frames(cached_pattern_t &pattern) {
+    cached_pattern_t sd_pattern = {};
+    if (!cached_pattern_open(sd_pattern, pattern.filepath.c_str())) {
+        return false;
+    }
+    bool same = true;
+    for (uint32_t step = 0; step < pattern.header.animation_steps && same; step++) {
+        const CRGB *frame = cached_pattern_frame(pattern, step);
+        const CRGB *sd_frame = cached_pattern_frame(sd_pattern, step);
+        same = memcmp(frame, sd_frame, leds_in_topology() * sizeof(CRGB)) == 0;
+    }
+    cached_pattern_close(sd_pattern);
+    return same;
+}
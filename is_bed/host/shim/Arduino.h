@@ -0,0 +1,157 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Minimal Arduino core for building controller code on the host.
+// Only what the is_bed sources use is provided.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+#define DMAMEM
+#define FASTRUN
+#define PROGMEM
+#define BUILTIN_SDCARD 254
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+using std::min;
+using std::max;
+template <typename T> T constrain(T x, T low, T high) { return x < low ? low : (x > high ? high : x); }
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return 0; }
+
+// Host only: drive millis()/micros() from a virtual clock instead of the wall clock.
+// Passing UINT64_MAX switches back to the wall clock.
+void host_set_time_us(uint64_t time_us);
+
+class String {
+public:
+    String() {}
+    String(const char *s) : s_(s ? s : "") {}
+    String(const std::string &s) : s_(s) {}
+    String(char c) : s_(1, c) {}
+    String(int v) : s_(std::to_string(v)) {}
+    String(unsigned int v) : s_(std::to_string(v)) {}
+    String(long v) : s_(std::to_string(v)) {}
+    String(unsigned long v) : s_(std::to_string(v)) {}
+    String(float v, unsigned char decimals = 2) { format(v, decimals); }
+    String(double v, unsigned char decimals = 2) { format(v, decimals); }
+
+    const char *c_str() const { return s_.c_str(); }
+    unsigned int length() const { return s_.length(); }
+    char charAt(unsigned int i) const { return i < s_.length() ? s_[i] : 0; }
+    void setCharAt(unsigned int i, char c) { if (i < s_.length()) s_[i] = c; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    int compareTo(const String &o) const { return strcmp(c_str(), o.c_str()); }
+    bool equals(const String &o) const { return s_ == o.s_; }
+    bool operator==(const String &o) const { return s_ == o.s_; }
+    bool operator!=(const String &o) const { return s_ != o.s_; }
+    bool operator<(const String &o) const { return s_ < o.s_; }
+    bool startsWith(const String &o) const { return s_.compare(0, o.s_.size(), o.s_) == 0; }
+    bool endsWith(const String &o) const {
+        return s_.size() >= o.s_.size() && s_.compare(s_.size() - o.s_.size(), o.s_.size(), o.s_) == 0;
+    }
+    int indexOf(char c, unsigned int from = 0) const { return pos(s_.find(c, from)); }
+    int lastIndexOf(char c) const { return pos(s_.rfind(c)); }
+    String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        return from < s_.size() ? String(s_.substr(from, to - from)) : String();
+    }
+    void remove(unsigned int index) { if (index < s_.size()) s_.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < s_.size()) s_.erase(index, count); }
+    void replace(char from, char to) { std::replace(s_.begin(), s_.end(), from, to); }
+    void toLowerCase() { for (auto &c : s_) c = tolower(c); }
+    void toUpperCase() { for (auto &c : s_) c = toupper(c); }
+    void trim() {
+        size_t b = s_.find_first_not_of(" \t\r\n");
+        size_t e = s_.find_last_not_of(" \t\r\n");
+        s_ = b == std::string::npos ? "" : s_.substr(b, e - b + 1);
+    }
+    void toCharArray(char *buf, unsigned int size) const {
+        if (size == 0) return;
+        size_t n = std::min<size_t>(size - 1, s_.size());
+        memcpy(buf, s_.data(), n);
+        buf[n] = 0;
+    }
+    String &operator+=(const String &o) { s_ += o.s_; return *this; }
+    String &operator+=(const char *o) { s_ += o; return *this; }
+    String &operator+=(char c) { s_ += c; return *this; }
+    friend String operator+(const String &a, const String &b) { return String(a.s_ + b.s_); }
+    friend String operator+(const String &a, const char *b) { return String(a.s_ + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.s_); }
+
+private:
+    static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+    void format(double v, unsigned char decimals) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        s_ = buf;
+    }
+    std::string s_;
+};
+
+// A serial port, as SerialTransfer sees it
+class Stream {
+public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            write(buf[i]);
+        }
+        return size;
+    }
+    virtual void flush() {}
+};
+
+// Serial output goes to stderr so that tools can use stdout for their own output. Nothing is ever received.
+class HostSerial : public Stream {
+public:
+    void begin(uint32_t) {}
+    explicit operator bool() const { return true; }
+    void setQuiet(bool quiet) { quiet_ = quiet; }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    size_t print(const String &s);
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(int v);
+    size_t print(unsigned int v);
+    size_t print(long v);
+    size_t print(unsigned long v);
+    size_t print(double v, int decimals = 2);
+    size_t println();
+    template <typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    size_t println(double v, int decimals) { size_t n = print(v, decimals); return n + println(); }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+private:
+    bool quiet_ = false;
+};
+extern HostSerial Serial;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,22 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// RAM backed EEPROM, with the Teensy 4.1 size. Contents are lost on exit.
+class HostEEPROM {
+public:
+    static const int size = 4284;
+    uint8_t read(int idx) { return data_[idx]; }
+    void write(int idx, uint8_t val) { data_[idx] = val; }
+    template <typename T> T &get(int idx, T &t) { memcpy((void *)&t, data_ + idx, sizeof(T)); return t; }
+    template <typename T> const T &put(int idx, const T &t) { memcpy(data_ + idx, (const void *)&t, sizeof(T)); return t; }
+    uint16_t length() { return size; }
+
+private:
+    uint8_t data_[size] = {};
+};
+extern HostEEPROM EEPROM;
+
+#endif // HOST_EEPROM_H
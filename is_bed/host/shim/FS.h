@@ -0,0 +1,106 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+// The Teensy FS / File abstraction (cores/teensy4/FS.h), reduced to what is used here.
+
+#include <Arduino.h>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define FILE_WRITE_BEGIN 2
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+typedef struct {
+    uint8_t sec;
+    uint8_t min;
+    uint8_t hour;
+    uint8_t wday;
+    uint8_t mday;
+    uint8_t mon;
+    uint8_t year;
+} DateTimeFields;
+
+class File;
+
+class FileImpl {
+public:
+    virtual ~FileImpl() {}
+    virtual size_t read(void *buf, size_t nbyte) = 0;
+    virtual size_t write(const void *buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual void flush() = 0;
+    virtual bool truncate(uint64_t size = 0) = 0;
+    virtual bool seek(uint64_t pos, int mode) = 0;
+    virtual uint64_t position() = 0;
+    virtual uint64_t size() = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() = 0;
+    virtual const char *name() = 0;
+    virtual bool isDirectory() = 0;
+    virtual File openNextFile(uint8_t mode = 0) = 0;
+    virtual void rewindDirectory() = 0;
+    virtual bool getModifyTime(DateTimeFields &tm) { return false; }
+    virtual bool setModifyTime(const DateTimeFields &tm) { return false; }
+    unsigned int refcount = 0;
+};
+
+class File {
+public:
+    File(FileImpl *f = nullptr) : f_(f) { if (f_) f_->refcount++; }
+    File(const File &o) : f_(o.f_) { if (f_) f_->refcount++; }
+    File &operator=(const File &o) {
+        if (o.f_) o.f_->refcount++;
+        release();
+        f_ = o.f_;
+        return *this;
+    }
+    ~File() { release(); }
+
+    size_t read(void *buf, size_t nbyte) { return f_ ? f_->read(buf, nbyte) : 0; }
+    int read() {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+    size_t write(const void *buf, size_t size) { return f_ ? f_->write(buf, size) : 0; }
+    size_t write(uint8_t b) { return write(&b, 1); }
+    int available() { return f_ ? f_->available() : 0; }
+    void flush() { if (f_) f_->flush(); }
+    bool truncate(uint64_t size = 0) { return f_ ? f_->truncate(size) : false; }
+    bool seek(uint64_t pos, int mode = SeekSet) { return f_ ? f_->seek(pos, mode) : false; }
+    uint64_t position() { return f_ ? f_->position() : 0; }
+    uint64_t size() { return f_ ? f_->size() : 0; }
+    void close() {
+        if (f_) f_->close();
+        release();
+    }
+    explicit operator bool() { return f_ && f_->isOpen(); }
+    const char *name() { return f_ ? f_->name() : ""; }
+    bool isDirectory() { return f_ ? f_->isDirectory() : false; }
+    File openNextFile(uint8_t mode = 0) { return f_ ? f_->openNextFile(mode) : File(); }
+    void rewindDirectory() { if (f_) f_->rewindDirectory(); }
+    bool getModifyTime(DateTimeFields &tm) { return f_ ? f_->getModifyTime(tm) : false; }
+    bool setModifyTime(const DateTimeFields &tm) { return f_ ? f_->setModifyTime(tm) : false; }
+
+private:
+    void release() {
+        if (f_ && --f_->refcount == 0) delete f_;
+        f_ = nullptr;
+    }
+    FileImpl *f_;
+};
+
+class FS {
+public:
+    virtual ~FS() {}
+    virtual File open(const char *filename, uint8_t mode = FILE_READ) = 0;
+    virtual bool exists(const char *filepath) = 0;
+    virtual bool mkdir(const char *filepath) = 0;
+    virtual bool rename(const char *oldfilepath, const char *newfilepath) = 0;
+    virtual bool remove(const char *filepath) = 0;
+    virtual bool rmdir(const char *filepath) = 0;
+    virtual uint64_t usedSize() { return 0; }
+    virtual uint64_t totalSize() { return 0; }
+};
+
+#endif // HOST_FS_H
@@ -0,0 +1,146 @@
+#ifndef HOST_FASTLED_H
+#define HOST_FASTLED_H
+
+// Subset of FastLED used by the controller, with the same fixed point math
+// (FASTLED_SCALE8_FIXED) so that host renders match the firmware bit for bit.
+
+#include <stdint.h>
+
+typedef uint8_t fract8;
+
+inline uint8_t scale8(uint8_t i, fract8 scale) { return ((uint16_t)i * (1 + (uint16_t)scale)) >> 8; }
+inline uint8_t scale8_video(uint8_t i, fract8 scale) { return (((uint16_t)i * scale) >> 8) + ((i && scale) ? 1 : 0); }
+inline uint8_t qadd8(uint8_t i, uint8_t j) { unsigned t = i + j; return t > 255 ? 255 : t; }
+inline uint8_t qsub8(uint8_t i, uint8_t j) { return i > j ? i - j : 0; }
+inline uint8_t lerp8by8(uint8_t a, uint8_t b, fract8 frac) {
+    if (b > a) return a + scale8(b - a, frac);
+    return a - scale8(a - b, frac);
+}
+
+struct CRGB {
+    union {
+        struct {
+            union { uint8_t r; uint8_t red; };
+            union { uint8_t g; uint8_t green; };
+            union { uint8_t b; uint8_t blue; };
+        };
+        uint8_t raw[3];
+    };
+
+    enum HTMLColorCode : uint32_t {
+        Aqua = 0x00FFFF,
+        Aquamarine = 0x7FFFD4,
+        Black = 0x000000,
+        Blue = 0x0000FF,
+        CadetBlue = 0x5F9EA0,
+        CornflowerBlue = 0x6495ED,
+        DarkBlue = 0x00008B,
+        DarkCyan = 0x008B8B,
+        DarkGreen = 0x006400,
+        DarkOliveGreen = 0x556B2F,
+        DarkRed = 0x8B0000,
+        ForestGreen = 0x228B22,
+        Green = 0x008000,
+        LawnGreen = 0x7CFC00,
+        LightBlue = 0xADD8E6,
+        LightGreen = 0x90EE90,
+        LightSkyBlue = 0x87CEFA,
+        LimeGreen = 0x32CD32,
+        Maroon = 0x800000,
+        MediumAquamarine = 0x66CDAA,
+        MediumBlue = 0x0000CD,
+        MidnightBlue = 0x191970,
+        Navy = 0x000080,
+        OliveDrab = 0x6B8E23,
+        Orange = 0xFFA500,
+        Red = 0xFF0000,
+        SeaGreen = 0x2E8B57,
+        SkyBlue = 0x87CEEB,
+        Teal = 0x008080,
+        White = 0xFFFFFF,
+        YellowGreen = 0x9ACD32,
+    };
+
+    CRGB() = default;
+    constexpr CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+    constexpr CRGB(uint32_t colorcode) : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF), b(colorcode & 0xFF) {}
+    constexpr CRGB(HTMLColorCode colorcode) : CRGB((uint32_t)colorcode) {}
+
+    uint8_t &operator[](uint8_t x) { return raw[x]; }
+    const uint8_t &operator[](uint8_t x) const { return raw[x]; }
+
+    CRGB &nscale8(uint8_t scale) {
+        r = ::scale8(r, scale);
+        g = ::scale8(g, scale);
+        b = ::scale8(b, scale);
+        return *this;
+    }
+    CRGB scale8(uint8_t scale) const {
+        return CRGB(::scale8(r, scale), ::scale8(g, scale), ::scale8(b, scale));
+    }
+    CRGB &nscale8_video(uint8_t scale) {
+        r = scale8_video(r, scale);
+        g = scale8_video(g, scale);
+        b = scale8_video(b, scale);
+        return *this;
+    }
+    CRGB &fadeToBlackBy(uint8_t fade) { return nscale8(255 - fade); }
+    uint8_t getAverageLight() const {
+        return ::scale8(r, 85) + ::scale8(g, 85) + ::scale8(b, 85);
+    }
+    CRGB lerp8(const CRGB &other, fract8 frac) const {
+        return CRGB(lerp8by8(r, other.r, frac), lerp8by8(g, other.g, frac), lerp8by8(b, other.b, frac));
+    }
+    CRGB &operator+=(const CRGB &o) {
+        r = qadd8(r, o.r);
+        g = qadd8(g, o.g);
+        b = qadd8(b, o.b);
+        return *this;
+    }
+    bool operator==(const CRGB &o) const { return r == o.r && g == o.g && b == o.b; }
+    bool operator!=(const CRGB &o) const { return !(*this == o); }
+};
+static_assert(sizeof(CRGB) == 3, "CRGB must be packed");
+
+CRGB blend(const CRGB &p1, const CRGB &p2, fract8 amountOfP2);
+CRGB *blend(const CRGB *src1, const CRGB *src2, CRGB *dest, uint16_t count, fract8 amountOfsrc2);
+void nblend(CRGB &existing, const CRGB &overlay, fract8 amountOfOverlay);
+
+typedef uint32_t TProgmemRGBPalette16[16];
+
+class CRGBPalette16 {
+public:
+    CRGB entries[16];
+
+    CRGBPalette16() {}
+    CRGBPalette16(const CRGB &c) {
+        for (auto &e : entries) e = c;
+    }
+    CRGBPalette16(const CRGB &c00, const CRGB &c01, const CRGB &c02, const CRGB &c03,
+                  const CRGB &c04, const CRGB &c05, const CRGB &c06, const CRGB &c07,
+                  const CRGB &c08, const CRGB &c09, const CRGB &c10, const CRGB &c11,
+                  const CRGB &c12, const CRGB &c13, const CRGB &c14, const CRGB &c15)
+        : entries{c00, c01, c02, c03, c04, c05, c06, c07, c08, c09, c10, c11, c12, c13, c14, c15} {}
+    CRGBPalette16(const TProgmemRGBPalette16 &rhs) {
+        for (int i = 0; i < 16; i++) entries[i] = CRGB(rhs[i]);
+    }
+    CRGB &operator[](uint8_t x) { return entries[x]; }
+    const CRGB &operator[](uint8_t x) const { return entries[x]; }
+};
+
+typedef enum { NOBLEND = 0, LINEARBLEND = 1 } TBlendType;
+
+CRGB ColorFromPalette(const CRGBPalette16 &pal, uint8_t index, uint8_t brightness = 255, TBlendType blendType = LINEARBLEND);
+
+CRGB applyGamma_video(const CRGB &orig, float gammaR, float gammaG, float gammaB);
+
+extern const TProgmemRGBPalette16 CloudColors_p;
+extern const TProgmemRGBPalette16 LavaColors_p;
+extern const TProgmemRGBPalette16 OceanColors_p;
+extern const TProgmemRGBPalette16 ForestColors_p;
+extern const TProgmemRGBPalette16 RainbowColors_p;
+extern const TProgmemRGBPalette16 RainbowStripeColors_p;
+extern const TProgmemRGBPalette16 PartyColors_p;
+extern const TProgmemRGBPalette16 HeatColors_p;
+
+#endif // HOST_FASTLED_H
@@ -0,0 +1,38 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+// QSPI flash filesystem, as a RAM-backed stand-in with a single flat directory.
+
+#include <FS.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+class LittleFS_QSPIFlash : public FS {
+public:
+    bool begin();
+    File open(const char *filename, uint8_t mode = FILE_READ) override;
+    bool exists(const char *filepath) override;
+    bool mkdir(const char *filepath) override;
+    bool rename(const char *oldfilepath, const char *newfilepath) override;
+    bool remove(const char *filepath) override;
+    bool rmdir(const char *filepath) override;
+    uint64_t usedSize() override;
+    uint64_t totalSize() override;
+
+    // Host only: the size of the simulated flash chips, 0 for no chip. The chips are owned by the
+    // code under test, so it applies to all of them.
+    static void setCapacity(uint64_t size);
+
+    struct Entry {
+        std::vector<uint8_t> data;
+        DateTimeFields mtime = {};
+    };
+
+private:
+    static std::string key(const char *filepath);
+    std::map<std::string, std::shared_ptr<Entry>> files_;
+    static uint64_t capacity_;
+};
+
+#endif // HOST_LITTLEFS_H
@@ -0,0 +1,15 @@
+#ifndef HOST_OCTOWS2811_H
+#define HOST_OCTOWS2811_H
+
+// Color ordering and timing constants of OctoWS2811. There is no output on the host.
+
+#define WS2811_RGB 0
+#define WS2811_RBG 1
+#define WS2811_GRB 2
+#define WS2811_GBR 3
+#define WS2811_BRG 4
+#define WS2811_BGR 5
+#define WS2811_800kHz 0x00
+#define WS2811_400kHz 0x10
+
+#endif // HOST_OCTOWS2811_H
@@ -0,0 +1,27 @@
+#ifndef HOST_SD_H
+#define HOST_SD_H
+
+// SD card backed by a directory of the host filesystem.
+
+#include <FS.h>
+
+class SDClass : public FS {
+public:
+    bool begin(uint8_t csPin = BUILTIN_SDCARD);
+    File open(const char *filename, uint8_t mode = FILE_READ) override;
+    bool exists(const char *filepath) override;
+    bool mkdir(const char *filepath) override;
+    bool rename(const char *oldfilepath, const char *newfilepath) override;
+    bool remove(const char *filepath) override;
+    bool rmdir(const char *filepath) override;
+
+    // Host only: the directory that acts as the root of the card.
+    void setRoot(const char *path);
+
+private:
+    std::string path(const char *filepath) const;
+    std::string root_ = ".";
+};
+extern SDClass SD;
+
+#endif // HOST_SD_H
@@ -0,0 +1,74 @@
+#ifndef HOST_SERIAL_TRANSFER_H
+#define HOST_SERIAL_TRANSFER_H
+
+// SerialTransfer, with the same framing on the wire as the library, so that the link code can be
+// exercised on the host over an in-memory stream:
+//   0x7E, packet id, overhead byte, payload length, payload with its 0x7E bytes stuffed, CRC-8 (0x9B), 0x81
+
+#include <Arduino.h>
+
+#define MAX_PACKET_SIZE 0xFE
+#define DEFAULT_TIMEOUT 50
+
+const int8_t CONTINUE = 3;
+const int8_t NEW_DATA = 2;
+const int8_t NO_DATA = 1;
+const int8_t CRC_ERROR = 0;
+const int8_t PAYLOAD_ERROR = -1;
+const int8_t STOP_BYTE_ERROR = -2;
+const int8_t STALE_PACKET_ERROR = -3;
+
+class Packet {
+public:
+    uint8_t txBuff[MAX_PACKET_SIZE];
+    uint8_t rxBuff[MAX_PACKET_SIZE];
+    uint8_t bytesRead = 0;
+    int8_t status = 0;
+
+    // Frame the first len bytes of txBuff into frame, which must hold len + 6 bytes. Returns the frame size.
+    uint16_t constructPacket(uint16_t len, uint8_t packetID, uint8_t *frame);
+    // Feed one received byte. Returns the payload size once a frame is complete, 0 otherwise.
+    uint8_t parse(uint8_t recChar, bool valid = true);
+    uint8_t currentPacketID() const { return idByte; }
+    void setTimeout(uint32_t timeout_ms) { timeout = timeout_ms; }
+    void reset();
+
+private:
+    enum fsm { find_start_byte, find_id_byte, find_overhead_byte, find_payload_len, find_payload, find_crc, find_end_byte };
+    fsm state = find_start_byte;
+    uint8_t idByte = 0;
+    uint8_t recOverheadByte = 0;
+    uint8_t bytesToRec = 0;
+    uint8_t payIndex = 0;
+    uint32_t packetStart = 0;
+    uint32_t timeout = DEFAULT_TIMEOUT;
+};
+
+class SerialTransfer {
+public:
+    Packet packet;
+    uint8_t bytesRead = 0;
+    int8_t status = 0;
+
+    void begin(Stream& port, const bool& debug = true, Stream& debugPort = Serial, uint32_t timeout = DEFAULT_TIMEOUT);
+    uint8_t sendData(const uint16_t& messageLen, const uint8_t packetID = 0);
+    uint8_t available();
+    uint8_t currentPacketID() { return packet.currentPacketID(); }
+    void reset();
+
+    template <typename T> uint16_t txObj(const T& val, const uint16_t& index = 0, const uint16_t& len = sizeof(T)) {
+        const uint16_t size = min((uint16_t)(MAX_PACKET_SIZE - min(index, (uint16_t)MAX_PACKET_SIZE)), len);
+        memcpy(packet.txBuff + min(index, (uint16_t)MAX_PACKET_SIZE), &val, size);
+        return index + size;
+    }
+    template <typename T> uint16_t rxObj(const T& val, const uint16_t& index = 0, const uint16_t& len = sizeof(T)) {
+        const uint16_t size = min((uint16_t)(MAX_PACKET_SIZE - min(index, (uint16_t)MAX_PACKET_SIZE)), len);
+        memcpy((void *)&val, packet.rxBuff + min(index, (uint16_t)MAX_PACKET_SIZE), size);
+        return index + size;
+    }
+
+private:
+    Stream *port = nullptr;
+};
+
+#endif // HOST_SERIAL_TRANSFER_H
@@ -0,0 +1,100 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+
+HostSerial Serial;
+HostEEPROM EEPROM;
+
+static uint64_t virtual_time_us = UINT64_MAX;
+
+static uint64_t now_us() {
+    if (virtual_time_us != UINT64_MAX) {
+        return virtual_time_us;
+    }
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void host_set_time_us(uint64_t time_us) {
+    virtual_time_us = time_us;
+}
+
+uint32_t millis() {
+    return now_us() / 1000;
+}
+
+uint32_t micros() {
+    return now_us();
+}
+
+void delay(uint32_t ms) {
+    if (virtual_time_us != UINT64_MAX) {
+        virtual_time_us += (uint64_t)ms * 1000;
+    } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+}
+
+void yield() {
+}
+
+size_t HostSerial::write(const uint8_t *buf, size_t size) {
+    if (quiet_) {
+        return size;
+    }
+    return fwrite(buf, 1, size, stderr);
+}
+
+size_t HostSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HostSerial::print(const char *s) {
+    return write((const uint8_t *)s, strlen(s));
+}
+
+size_t HostSerial::print(const String &s) {
+    return print(s.c_str());
+}
+
+size_t HostSerial::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t HostSerial::print(int v) {
+    return print(String(v));
+}
+
+size_t HostSerial::print(unsigned int v) {
+    return print(String(v));
+}
+
+size_t HostSerial::print(long v) {
+    return print(String(v));
+}
+
+size_t HostSerial::print(unsigned long v) {
+    return print(String(v));
+}
+
+size_t HostSerial::print(double v, int decimals) {
+    return print(String(v, decimals));
+}
+
+size_t HostSerial::println() {
+    return print("\r\n");
+}
+
+size_t HostSerial::printf(const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return 0;
+    }
+    return write((const uint8_t *)buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
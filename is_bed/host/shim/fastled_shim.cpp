@@ -0,0 +1,128 @@
+#include <FastLED.h>
+#include <math.h>
+
+CRGB blend(const CRGB &p1, const CRGB &p2, fract8 amountOfP2) {
+    CRGB nu(p1);
+    nblend(nu, p2, amountOfP2);
+    return nu;
+}
+
+CRGB *blend(const CRGB *src1, const CRGB *src2, CRGB *dest, uint16_t count, fract8 amountOfsrc2) {
+    for (uint16_t i = 0; i < count; i++) {
+        dest[i] = blend(src1[i], src2[i], amountOfsrc2);
+    }
+    return dest;
+}
+
+void nblend(CRGB &existing, const CRGB &overlay, fract8 amountOfOverlay) {
+    if (amountOfOverlay == 0) {
+        return;
+    }
+    if (amountOfOverlay == 255) {
+        existing = overlay;
+        return;
+    }
+    // Same as FastLED's FASTLED_BLEND_FIXED variant
+    fract8 amountOfKeep = 255 - amountOfOverlay;
+    existing.red = scale8(existing.red, amountOfKeep) + scale8(overlay.red, amountOfOverlay);
+    existing.green = scale8(existing.green, amountOfKeep) + scale8(overlay.green, amountOfOverlay);
+    existing.blue = scale8(existing.blue, amountOfKeep) + scale8(overlay.blue, amountOfOverlay);
+}
+
+CRGB ColorFromPalette(const CRGBPalette16 &pal, uint8_t index, uint8_t brightness, TBlendType blendType) {
+    uint8_t hi4 = index >> 4;
+    uint8_t lo4 = index & 0x0F;
+    const CRGB *entry = &pal.entries[hi4];
+    uint8_t red1 = entry->red;
+    uint8_t green1 = entry->green;
+    uint8_t blue1 = entry->blue;
+    if (lo4 && blendType != NOBLEND) {
+        entry = hi4 == 15 ? &pal.entries[0] : entry + 1;
+        uint8_t f2 = lo4 << 4;
+        uint8_t f1 = 255 - f2;
+        red1 = scale8(red1, f1) + scale8(entry->red, f2);
+        green1 = scale8(green1, f1) + scale8(entry->green, f2);
+        blue1 = scale8(blue1, f1) + scale8(entry->blue, f2);
+    }
+    if (brightness != 255) {
+        if (brightness) {
+            ++brightness;
+            if (red1) {
+                red1 = scale8(red1, brightness);
+                ++red1;
+            }
+            if (green1) {
+                green1 = scale8(green1, brightness);
+                ++green1;
+            }
+            if (blue1) {
+                blue1 = scale8(blue1, brightness);
+                ++blue1;
+            }
+        } else {
+            red1 = green1 = blue1 = 0;
+        }
+    }
+    return CRGB(red1, green1, blue1);
+}
+
+static uint8_t applyGamma_video(uint8_t brightness, float gamma) {
+    float adj = powf(brightness / 255.0f, gamma) * 255.0f;
+    uint8_t result = (uint8_t)adj;
+    if (brightness > 0 && result == 0) {
+        result = 1;
+    }
+    return result;
+}
+
+CRGB applyGamma_video(const CRGB &orig, float gammaR, float gammaG, float gammaB) {
+    return CRGB(applyGamma_video(orig.r, gammaR), applyGamma_video(orig.g, gammaG), applyGamma_video(orig.b, gammaB));
+}
+
+const TProgmemRGBPalette16 CloudColors_p = {
+    CRGB::Blue, CRGB::DarkBlue, CRGB::DarkBlue, CRGB::DarkBlue,
+    CRGB::DarkBlue, CRGB::DarkBlue, CRGB::DarkBlue, CRGB::DarkBlue,
+    CRGB::Blue, CRGB::DarkBlue, CRGB::SkyBlue, CRGB::SkyBlue,
+    CRGB::LightBlue, CRGB::White, CRGB::LightBlue, CRGB::SkyBlue};
+
+const TProgmemRGBPalette16 LavaColors_p = {
+    CRGB::Black, CRGB::Maroon, CRGB::Black, CRGB::Maroon,
+    CRGB::DarkRed, CRGB::DarkRed, CRGB::Maroon, CRGB::DarkRed,
+    CRGB::DarkRed, CRGB::DarkRed, CRGB::Red, CRGB::Orange,
+    CRGB::White, CRGB::Orange, CRGB::Red, CRGB::DarkRed};
+
+const TProgmemRGBPalette16 OceanColors_p = {
+    CRGB::MidnightBlue, CRGB::DarkBlue, CRGB::MidnightBlue, CRGB::Navy,
+    CRGB::DarkBlue, CRGB::MediumBlue, CRGB::SeaGreen, CRGB::Teal,
+    CRGB::CadetBlue, CRGB::Blue, CRGB::DarkCyan, CRGB::CornflowerBlue,
+    CRGB::Aquamarine, CRGB::SeaGreen, CRGB::Aqua, CRGB::LightSkyBlue};
+
+const TProgmemRGBPalette16 ForestColors_p = {
+    CRGB::DarkGreen, CRGB::DarkGreen, CRGB::DarkOliveGreen, CRGB::DarkGreen,
+    CRGB::Green, CRGB::ForestGreen, CRGB::OliveDrab, CRGB::Green,
+    CRGB::SeaGreen, CRGB::MediumAquamarine, CRGB::LimeGreen, CRGB::YellowGreen,
+    CRGB::LightGreen, CRGB::LawnGreen, CRGB::MediumAquamarine, CRGB::ForestGreen};
+
+const TProgmemRGBPalette16 RainbowColors_p = {
+    0xFF0000, 0xD52A00, 0xAB5500, 0xAB7F00,
+    0xABAB00, 0x56D500, 0x00FF00, 0x00D52A,
+    0x00AB55, 0x0056AA, 0x0000FF, 0x2A00D5,
+    0x5500AB, 0x7F0081, 0xAB0055, 0xD5002B};
+
+const TProgmemRGBPalette16 RainbowStripeColors_p = {
+    0xFF0000, 0x000000, 0xAB5500, 0x000000,
+    0xABAB00, 0x000000, 0x00FF00, 0x000000,
+    0x00AB55, 0x000000, 0x0000FF, 0x000000,
+    0x5500AB, 0x000000, 0xAB0055, 0x000000};
+
+const TProgmemRGBPalette16 PartyColors_p = {
+    0x5500AB, 0x84007C, 0xB5004B, 0xE5001B,
+    0xE81700, 0xB84700, 0xAB7700, 0xABAB00,
+    0xAB5500, 0xDD2200, 0xF2000E, 0xC2003E,
+    0x8F0071, 0x5F00A1, 0x2F00D0, 0x0007F9};
+
+const TProgmemRGBPalette16 HeatColors_p = {
+    0x000000, 0x330000, 0x660000, 0x990000,
+    0xCC0000, 0xFF0000, 0xFF3300, 0xFF6600,
+    0xFF9900, 0xFFCC00, 0xFFFF00, 0xFFFF33,
+    0xFFFF66, 0xFFFF99, 0xFFFFCC, 0xFFFFFF};
@@ -0,0 +1,168 @@
+#include <LittleFS.h>
+
+class RamFileImpl : public FileImpl {
+public:
+    RamFileImpl(std::shared_ptr<LittleFS_QSPIFlash::Entry> entry, const std::string &name, uint8_t mode)
+        : entry_(entry), name_(name), writable_(mode != FILE_READ) {
+        if (mode == FILE_WRITE) {
+            pos_ = entry_->data.size();
+        }
+    }
+    size_t read(void *buf, size_t nbyte) override {
+        if (!entry_ || pos_ >= entry_->data.size()) return 0;
+        size_t n = std::min<uint64_t>(nbyte, entry_->data.size() - pos_);
+        memcpy(buf, entry_->data.data() + pos_, n);
+        pos_ += n;
+        return n;
+    }
+    size_t write(const void *buf, size_t size) override {
+        if (!entry_ || !writable_) return 0;
+        if (entry_->data.size() < pos_ + size) entry_->data.resize(pos_ + size);
+        memcpy(entry_->data.data() + pos_, buf, size);
+        pos_ += size;
+        return size;
+    }
+    int available() override { return entry_ && pos_ < entry_->data.size() ? entry_->data.size() - pos_ : 0; }
+    void flush() override {}
+    bool truncate(uint64_t size) override {
+        if (!entry_ || !writable_) return false;
+        entry_->data.resize(size);
+        return true;
+    }
+    bool seek(uint64_t pos, int mode) override {
+        if (!entry_) return false;
+        uint64_t base = mode == SeekSet ? 0 : mode == SeekCur ? pos_ : entry_->data.size();
+        pos_ = base + pos;
+        return true;
+    }
+    uint64_t position() override { return pos_; }
+    uint64_t size() override { return entry_ ? entry_->data.size() : 0; }
+    void close() override { entry_.reset(); }
+    bool isOpen() override { return entry_ != nullptr; }
+    const char *name() override { return name_.c_str(); }
+    bool isDirectory() override { return false; }
+    File openNextFile(uint8_t) override { return File(); }
+    void rewindDirectory() override {}
+    bool getModifyTime(DateTimeFields &tm) override {
+        if (!entry_) return false;
+        tm = entry_->mtime;
+        return true;
+    }
+    bool setModifyTime(const DateTimeFields &tm) override {
+        if (!entry_) return false;
+        entry_->mtime = tm;
+        return true;
+    }
+
+private:
+    std::shared_ptr<LittleFS_QSPIFlash::Entry> entry_;
+    std::string name_;
+    bool writable_;
+    uint64_t pos_ = 0;
+};
+
+// The root directory. Lists a snapshot of the file names taken when it was opened.
+class RamDirImpl : public FileImpl {
+public:
+    RamDirImpl(LittleFS_QSPIFlash *fs, std::vector<std::string> names) : fs_(fs), names_(names) {}
+    size_t read(void *, size_t) override { return 0; }
+    size_t write(const void *, size_t) override { return 0; }
+    int available() override { return 0; }
+    void flush() override {}
+    bool truncate(uint64_t) override { return false; }
+    bool seek(uint64_t, int) override { return false; }
+    uint64_t position() override { return 0; }
+    uint64_t size() override { return 0; }
+    void close() override { fs_ = nullptr; }
+    bool isOpen() override { return fs_ != nullptr; }
+    const char *name() override { return "/"; }
+    bool isDirectory() override { return true; }
+    File openNextFile(uint8_t mode) override {
+        while (fs_ && next_ < names_.size()) {
+            File file = fs_->open(names_[next_++].c_str(), mode);
+            if (file) return file;
+        }
+        return File();
+    }
+    void rewindDirectory() override { next_ = 0; }
+
+private:
+    LittleFS_QSPIFlash *fs_;
+    std::vector<std::string> names_;
+    size_t next_ = 0;
+};
+
+uint64_t LittleFS_QSPIFlash::capacity_ = 16 * 1024 * 1024;
+
+bool LittleFS_QSPIFlash::begin() {
+    return capacity_ > 0;
+}
+
+void LittleFS_QSPIFlash::setCapacity(uint64_t size) {
+    capacity_ = size;
+}
+
+std::string LittleFS_QSPIFlash::key(const char *filepath) {
+    while (*filepath == '/') {
+        filepath++;
+    }
+    return filepath;
+}
+
+File LittleFS_QSPIFlash::open(const char *filename, uint8_t mode) {
+    std::string name = key(filename);
+    if (name.empty()) {
+        std::vector<std::string> names;
+        for (const auto &file : files_) {
+            names.push_back(file.first);
+        }
+        return File(new RamDirImpl(this, names));
+    }
+    auto it = files_.find(name);
+    if (it == files_.end()) {
+        if (mode == FILE_READ) {
+            return File();
+        }
+        it = files_.emplace(name, std::make_shared<Entry>()).first;
+    }
+    return File(new RamFileImpl(it->second, name, mode));
+}
+
+bool LittleFS_QSPIFlash::exists(const char *filepath) {
+    return key(filepath).empty() || files_.count(key(filepath)) > 0;
+}
+
+bool LittleFS_QSPIFlash::mkdir(const char *) {
+    return false;
+}
+
+bool LittleFS_QSPIFlash::rename(const char *oldfilepath, const char *newfilepath) {
+    auto it = files_.find(key(oldfilepath));
+    if (it == files_.end()) {
+        return false;
+    }
+    auto entry = it->second;
+    files_.erase(it);
+    files_[key(newfilepath)] = entry;
+    return true;
+}
+
+bool LittleFS_QSPIFlash::remove(const char *filepath) {
+    return files_.erase(key(filepath)) > 0;
+}
+
+bool LittleFS_QSPIFlash::rmdir(const char *) {
+    return false;
+}
+
+uint64_t LittleFS_QSPIFlash::usedSize() {
+    uint64_t used = 0;
+    for (const auto &file : files_) {
+        used += file.second->data.size();
+    }
+    return used;
+}
+
+uint64_t LittleFS_QSPIFlash::totalSize() {
+    return capacity_;
+}
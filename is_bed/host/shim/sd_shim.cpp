@@ -0,0 +1,169 @@
+#include <SD.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+SDClass SD;
+
+static bool mtime_fields(const std::string &path, DateTimeFields &tm) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    struct tm t;
+    localtime_r(&st.st_mtime, &t);
+    tm.sec = t.tm_sec;
+    tm.min = t.tm_min;
+    tm.hour = t.tm_hour;
+    tm.wday = t.tm_wday;
+    tm.mday = t.tm_mday;
+    tm.mon = t.tm_mon;
+    tm.year = t.tm_year;
+    return true;
+}
+
+class HostFileImpl : public FileImpl {
+public:
+    HostFileImpl(FILE *f, const std::string &path, const std::string &name) : f_(f), path_(path), name_(name) {}
+    ~HostFileImpl() override { close(); }
+    size_t read(void *buf, size_t nbyte) override { return f_ ? fread(buf, 1, nbyte, f_) : 0; }
+    size_t write(const void *buf, size_t size) override { return f_ ? fwrite(buf, 1, size, f_) : 0; }
+    int available() override {
+        uint64_t s = size(), p = position();
+        return p < s ? std::min<uint64_t>(s - p, INT32_MAX) : 0;
+    }
+    void flush() override { if (f_) fflush(f_); }
+    bool truncate(uint64_t size) override { return f_ && fflush(f_) == 0 && ftruncate(fileno(f_), size) == 0; }
+    bool seek(uint64_t pos, int mode) override {
+        static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+        return f_ && fseeko(f_, pos, whence[mode]) == 0;
+    }
+    uint64_t position() override { return f_ ? ftello(f_) : 0; }
+    uint64_t size() override {
+        struct stat st;
+        if (!f_ || fflush(f_) != 0 || fstat(fileno(f_), &st) != 0) return 0;
+        return st.st_size;
+    }
+    void close() override {
+        if (f_) fclose(f_);
+        f_ = nullptr;
+    }
+    bool isOpen() override { return f_ != nullptr; }
+    const char *name() override { return name_.c_str(); }
+    bool isDirectory() override { return false; }
+    File openNextFile(uint8_t) override { return File(); }
+    void rewindDirectory() override {}
+    bool getModifyTime(DateTimeFields &tm) override { return mtime_fields(path_, tm); }
+
+private:
+    FILE *f_;
+    std::string path_;
+    std::string name_;
+};
+
+class HostDirImpl : public FileImpl {
+public:
+    HostDirImpl(DIR *d, const std::string &path, const std::string &name) : d_(d), path_(path), name_(name) {}
+    ~HostDirImpl() override { close(); }
+    size_t read(void *, size_t) override { return 0; }
+    size_t write(const void *, size_t) override { return 0; }
+    int available() override { return 0; }
+    void flush() override {}
+    bool truncate(uint64_t) override { return false; }
+    bool seek(uint64_t, int) override { return false; }
+    uint64_t position() override { return 0; }
+    uint64_t size() override { return 0; }
+    void close() override {
+        if (d_) closedir(d_);
+        d_ = nullptr;
+    }
+    bool isOpen() override { return d_ != nullptr; }
+    const char *name() override { return name_.c_str(); }
+    bool isDirectory() override { return true; }
+    File openNextFile(uint8_t mode) override;
+    void rewindDirectory() override { if (d_) rewinddir(d_); }
+    bool getModifyTime(DateTimeFields &tm) override { return mtime_fields(path_, tm); }
+
+private:
+    DIR *d_;
+    std::string path_;
+    std::string name_;
+};
+
+static File open_path(const std::string &path, const std::string &name, uint8_t mode) {
+    struct stat st;
+    bool exists = stat(path.c_str(), &st) == 0;
+    if (exists && S_ISDIR(st.st_mode)) {
+        DIR *d = opendir(path.c_str());
+        return d ? File(new HostDirImpl(d, path, name)) : File();
+    }
+    FILE *f = nullptr;
+    if (mode == FILE_READ) {
+        f = fopen(path.c_str(), "rb");
+    } else {
+        // Like the Teensy SD library: create if needed, never truncate.
+        f = fopen(path.c_str(), exists ? "r+b" : "w+b");
+        if (f && mode == FILE_WRITE) {
+            fseeko(f, 0, SEEK_END);
+        }
+    }
+    return f ? File(new HostFileImpl(f, path, name)) : File();
+}
+
+File HostDirImpl::openNextFile(uint8_t mode) {
+    if (!d_) {
+        return File();
+    }
+    while (struct dirent *e = readdir(d_)) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        return open_path(path_ + "/" + e->d_name, e->d_name, mode);
+    }
+    return File();
+}
+
+bool SDClass::begin(uint8_t) {
+    struct stat st;
+    return stat(root_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void SDClass::setRoot(const char *path) {
+    root_ = path;
+}
+
+std::string SDClass::path(const char *filepath) const {
+    std::string p = filepath;
+    if (p.empty() || p[0] != '/') {
+        p = "/" + p;
+    }
+    return root_ + p;
+}
+
+File SDClass::open(const char *filename, uint8_t mode) {
+    const char *name = strrchr(filename, '/');
+    return open_path(path(filename), name ? name + 1 : filename, mode);
+}
+
+bool SDClass::exists(const char *filepath) {
+    struct stat st;
+    return stat(path(filepath).c_str(), &st) == 0;
+}
+
+bool SDClass::mkdir(const char *filepath) {
+    return ::mkdir(path(filepath).c_str(), 0755) == 0;
+}
+
+bool SDClass::rename(const char *oldfilepath, const char *newfilepath) {
+    return ::rename(path(oldfilepath).c_str(), path(newfilepath).c_str()) == 0;
+}
+
+bool SDClass::remove(const char *filepath) {
+    return ::unlink(path(filepath).c_str()) == 0;
+}
+
+bool SDClass::rmdir(const char *filepath) {
+    return ::rmdir(path(filepath).c_str()) == 0;
+}
@@ -0,0 +1,183 @@
+#include <SerialTransfer.h>
+
+#define START_BYTE 0x7E
+#define STOP_BYTE 0x81
+#define CRC_POLYNOMIAL 0x9B
+// Start byte, packet id, overhead byte, payload length, CRC, stop byte
+#define FRAME_OVERHEAD 6
+
+static uint8_t crc8(const uint8_t *data, uint16_t len) {
+    static uint8_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint8_t value = i;
+            for (uint32_t j = 0; j < 8; j++) {
+                value = (value & 0x80) ? (uint8_t)(value << 1) ^ CRC_POLYNOMIAL : (uint8_t)(value << 1);
+            }
+            table[i] = value;
+        }
+        table_ready = true;
+    }
+    uint8_t crc = 0;
+    for (uint16_t i = 0; i < len; i++) {
+        crc = table[crc ^ data[i]];
+    }
+    return crc;
+}
+
+uint16_t Packet::constructPacket(uint16_t len, uint8_t packetID, uint8_t *frame) {
+    len = min(len, (uint16_t)MAX_PACKET_SIZE);
+    uint8_t *payload = frame + 4;
+    memcpy(payload, txBuff, len);
+    // The payload can't have start bytes: each one is replaced with the distance to the next one, and the
+    // overhead byte is the index of the first one, 0xFF if there is none
+    uint8_t overhead = 0xFF;
+    int32_t next = -1;
+    for (int32_t i = len - 1; i >= 0; i--) {
+        if (payload[i] == START_BYTE) {
+            payload[i] = next < 0 ? 0 : next - i;
+            next = i;
+        }
+    }
+    if (next >= 0) {
+        overhead = next;
+    }
+    frame[0] = START_BYTE;
+    frame[1] = packetID;
+    frame[2] = overhead;
+    frame[3] = len;
+    frame[4 + len] = crc8(payload, len);
+    frame[5 + len] = STOP_BYTE;
+    return len + FRAME_OVERHEAD;
+}
+
+uint8_t Packet::parse(uint8_t recChar, bool valid) {
+    if (state != find_start_byte && millis() - packetStart >= timeout) {
+        bytesRead = 0;
+        state = find_start_byte;
+        status = STALE_PACKET_ERROR;
+        return 0;
+    }
+    if (!valid) {
+        bytesRead = 0;
+        status = NO_DATA;
+        return 0;
+    }
+    switch (state) {
+    case find_start_byte:
+        if (recChar == START_BYTE) {
+            state = find_id_byte;
+            packetStart = millis();
+        }
+        break;
+    case find_id_byte:
+        idByte = recChar;
+        state = find_overhead_byte;
+        break;
+    case find_overhead_byte:
+        recOverheadByte = recChar;
+        state = find_payload_len;
+        break;
+    case find_payload_len:
+        if (recChar > 0 && recChar <= MAX_PACKET_SIZE) {
+            bytesToRec = recChar;
+            payIndex = 0;
+            state = find_payload;
+        } else {
+            bytesRead = 0;
+            state = find_start_byte;
+            status = PAYLOAD_ERROR;
+            return 0;
+        }
+        break;
+    case find_payload:
+        rxBuff[payIndex++] = recChar;
+        if (payIndex == bytesToRec) {
+            state = find_crc;
+        }
+        break;
+    case find_crc:
+        if (crc8(rxBuff, bytesToRec) == recChar) {
+            state = find_end_byte;
+        } else {
+            bytesRead = 0;
+            state = find_start_byte;
+            status = CRC_ERROR;
+            return 0;
+        }
+        break;
+    case find_end_byte:
+        state = find_start_byte;
+        if (recChar != STOP_BYTE) {
+            bytesRead = 0;
+            status = STOP_BYTE_ERROR;
+            return 0;
+        }
+        // Put the start bytes back
+        for (uint32_t i = recOverheadByte; i < bytesToRec;) {
+            const uint8_t delta = rxBuff[i];
+            rxBuff[i] = START_BYTE;
+            if (delta == 0) {
+                break;
+            }
+            i += delta;
+        }
+        bytesRead = bytesToRec;
+        status = NEW_DATA;
+        return bytesToRec;
+    }
+    bytesRead = 0;
+    status = CONTINUE;
+    return 0;
+}
+
+void Packet::reset() {
+    memset(txBuff, 0, sizeof(txBuff));
+    memset(rxBuff, 0, sizeof(rxBuff));
+    bytesRead = 0;
+    packetStart = 0;
+    state = find_start_byte;
+}
+
+void SerialTransfer::begin(Stream& port, const bool& debug, Stream& debugPort, uint32_t timeout) {
+    this->port = &port;
+    packet.setTimeout(timeout);
+}
+
+uint8_t SerialTransfer::sendData(const uint16_t& messageLen, const uint8_t packetID) {
+    uint8_t frame[MAX_PACKET_SIZE + FRAME_OVERHEAD];
+    const uint16_t frame_size = packet.constructPacket(messageLen, packetID, frame);
+    port->write(frame, frame_size);
+    return frame_size - FRAME_OVERHEAD;
+}
+
+uint8_t SerialTransfer::available() {
+    if (port->available()) {
+        while (port->available()) {
+            bytesRead = packet.parse(port->read());
+            status = packet.status;
+            if (status != CONTINUE) {
+                if (status < 0) {
+                    reset();
+                }
+                break;
+            }
+        }
+    } else {
+        bytesRead = packet.parse(0xFF, false);
+        status = packet.status;
+        if (status < 0) {
+            reset();
+        }
+    }
+    return bytesRead;
+}
+
+void SerialTransfer::reset() {
+    while (port->available()) {
+        port->read();
+    }
+    packet.reset();
+    status = packet.status;
+}
@@ -0,0 +1,350 @@
+#include "controller_link.h"
+#include <SerialTransfer.h>
+#include <is_bed_state_sync.h>
+#include <is_bed_link.h>
+#include <is_bed_clock.h>
+#include <is_bed_message.h>
+
+static SerialTransfer transfer;
+static controller_link_callbacks_t ui;
+static uint8_t max_catalog_size = 0;
+static uint32_t last_send_ms = 0;
+// Protocol version spoken with the controller: the lowest of its own and ours, once it answered our hello.
+// Until then it is 0, and hello is sent instead of our state.
+static uint8_t protocol_version = 0;
+static uint8_t controller_capabilities = 0;
+// Our side of the link. Our serial port is the link, so the controller is the one that prints both sides
+// on its own.
+static is_bed_link_t link;
+// The pattern clock of the controller, if it answers the time requests
+static is_bed_clock_t pattern_clock;
+// Our state, kept up to date on the controller with deltas. A version 2 controller gets the state of the first
+// zone for all the zones.
+static is_bed_state_sender_t lcd_state_sender;
+static is_bed_lcd_v2_state_t lcd_v2_state;
+static is_bed_controller_state_t controller_state = {IS_BED_UPDATE_NONE, 0, 1};
+// The pattern set the pattern list was learned from, and whether it is still the one of the controller
+static uint8_t pattern_set = 0;
+static bool catalog_valid = false;
+// When the controller says hello or swaps in a new pattern set, the catalog is asked again.
+// The catalog being received: its pattern set, once its first chunk arrived, its size, and the next
+// entry expected. It is asked again from that entry when it stalls.
+static bool catalog_receiving = false;
+static bool catalog_set_known = false;
+static uint8_t catalog_set = 0;
+static uint8_t catalog_size = 0;
+static uint8_t catalog_next_index = 0;
+static uint32_t catalog_progress_ms = 0;
+
+//
+// Static function prototypes
+//
+static void receive_catalog(const is_bed_message_t& message);
+static void receive_segment_preview(const is_bed_message_t& message);
+static void invalidate_catalog();
+static void request_catalog(uint8_t first_index);
+static void send_state(is_bed_lcd_state_t& state);
+static void v2_state_from_zones(const is_bed_lcd_state_t& state);
+static void send_ping();
+static void send_time_request();
+static uint16_t begin_message();
+static void count_link_error();
+
+void controller_link_begin(Stream& port, uint8_t max_patterns, const controller_link_callbacks_t& callbacks) {
+    transfer.begin(port, false);
+    ui = callbacks;
+    max_catalog_size = max_patterns;
+    is_bed_state_sender_init(lcd_state_sender, is_bed_lcd_state_layout);
+    is_bed_link_init(link, millis());
+    is_bed_clock_init(pattern_clock, millis());
+}
+
+bool controller_link_connected() {
+    return protocol_version >= 2;
+}
+
+bool controller_link_catalog_valid() {
+    return catalog_valid && controller_state.pattern_set == pattern_set;
+}
+
+bool controller_link_clock_synced() {
+    return pattern_clock.synced;
+}
+
+uint32_t controller_link_pattern_ms() {
+    return is_bed_clock_now(pattern_clock, millis());
+}
+
+void controller_link_receive() {
+    while (true) {
+        const uint8_t size = transfer.available();
+        if (size == 0) {
+            count_link_error();
+            break;
+        }
+        // From version 4, the messages of the controller start with a link header, except hello.
+        // The message is read in place, it stays in the receive buffer until the next frame.
+        is_bed_message_t message;
+        if (!is_bed_message_parse(transfer.currentPacketID(), transfer.packet.rxBuff, size, protocol_version >= 4,
+                                  message)) {
+            continue;
+        }
+        if (message.header != nullptr && !is_bed_link_receive(link, millis(), *message.header)) {
+            continue;
+        }
+        switch (message.type) {
+        case IS_BED_MESSAGE_V1:
+            // The controller does not know us yet, it restarted. Say hello again.
+            protocol_version = 0;
+            break;
+        case IS_BED_MESSAGE_HELLO: {
+            // Speak the version of the controller if it is older
+            const is_bed_hello_t& hello = is_bed_message_view<is_bed_hello_t>(message);
+            protocol_version = min(hello.version, (uint8_t)IS_BED_PROTOCOL_VERSION);
+            controller_capabilities = hello.capabilities;
+            is_bed_link_hello(link);
+            // The controller may have restarted, with its clock
+            is_bed_clock_reset(pattern_clock, millis());
+            // Send our whole state again, in the layout of the version, and learn the catalog again as the
+            // patterns may have changed. A version 2 controller has a single palette.
+            is_bed_state_sender_init(lcd_state_sender, protocol_version >= 5   ? is_bed_lcd_state_layout
+                                                       : protocol_version >= 3 ? is_bed_lcd_v3_state_layout
+                                                                               : is_bed_lcd_v2_state_layout);
+            if (protocol_version < 3) {
+                controller_state.num_palettes = 1;
+            }
+            invalidate_catalog();
+            catalog_receiving = false;
+            break;
+        }
+        case IS_BED_MESSAGE_CATALOG:
+            receive_catalog(message);
+            break;
+        case IS_BED_MESSAGE_PREVIEW:
+            ui.zone_preview(is_bed_message_view<is_bed_preview_t>(message).zone_color);
+            break;
+        case IS_BED_MESSAGE_SEGMENT_PREVIEW:
+            receive_segment_preview(message);
+            break;
+        case IS_BED_MESSAGE_STATE: {
+            // Only the fields that changed are in the message, the others keep their value
+            is_bed_state_header_t header;
+            if (!is_bed_state_apply(protocol_version >= 3 ? is_bed_controller_state_layout
+                                                          : is_bed_controller_v2_state_layout,
+                                    &controller_state, message.payload, message.size, &header)) {
+                break;
+            }
+            is_bed_ack_t ack = {header.sequence};
+            uint16_t send_size = transfer.txObj(ack, begin_message(), sizeof(ack));
+            transfer.sendData(send_size, IS_BED_MESSAGE_ACK);
+            ui.state_changed(controller_state);
+            break;
+        }
+        case IS_BED_MESSAGE_ACK:
+            is_bed_state_ack(lcd_state_sender, is_bed_message_view<is_bed_ack_t>(message));
+            break;
+        case IS_BED_MESSAGE_PING: {
+            // The pong goes out of the send buffer, apart from the receive buffer
+            const is_bed_ping_t& ping = is_bed_message_view<is_bed_ping_t>(message);
+            uint16_t send_size = transfer.txObj(ping, begin_message(), sizeof(ping));
+            transfer.sendData(send_size, IS_BED_MESSAGE_PONG);
+            break;
+        }
+        case IS_BED_MESSAGE_PONG:
+            is_bed_link_pong(link, millis(), is_bed_message_view<is_bed_ping_t>(message));
+            break;
+        case IS_BED_MESSAGE_LINK_STATS:
+            // The controller sends its counters with its pings
+            ui.link_stats(link.stats, is_bed_message_view<is_bed_link_stats_t>(message));
+            break;
+        case IS_BED_MESSAGE_TIME:
+            is_bed_clock_answer(pattern_clock, millis(), is_bed_message_view<is_bed_time_t>(message));
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void controller_link_update(is_bed_lcd_state_t& state) {
+    // Ask for the pattern catalog if we don't have the current one, and again when it stalls
+    if (protocol_version >= 2) {
+        if (catalog_receiving) {
+            if (millis() - catalog_progress_ms >= CATALOG_TIMEOUT_MS) {
+                request_catalog(catalog_next_index);
+            }
+        } else if (!catalog_valid || controller_state.pattern_set != pattern_set) {
+            invalidate_catalog();
+            catalog_receiving = true;
+            request_catalog(0);
+        }
+    }
+    send_state(state);
+    send_ping();
+    send_time_request();
+}
+
+// Add a chunk of the pattern catalog to the pattern list. Chunks that don't follow the entries
+// received so far are dropped, the missing entries are asked again when the catalog stalls.
+static void receive_catalog(const is_bed_message_t& message) {
+    const is_bed_catalog_t& catalog = is_bed_message_view<is_bed_catalog_t>(message);
+    const is_bed_catalog_entry_t *entries =
+        is_bed_message_array<is_bed_catalog_entry_t>(message, sizeof(catalog), catalog.count);
+    if (!catalog_receiving || entries == nullptr) {
+        return;
+    }
+    if (catalog_set_known && catalog.pattern_set != catalog_set) {
+        // The controller swapped its patterns meanwhile, start over
+        request_catalog(0);
+        return;
+    }
+    if (!catalog_set_known) {
+        if (catalog.first_index != 0) {
+            return;
+        }
+        catalog_set_known = true;
+        catalog_set = catalog.pattern_set;
+    }
+    if (catalog.first_index > catalog_next_index) {
+        return;
+    }
+    catalog_size = min(catalog.num_patterns, max_catalog_size);
+    for (uint8_t i = 0; i < catalog.count; i++) {
+        const uint8_t index = catalog.first_index + i;
+        if (index != catalog_next_index || index >= catalog_size) {
+            continue;
+        }
+        ui.catalog_entry(index, entries[i]);
+        catalog_next_index++;
+        catalog_progress_ms = millis();
+    }
+    if (catalog_next_index < catalog_size) {
+        return;
+    }
+
+    // The catalog is complete: the UI selects the same patterns as before, and only then the controller
+    // uses our pattern indexes again
+    catalog_receiving = false;
+    catalog_valid = true;
+    pattern_set = catalog_set;
+    ui.catalog_complete(catalog_size);
+}
+
+// Hand the colors of the segments to the UI, where they were received. The message has one per segment.
+static void receive_segment_preview(const is_bed_message_t& message) {
+    const is_bed_segment_preview_t& preview = is_bed_message_view<is_bed_segment_preview_t>(message);
+    const uint32_t num_colors = (message.size - sizeof(preview)) / sizeof(is_bed_preview_color_t);
+    ui.segment_preview(preview, is_bed_message_array<is_bed_preview_color_t>(message, sizeof(preview), num_colors));
+}
+
+// Let the UI remember the selected and displayed patterns of a catalog that is about to be replaced
+static void invalidate_catalog() {
+    if (catalog_valid) {
+        ui.catalog_invalidated();
+    }
+    catalog_valid = false;
+}
+
+// Ask the controller for its catalog, from an entry to the last one
+static void request_catalog(uint8_t first_index) {
+    if (first_index == 0) {
+        catalog_set_known = false;
+    }
+    catalog_next_index = first_index;
+    catalog_progress_ms = millis();
+    is_bed_catalog_request_t request = {first_index};
+    uint16_t send_size = transfer.txObj(request, begin_message(), sizeof(request));
+    transfer.sendData(send_size, IS_BED_MESSAGE_CATALOG_REQUEST);
+}
+
+// Say hello until the controller answers, then send what changed in our state
+static void send_state(is_bed_lcd_state_t& state) {
+    state.pattern_set = pattern_set;
+    const uint32_t since_last_send_ms = millis() - last_send_ms;
+    if (protocol_version < 2) {
+        if (since_last_send_ms < COMMS_HELLO_INTERVAL_MS) {
+            return;
+        }
+        last_send_ms = millis();
+        is_bed_hello_t hello;
+        hello.version = IS_BED_PROTOCOL_VERSION;
+        hello.capabilities = IS_BED_CAPABILITY_PREVIEW | IS_BED_CAPABILITY_SEGMENT_PREVIEW |
+                             IS_BED_CAPABILITY_UPDATE_PROGRESS | IS_BED_CAPABILITY_PATTERN_CLOCK;
+        uint16_t send_size = transfer.txObj(hello, 0, sizeof(hello));
+        transfer.sendData(send_size, IS_BED_MESSAGE_HELLO);
+        return;
+    }
+    const void *current_state = &state;
+    if (protocol_version < 3) {
+        v2_state_from_zones(state);
+        current_state = &lcd_v2_state;
+    }
+    const bool send = (since_last_send_ms >= COMMS_COALESCE_MS && is_bed_state_changed(lcd_state_sender, current_state)) ||
+                      (since_last_send_ms >= COMMS_RETRY_MS && lcd_state_sender.waiting) ||
+                      since_last_send_ms >= COMMS_HEARTBEAT_MS;
+    if (!send) {
+        return;
+    }
+    last_send_ms = millis();
+    uint8_t message[IS_BED_STATE_MESSAGE_MAX_SIZE];
+    const uint8_t message_size = is_bed_state_message(lcd_state_sender, current_state, message, true);
+    uint16_t send_size = transfer.txObj(message, begin_message(), message_size);
+    transfer.sendData(send_size, IS_BED_MESSAGE_STATE);
+}
+
+// The state of a version 2 LCD: the pattern, color and frequency of the first zone, for all the zones
+static void v2_state_from_zones(const is_bed_lcd_state_t& state) {
+    is_bed_lcd_to_controller_t& frame = lcd_v2_state.frame;
+    frame.selected_pattern_index = state.zones[0].selected_pattern_index;
+    frame.displayed_pattern_index = state.zones[0].displayed_pattern_index;
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        frame.zone_brightness[i] = state.zones[i].brightness;
+    }
+    frame.selected_color = state.zones[0].color;
+    frame.frequency = state.zones[0].frequency;
+    lcd_v2_state.pattern_set = state.pattern_set;
+}
+
+// Ping the controller and send it our counters, once in a while
+static void send_ping() {
+    is_bed_ping_t ping;
+    if (protocol_version < 4 || !is_bed_link_ping(link, millis(), ping)) {
+        return;
+    }
+    uint16_t send_size = transfer.txObj(ping, begin_message(), sizeof(ping));
+    transfer.sendData(send_size, IS_BED_MESSAGE_PING);
+    send_size = transfer.txObj(link.stats, begin_message(), sizeof(link.stats));
+    transfer.sendData(send_size, IS_BED_MESSAGE_LINK_STATS);
+}
+
+// Ask the controller for its pattern clock, quickly until we follow it, then once in a while
+static void send_time_request() {
+    is_bed_time_request_t request;
+    if (protocol_version < 2 || !(controller_capabilities & IS_BED_CAPABILITY_PATTERN_CLOCK) ||
+        !is_bed_clock_request(pattern_clock, millis(), request)) {
+        return;
+    }
+    uint16_t send_size = transfer.txObj(request, begin_message(), sizeof(request));
+    transfer.sendData(send_size, IS_BED_MESSAGE_TIME_REQUEST);
+}
+
+// Start a message to the controller: write the link header if the controller speaks version 4.
+// Returns where the payload goes.
+static uint16_t begin_message() {
+    if (protocol_version < 4) {
+        return 0;
+    }
+    is_bed_link_header_t header;
+    is_bed_link_send(link, millis(), header);
+    return transfer.txObj(header, 0, sizeof(header));
+}
+
+// SerialTransfer drops the frames it rejects, only its status tells why
+static void count_link_error() {
+    if (transfer.status == CRC_ERROR) {
+        is_bed_link_error(link, true);
+    } else if (transfer.status == PAYLOAD_ERROR || transfer.status == STOP_BYTE_ERROR ||
+               transfer.status == STALE_PACKET_ERROR) {
+        is_bed_link_error(link, false);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef CONTROLLER_LINK_H
+#define CONTROLLER_LINK_H
+
+#include <Arduino.h>
+#include <is_bed_protocol.h>
+#include <is_bed_message.h>
+#include <stdint.h>
+
+// The link with the controller (see is_bed_protocol.h): says hello, keeps our state up to date on the
+// controller, learns the pattern catalog, follows the pattern clock, and hands what the controller sends to
+// the UI through callbacks.
+// It does not depend on LVGL, so that it also builds on the host (see host/link_harness).
+
+// Our state is sent as soon as it changes, but at most once every COMMS_COALESCE_MS so that the changes of a
+// quick control movement share a message. A message that is not acknowledged is sent again every
+// COMMS_RETRY_MS, and an idle link gets a heartbeat every COMMS_HEARTBEAT_MS.
+#define COMMS_COALESCE_MS 5
+#define COMMS_RETRY_MS 50
+#define COMMS_HEARTBEAT_MS 1000
+#define COMMS_HELLO_INTERVAL_MS 100
+// The catalog is asked again from the next entry expected when it stalls that long
+#define CATALOG_TIMEOUT_MS 500
+
+// What the UI does with what the controller sends. The messages are read where they were received, so what
+// is given is only valid during the call.
+typedef struct {
+    // The state of the controller changed
+    void (*state_changed)(const is_bed_controller_state_t& state);
+    // The catalog is about to be learned again. Called only if it was complete, for the UI to remember the
+    // patterns selected and displayed in each zone by name.
+    void (*catalog_invalidated)();
+    // An entry of the catalog being learned, in index order. The name fills the entry when it has no
+    // terminating null.
+    void (*catalog_entry)(uint8_t index, const is_bed_catalog_entry_t& entry);
+    // The catalog is complete, with its number of patterns: the patterns are found again by name
+    void (*catalog_complete)(uint8_t num_patterns);
+    // A color per zone
+    void (*zone_preview)(const color_rgb_t zone_color[]);
+    // A color per segment of the preview, in zone order
+    void (*segment_preview)(const is_bed_segment_preview_t& preview, const is_bed_preview_color_t *colors);
+    // New counters for both sides of the link
+    void (*link_stats)(const is_bed_link_stats_t& lcd, const is_bed_link_stats_t& controller);
+} controller_link_callbacks_t;
+
+// Start talking to the controller over a serial port. The catalog is cut to max_patterns, the number of
+// patterns the UI can hold.
+void controller_link_begin(Stream& port, uint8_t max_patterns, const controller_link_callbacks_t& callbacks);
+
+// Handle the messages received from the controller
+void controller_link_receive();
+
+// Ask for the catalog if we don't have the current one, say hello until the controller answers, then send
+// our state when it changes, ping the controller and ask for its pattern clock once in a while. The pattern indexes of the state are
+// those of the catalog, whose pattern set is filled in here.
+void controller_link_update(is_bed_lcd_state_t& state);
+
+// Whether the controller answered our hello, and the pattern catalog is the current one
+bool controller_link_connected();
+bool controller_link_catalog_valid();
+
+// Whether we follow the pattern clock of the controller, and that clock: the millis() the controller renders
+// its patterns with, for the UI to animate them in step (see is_bed_clock.h). It runs on our own millis()
+// until the controller answers a time request.
+bool controller_link_clock_synced();
+uint32_t controller_link_pattern_ms();
+
+#endif // CONTROLLER_LINK_H
@@ -10,14 +10,16 @@
 #include <FT6336U.h>
 #include <Wire.h>
 #include <Adafruit_seesaw.h>
-#include <SerialTransfer.h>
 #include <is_bed_protocol.h>
+#include <is_bed_link.h>
+#include "controller_link.h"
 
-// Communication with the main controller
-SerialTransfer controller_transfer;
-is_bed_controller_to_lcd_t from_controller_msg;
-is_bed_lcd_to_controller_t to_controller_msg;
-#define COMMS_SEND_INTERVAL_MS 100
+// Our state, sent to the main controller when it changes
+is_bed_lcd_state_t to_controller_msg;
+// When the controller swaps in a new pattern set, the patterns that were selected and displayed in each zone
+// are found again by name once the new catalog is complete
+char relearned_selected_names[NUM_ZONES][MAX_LED_PATTERN_NAME_LENGTH + 1];
+char relearned_displayed_names[NUM_ZONES][MAX_LED_PATTERN_NAME_LENGTH + 1];
 
 // Touchscreen
 #define TOUCH_RST_PIN 37
@@ -52,7 +54,27 @@ static lv_color_t draw_buf[DRAW_BUF_SIZE];
 static uint32_t lv_tick(void);
 static void lv_touchpad_read(lv_indev_t *indev, lv_indev_data_t *data);
 static void lv_encoder_read(lv_indev_t *indev, lv_indev_data_t *data);
-static void comms_send_cb(lv_timer_t *timer);
+static void comms_send();
+static void show_controller_state(const is_bed_controller_state_t& state);
+static void remember_patterns();
+static void learn_pattern(uint8_t index, const is_bed_catalog_entry_t& entry);
+static void relearn_patterns(uint8_t num_learned_patterns);
+static void show_zone_colors(const color_rgb_t zone_color[]);
+static void show_segment_colors(const is_bed_segment_preview_t& preview, const is_bed_preview_color_t *colors);
+static void show_link_stats(const is_bed_link_stats_t& lcd, const is_bed_link_stats_t& controller);
+static uint32_t find_pattern(const char *name);
+static composite_image_flash_t pattern_flash(uint32_t pattern_index);
+
+// What the UI does with what the controller sends
+static const controller_link_callbacks_t controller_link_callbacks = {
+    show_controller_state,
+    remember_patterns,
+    learn_pattern,
+    relearn_patterns,
+    show_zone_colors,
+    show_segment_colors,
+    show_link_stats,
+};
 
 //
 // The main setup function
@@ -61,7 +83,7 @@ void setup()
 {
     // Serial port
     Serial.begin(115200);
-    controller_transfer.begin(Serial, false);
+    controller_link_begin(Serial, MAX_LED_PATTERNS, controller_link_callbacks);
 
     // Touchscreen
     ft6336u.begin();
@@ -108,11 +130,9 @@ void setup()
         lv_indev_set_user_data(encoders[i], (void *)i); // Store the encoder index in the user data
     }
 
-    // Build the UI
+    // Build the UI. It flashes in step with the patterns of the controller.
     is_bed_ui();
-
-    // Create a timer for the communication send function.
-    lv_timer_create(comms_send_cb, COMMS_SEND_INTERVAL_MS, NULL);
+    set_pattern_clock(controller_link_pattern_ms);
 }
 
 void loop()
@@ -121,45 +141,127 @@ void loop()
     lv_timer_handler();
 
     // Listen for messages from the controller
-    while (controller_transfer.available()) {
-        controller_transfer.rxObj(from_controller_msg);
-        // Add the pattern name to the pattern slider
-        if (from_controller_msg.pattern_index < MAX_LED_PATTERNS) {
-            uint8_t index = from_controller_msg.pattern_index;
-            pattern_names[index] = String(from_controller_msg.pattern_name);
-            pattern_types[index] = from_controller_msg.pattern_type;
-            if (index >= num_patterns) {
-                num_patterns = index + 1;
-                unhide_widgets();
-                pattern_slider_set_pattern(0);
-            }
-        }
-        // Update the colors on the composite image
-        for (uint32_t i = 0; i < NUM_ZONES; i++) {
-            composite_layers[i].led_color =
-                lv_color_make(from_controller_msg.zone_color[i].r,
-                              from_controller_msg.zone_color[i].g,
-                              from_controller_msg.zone_color[i].b);
+    controller_link_receive();
+    // Send the changes made by the UI
+    comms_send();
+}
+
+// Send our state to the controller when it changes
+static void comms_send() {
+    // Fill the to_controller_msg structure with the settings of each zone
+    sync_zone_settings();
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        const zone_settings_t& settings = zone_settings[i];
+        is_bed_zone_state_t& zone = to_controller_msg.zones[i];
+        zone.selected_pattern_index = settings.selected_pattern_index;
+        zone.displayed_pattern_index = settings.displayed_pattern_index;
+        zone.color.r = settings.color.red;
+        zone.color.g = settings.color.green;
+        zone.color.b = settings.color.blue;
+        zone.palette_index = settings.palette_index;
+        zone.frequency = settings.frequency;
+        zone.brightness = zone_brightness[i];
+        zone.phase = settings.phase;
+    }
+    controller_link_update(to_controller_msg);
+}
+
+// Show the state of the controller
+static void show_controller_state(const is_bed_controller_state_t& state) {
+    show_update_progress(state.update_progress);
+    num_palettes = max(state.num_palettes, (uint8_t)1);
+}
+
+// Remember the selected and displayed patterns of a catalog that is about to be replaced
+static void remember_patterns() {
+    sync_zone_settings();
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        strcpy(relearned_selected_names[i], pattern_names[zone_settings[i].selected_pattern_index]);
+        strcpy(relearned_displayed_names[i], pattern_names[zone_settings[i].displayed_pattern_index]);
+    }
+}
+
+// Add an entry of the catalog to the pattern list
+static void learn_pattern(uint8_t index, const is_bed_catalog_entry_t& entry) {
+    const size_t length = strnlen(entry.name, sizeof(entry.name));
+    memcpy(pattern_names[index], entry.name, length);
+    pattern_names[index][length] = '\0';
+    pattern_types[index] = entry.type;
+}
+
+// The catalog is complete: select the same patterns as before
+static void relearn_patterns(uint8_t num_learned_patterns) {
+    num_patterns = num_learned_patterns;
+    if (num_patterns > 0) {
+        unhide_widgets();
+    }
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        zone_settings[i].selected_pattern_index = find_pattern(relearned_selected_names[i]);
+        zone_settings[i].displayed_pattern_index = find_pattern(relearned_displayed_names[i]);
+    }
+    show_zone_settings();
+}
+
+// Find a pattern by name. Returns 0 if there is no such pattern.
+static uint32_t find_pattern(const char *name) {
+    for (uint32_t i = 0; i < num_patterns; i++) {
+        if (strcmp(pattern_names[i], name) == 0) {
+            return i;
         }
     }
+    return 0;
+}
+
+// How the layer of a zone flashes with a pattern, as the pattern does on the controller
+static composite_image_flash_t pattern_flash(uint32_t pattern_index) {
+    if (!controller_link_catalog_valid() || pattern_index >= num_patterns) {
+        return COMPOSITE_IMAGE_STEADY;
+    }
+    switch (pattern_types[pattern_index]) {
+    case IS_BED_PATTERN_BLINK:
+        return COMPOSITE_IMAGE_BLINK;
+    case IS_BED_PATTERN_STROBE:
+        return COMPOSITE_IMAGE_STROBE;
+    default:
+        return COMPOSITE_IMAGE_STEADY;
+    }
+}
+
+// Update the colors on the composite image
+static void show_zone_colors(const color_rgb_t zone_color[]) {
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        composite_layers[i].led_color = lv_color_make(zone_color[i].r, zone_color[i].g, zone_color[i].b);
+        composite_layers[i].num_segments = 0;
+        composite_layers[i].flash = COMPOSITE_IMAGE_STEADY;
+    }
 }
 
-// Communication send timer callback
-static void comms_send_cb(lv_timer_t *timer) {
-    // Fill the to_controller_msg structure
+// Update the colors of the segments on the composite image. The segments that don't fit in a layer are
+// skipped. Once we follow the pattern clock, the patterns that flash are sent lit, and flashed here.
+static void show_segment_colors(const is_bed_segment_preview_t& preview, const is_bed_preview_color_t *colors) {
+    uint32_t color_index = 0;
     for (uint32_t i = 0; i < NUM_ZONES; i++) {
-        to_controller_msg.zone_brightness[i] = zone_brightness[i];
+        composite_image_layer_t& layer = composite_layers[i];
+        layer.flash = controller_link_clock_synced() ? pattern_flash(zone_settings[i].displayed_pattern_index)
+                                                     : COMPOSITE_IMAGE_STEADY;
+        layer.period_ms = 10000 / max(zone_settings[i].frequency, (uint8_t)1);
+        layer.num_segments = min(preview.num_segments[i], (uint8_t)COMPOSITE_IMAGE_MAX_SEGMENTS);
+        for (uint32_t j = 0; j < layer.num_segments; j++) {
+            const color_rgb_t color = is_bed_rgb888(colors[color_index + j].rgb565);
+            layer.segment_colors[j] = lv_color_make(color.r, color.g, color.b);
+        }
+        color_index += preview.num_segments[i];
     }
-    to_controller_msg.selected_pattern_index = selected_pattern_index;
-    to_controller_msg.displayed_pattern_index = displayed_pattern_index;
-    to_controller_msg.selected_color.r = selected_color.red;
-    to_controller_msg.selected_color.g = selected_color.green;
-    to_controller_msg.selected_color.b = selected_color.blue;
-    to_controller_msg.frequency = frequency;
-
-    // Send the message
-    controller_transfer.txObj(to_controller_msg);
-    controller_transfer.sendData(sizeof(to_controller_msg));
+}
+
+// Show the counters of both sides of the link on the diagnostics screen
+static void show_link_stats(const is_bed_link_stats_t& lcd, const is_bed_link_stats_t& controller) {
+    char text[512];
+    size_t length = snprintf(text, sizeof(text), "LCD\n");
+    length += is_bed_link_format(lcd, text + length, sizeof(text) - length);
+    length += snprintf(text + length, sizeof(text) - length, "\nController\n");
+    is_bed_link_format(controller, text + length, sizeof(text) - length);
+    show_link_diagnostics(text);
 }
 
 // Provides LVGL with access to the timer
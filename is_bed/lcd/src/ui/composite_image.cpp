@@ -1,6 +1,4 @@
 #include "composite_image.h"
-#include "pattern_slider.h"
-#include <is_bed_protocol.h>
 #include <Arduino.h>
 #include <numeric>
 
@@ -29,18 +27,36 @@ static composite_image_dsc_t composite_dsc = {
     .background_image_dsc = background,
     .layers = composite_layers,
     .layer_count = sizeof(composite_layers) / sizeof(composite_layers[0])};
+// The points of a layer that are lit less than this belong to no layer
+static const uint8_t kLitThreshold = 32;
+// The image is redrawn at least at the rate of the previews, and also when a layer flashes
+static const uint32_t kRefreshPeriodMs = 100;
+// Time a strobe flash stays lit, at most half its period
+static const uint32_t kStrobeFlashMs = 20;
+// The clock of the flashes
+static uint32_t (*flash_clock_ms)(void) = lv_tick_get;
+
+// Where the segments of a layer go: along x or y, from start over length pixels, which is the extent of its
+// lit points. The segment at each coordinate along that axis is computed for num_segments.
+typedef struct
+{
+    bool vertical;
+    uint16_t start;
+    uint16_t length;
+    uint8_t num_segments;
+    uint8_t segment_at[TFT_HOR_RES > TFT_VER_RES ? TFT_HOR_RES : TFT_VER_RES];
+} layer_segments_t;
+static layer_segments_t layer_segments[sizeof(composite_layers) / sizeof(composite_layers[0])];
 
 //
 // Static prototypes
 //
 static void composite_image_timer_cb(lv_timer_t *timer);
-static void composite_image_update(const composite_image_dsc_t *dsc);
-
-//
-// Local variables
-//
-bool blanked_image = false;
-
+static void composite_image_update(const composite_image_dsc_t *dsc, uint32_t now_ms);
+static uint32_t layer_lit_ms(const composite_image_layer_t *layer);
+static uint32_t next_flash_ms(const composite_image_dsc_t *dsc, uint32_t now_ms);
+static void layer_segments_init(const composite_image_dsc_t *dsc, uint32_t layer_index);
+static void layer_segments_update(uint32_t layer_index, uint8_t num_segments);
 
 //
 // Global functions
@@ -60,6 +76,7 @@ lv_obj_t *composite_image_create(lv_obj_t *parent, lv_event_cb_t callback)
             LV_LOG_ERROR("Layer %lu must be in 8bit luminosity format", i);
             return NULL; // Invalid layer image
         }
+        layer_segments_init(&composite_dsc, i);
     }
     lv_obj_t *canvas_w = lv_canvas_create(parent);
     lv_memset(composite_dsc.buffer, 0, composite_dsc.background_image_dsc.header.w * composite_dsc.background_image_dsc.header.h * 3);
@@ -68,20 +85,56 @@ lv_obj_t *composite_image_create(lv_obj_t *parent, lv_event_cb_t callback)
     // Use the user data of the canvas to store the composite image descriptor
     lv_obj_set_user_data(canvas_w, (void *)&composite_dsc);
     // Create a timer to update the composite image
-    lv_timer_create(composite_image_timer_cb, 100, canvas_w);
+    lv_timer_create(composite_image_timer_cb, kRefreshPeriodMs, canvas_w);
 
-    // Register the callback if it exists
+    // Register the callback if it exists. Short clicks only, so that long presses can do something else.
     if (callback != NULL) {
         lv_obj_add_flag(canvas_w, LV_OBJ_FLAG_CLICKABLE);
-        lv_obj_add_event_cb(canvas_w, callback, LV_EVENT_CLICKED, NULL);
+        lv_obj_add_event_cb(canvas_w, callback, LV_EVENT_SHORT_CLICKED, NULL);
     }
 
     return canvas_w;
 }
 
-// Update the canvas with the composite image
-void composite_image_update(const composite_image_dsc_t *dsc)
+void composite_image_set_clock(uint32_t (*clock_ms)(void))
 {
+    flash_clock_ms = clock_ms;
+}
+
+int32_t composite_image_layer_at(lv_obj_t *canvas_w, const lv_point_t *point)
+{
+    composite_image_dsc_t *dsc = (composite_image_dsc_t *)lv_obj_get_user_data(canvas_w);
+    // Get coordinates relative to the image
+    lv_area_t coords;
+    lv_obj_get_coords(canvas_w, &coords);
+    int32_t x = point->x - coords.x1;
+    int32_t y = point->y - coords.y1;
+    if (x < 0 || y < 0 || x >= (int32_t)dsc->background_image_dsc.header.w || y >= (int32_t)dsc->background_image_dsc.header.h) {
+        return -1;
+    }
+    uint32_t layer_index = x + y * dsc->background_image_dsc.header.w;
+    int32_t brightest_layer = -1;
+    uint8_t brightest_pixel = kLitThreshold;
+    for (uint32_t i = 0; i < dsc->layer_count; i++) {
+        uint8_t layer_pixel = dsc->layers[i].image_dsc.data[layer_index];
+        if (layer_pixel > brightest_pixel) {
+            brightest_pixel = layer_pixel;
+            brightest_layer = i;
+        }
+    }
+    return brightest_layer;
+}
+
+// Update the canvas with the composite image, with the layers that are lit at a time of the clock
+void composite_image_update(const composite_image_dsc_t *dsc, uint32_t now_ms)
+{
+    bool lit[sizeof(layer_segments) / sizeof(layer_segments[0])];
+    for (uint32_t i = 0; i < dsc->layer_count; i++)
+    {
+        layer_segments_update(i, dsc->layers[i].num_segments);
+        const composite_image_layer_t *layer = &dsc->layers[i];
+        lit[i] = layer->flash == COMPOSITE_IMAGE_STEADY || now_ms % max(layer->period_ms, (uint32_t)1) < layer_lit_ms(layer);
+    }
     // For each pixel in the background image, composite the layers on top of it
     for (uint32_t y = 0; y < dsc->background_image_dsc.header.h; y++)
     {
@@ -95,12 +148,23 @@ void composite_image_update(const composite_image_dsc_t *dsc)
             for (uint32_t i = 0; i < dsc->layer_count; i++)
             {
                 composite_image_layer_t *layer = &dsc->layers[i];
+                if (!lit[i])
+                {
+                    continue;
+                }
                 // Get the pixel value from the layer image
                 uint8_t layer_pixel = layer->image_dsc.data[layer_index];
+                // The color of the segment at that point, if the layer has segments
+                lv_color_t color = layer->led_color;
+                if (layer->num_segments > 0)
+                {
+                    const layer_segments_t *segments = &layer_segments[i];
+                    color = layer->segment_colors[segments->segment_at[segments->vertical ? y : x]];
+                }
                 // Scale the layer color by the pixel value
-                r += (layer->led_color.red * layer_pixel) / 255;
-                g += (layer->led_color.green * layer_pixel) / 255;
-                b += (layer->led_color.blue * layer_pixel) / 255;
+                r += (color.red * layer_pixel) / 255;
+                g += (color.green * layer_pixel) / 255;
+                b += (color.blue * layer_pixel) / 255;
             }
             // Clamp the color values to the range [0, 255]
             if (r > 255)
@@ -126,30 +190,91 @@ static void composite_image_timer_cb(lv_timer_t *timer)
 # if LV_LOG_LEVEL <= LV_LOG_LEVEL_TRACE
     uint32_t tic = lv_tick_get();
 # endif
-    // If we are displaying the frequency slider, do not update the composite image
-    if (pattern_types[displayed_pattern_index] == IS_BED_PATTERN_STROBE ||
-        pattern_types[displayed_pattern_index] == IS_BED_PATTERN_ROTATE ||
-        pattern_types[displayed_pattern_index] == IS_BED_PATTERN_FADE ||
-        pattern_types[displayed_pattern_index] == IS_BED_PATTERN_BLINK) {
-        if (!blanked_image) {
-            const composite_image_dsc_t dark_dsc = {
-                .buffer = dsc->buffer,
-                .background_image_dsc = dsc->background_image_dsc,
-                .layers = nullptr,
-                .layer_count = 0};
-            // Generate a dark image
-            composite_image_update(&dark_dsc);
-            lv_obj_invalidate(canvas_w);
-            blanked_image = true;
-        }
-    } else{
-        blanked_image = false;
-        composite_image_update(dsc);
-        lv_obj_invalidate(canvas_w);
-    }
+    // The preview has the motion of the patterns, so the image follows it whatever the pattern. The flashes
+    // are drawn here, in step with the LEDs.
+    const uint32_t now_ms = flash_clock_ms();
+    composite_image_update(dsc, now_ms);
+    lv_obj_invalidate(canvas_w);
+    lv_timer_set_period(timer, next_flash_ms(dsc, now_ms));
 
 # if LV_LOG_LEVEL <= LV_LOG_LEVEL_TRACE
     uint32_t toc = lv_tick_get();
 # endif
     LV_LOG_TRACE("Composite image updated in %lu ms", toc - tic);
-}
\ No newline at end of file
+}
+
+// Time a flashing layer stays lit at the start of each period
+static uint32_t layer_lit_ms(const composite_image_layer_t *layer)
+{
+    const uint32_t period_ms = max(layer->period_ms, (uint32_t)1);
+    return layer->flash == COMPOSITE_IMAGE_STROBE ? min(kStrobeFlashMs, period_ms / 2) : period_ms / 2;
+}
+
+// Time until the next preview, or until a flashing layer goes on or off if that is sooner
+static uint32_t next_flash_ms(const composite_image_dsc_t *dsc, uint32_t now_ms)
+{
+    uint32_t next_ms = kRefreshPeriodMs;
+    for (uint32_t i = 0; i < dsc->layer_count; i++)
+    {
+        const composite_image_layer_t *layer = &dsc->layers[i];
+        if (layer->flash == COMPOSITE_IMAGE_STEADY)
+        {
+            continue;
+        }
+        const uint32_t period_ms = max(layer->period_ms, (uint32_t)1);
+        const uint32_t phase_ms = now_ms % period_ms;
+        const uint32_t lit_ms = layer_lit_ms(layer);
+        next_ms = min(next_ms, phase_ms < lit_ms ? lit_ms - phase_ms : period_ms - phase_ms);
+    }
+    return max(next_ms, (uint32_t)1);
+}
+
+// Find the extent of the lit points of a layer, and lay its segments along the longer side of that extent
+static void layer_segments_init(const composite_image_dsc_t *dsc, uint32_t layer_index)
+{
+    const uint32_t w = dsc->background_image_dsc.header.w;
+    const uint32_t h = dsc->background_image_dsc.header.h;
+    const uint8_t *data = dsc->layers[layer_index].image_dsc.data;
+    uint32_t x1 = w, y1 = h, x2 = 0, y2 = 0;
+    for (uint32_t y = 0; y < h; y++)
+    {
+        for (uint32_t x = 0; x < w; x++)
+        {
+            if (data[x + y * w] > kLitThreshold)
+            {
+                x1 = min(x1, x);
+                x2 = max(x2, x);
+                y1 = min(y1, y);
+                y2 = max(y2, y);
+            }
+        }
+    }
+    layer_segments_t *segments = &layer_segments[layer_index];
+    if (x1 > x2)
+    {
+        // Nothing lit, any layout does
+        x1 = x2 = y1 = y2 = 0;
+    }
+    segments->vertical = y2 - y1 > x2 - x1;
+    segments->start = segments->vertical ? y1 : x1;
+    segments->length = (segments->vertical ? y2 - y1 : x2 - x1) + 1;
+    // Computed on the first update
+    segments->num_segments = 0xFF;
+}
+
+// Compute the segment at each coordinate of a layer, when its number of segments changes
+static void layer_segments_update(uint32_t layer_index, uint8_t num_segments)
+{
+    layer_segments_t *segments = &layer_segments[layer_index];
+    if (num_segments == segments->num_segments)
+    {
+        return;
+    }
+    segments->num_segments = num_segments;
+    for (uint32_t i = 0; i < sizeof(segments->segment_at); i++)
+    {
+        const int32_t position = (int32_t)i - segments->start;
+        const int32_t segment = position * num_segments / segments->length;
+        segments->segment_at[i] = num_segments == 0 ? 0 : constrain(segment, 0, num_segments - 1);
+    }
+}
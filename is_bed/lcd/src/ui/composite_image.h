@@ -3,6 +3,20 @@
 
 #include "../lvgl.h"
 
+// Most LED segments in a layer
+#define COMPOSITE_IMAGE_MAX_SEGMENTS 16
+
+// How a layer flashes, in step with the pattern clock (see composite_image_set_clock())
+typedef enum
+{
+    // Always lit
+    COMPOSITE_IMAGE_STEADY,
+    // Lit for the first half of each period, like the blink pattern
+    COMPOSITE_IMAGE_BLINK,
+    // Lit for a moment at the start of each period, like the strobe pattern
+    COMPOSITE_IMAGE_STROBE,
+} composite_image_flash_t;
+
 // This describes a layer for a composite image
 typedef struct
 {
@@ -10,6 +24,13 @@ typedef struct
     lv_image_dsc_t image_dsc;
     // The led color associated with this layer.
     lv_color_t led_color;
+    // The colors of the LED segments of the layer, spread along the longer side of the layer.
+    // The whole layer has led_color when there are none.
+    lv_color_t segment_colors[COMPOSITE_IMAGE_MAX_SEGMENTS];
+    uint8_t num_segments;
+    // How the layer flashes, with its colors when it is lit, and the period of the flashes in ms
+    composite_image_flash_t flash;
+    uint32_t period_ms;
 } composite_image_layer_t;
 
 // This struct stores the data for a composite image
@@ -28,7 +49,13 @@ typedef struct
 // The layer for each zone
 extern composite_image_layer_t composite_layers[];
 
-// Create a composite image widget
+// Create a composite image widget. The callback is called when the image is clicked, but not long pressed.
 lv_obj_t *composite_image_create(lv_obj_t *parent, lv_event_cb_t callback);
 
+// Set the clock the flashes of the layers follow, in ms. It is the LVGL tick until then.
+void composite_image_set_clock(uint32_t (*clock_ms)(void));
+
+// Find the layer that lights a point of the screen the most. Returns -1 if no layer lights it much.
+int32_t composite_image_layer_at(lv_obj_t *canvas_w, const lv_point_t *point);
+
 #endif /*LV_COMPOSITE_IMAGE_H*/
\ No newline at end of file
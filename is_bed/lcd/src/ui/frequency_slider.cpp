@@ -11,8 +11,9 @@ uint8_t frequency = 1;
 //
 // Local variables
 //
-// The timer for pulsing the frequency display
+// The timer for pulsing the frequency display, and the clock of the pulses
 lv_timer_t *pulse_timer = NULL;
+static uint32_t (*pulse_clock_ms)(void) = lv_tick_get;
 
 //
 // Constants
@@ -27,6 +28,8 @@ static const lv_color_t kKnobColor = lv_color_hex(0xFFFFFF);
 static void slider_changed_local_cb(lv_event_t *e);
 static void pulse_timer_cb(lv_timer_t *timer);
 static void pulse_animation_cb(void *var, int32_t v);
+static void show_frequency(lv_obj_t *arc_w, uint8_t value);
+static void schedule_pulse(bool pulsing);
 
 //
 // Global functions
@@ -66,6 +69,19 @@ lv_obj_t *frequency_slider_create(lv_obj_t *parent, lv_event_cb_t slider_changed
     return arc_w;
 }
 
+void frequency_slider_set_frequency(lv_obj_t *slider_w, uint8_t value) {
+    // Invert the quadratic scale of slider_changed_local_cb()
+    float val = constrain((value / 10.0f - 0.2f) / 9.8f, 0.0f, 1.0f);
+    lv_arc_set_value(slider_w, lroundf(sqrtf(val) * 255.0f));
+    // Keep the value as given, the slider may not land exactly on it
+    show_frequency(slider_w, max(value, (uint8_t)1));
+}
+
+void frequency_slider_set_clock(uint32_t (*clock_ms)(void)) {
+    pulse_clock_ms = clock_ms;
+    schedule_pulse(false);
+}
+
 //
 // Private callbacks and helper functions
 //
@@ -76,16 +92,37 @@ static void slider_changed_local_cb(lv_event_t *e)
     // Use a quadratic scale for more precision at low frequencies
     val = powf(val, 2.0f);
     float frequency_hz = val * 9.8f + 0.2f;
-    String frequency_str = String(frequency_hz) + " Hz";
+    show_frequency(arc_w, (uint8_t) (frequency_hz * 10.0f));
+}
+
+// Show a frequency on the label and the pulse, and make it the current one
+static void show_frequency(lv_obj_t *arc_w, uint8_t value) {
+    String frequency_str = String(value / 10.0f) + " Hz";
     lv_obj_t *patch_w = lv_obj_get_child(arc_w, 0);
     lv_obj_t *text_w = lv_obj_get_child(patch_w, 0);
     lv_label_set_text(text_w, frequency_str.c_str());
-    frequency = (uint8_t) (frequency_hz * 10.0f);
-    lv_timer_set_period(pulse_timer, 10000 / frequency);
+    frequency = value;
+    schedule_pulse(false);
+}
+
+// Time the next pulse for the start of the next period on the clock. When pulsing, the pulse may come a bit
+// before the start of its period, which must not be pulsed again.
+static void schedule_pulse(bool pulsing) {
+    if (pulse_timer == NULL) {
+        return;
+    }
+    const uint32_t period_ms = 10000 / frequency;
+    uint32_t delay_ms = period_ms - pulse_clock_ms() % period_ms;
+    if (pulsing && delay_ms < period_ms / 2) {
+        delay_ms += period_ms;
+    }
+    lv_timer_set_period(pulse_timer, delay_ms);
+    lv_timer_reset(pulse_timer);
 }
 
 static void pulse_timer_cb(lv_timer_t *timer) {
     lv_obj_t *arc_w = (lv_obj_t *)lv_timer_get_user_data(timer);
+    schedule_pulse(true);
     if (lv_obj_has_flag(arc_w, LV_OBJ_FLAG_HIDDEN)) {
         return; // Do not pulse if the arc is hidden
     }
@@ -10,4 +10,11 @@ extern uint8_t frequency;
 // Create a simple slider widget
 lv_obj_t *frequency_slider_create(lv_obj_t *parent, lv_event_cb_t slider_changed_cb);
 
+// Set the frequency shown on the slider, in the same unit as frequency
+void frequency_slider_set_frequency(lv_obj_t *slider_w, uint8_t value);
+
+// Set the clock the pulses follow, in ms: they happen when a period of the frequency starts, like the flashes
+// of the strobe pattern. It is the LVGL tick until then.
+void frequency_slider_set_clock(uint32_t (*clock_ms)(void));
+
 #endif // FREQUENCY_SLIDER_H
\ No newline at end of file
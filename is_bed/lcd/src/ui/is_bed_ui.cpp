@@ -15,6 +15,15 @@
 static const uint32_t kSlidersHideDelayMs = 3000; // Time after which the sliders hide
 static const uint32_t kSlidersAnimTimeMs = 500;   // Time for the slider show/hide animation
 static const uint32_t kSlidersSpacing = 45;        // Vertical spacing between sliders
+static const uint8_t kAllZones = (1 << NUM_ZONES) - 1; // Mask of the zones being edited when all are
+static const char *kZoneNames[NUM_ZONES] = {"Cage", "Bed", "Bench", "Headboard"}; // In the order of the zones
+static const uint8_t kPhaseStep = 64;              // Phase change of each click on the phase button, a quarter cycle
+
+//
+// Global variables
+//
+zone_settings_t zone_settings[NUM_ZONES];
+uint8_t num_palettes = 1;
 
 //
 // Static prototypes
@@ -27,10 +36,18 @@ static void cancel_btn_event_cb(lv_event_t *e);
 static void off_btn_event_cb(lv_event_t *e);
 static void on_btn_event_cb(lv_event_t *e);
 static void background_clicked_cb(lv_event_t *e);
+static void background_long_pressed_cb(lv_event_t *e);
+static void palette_btn_event_cb(lv_event_t *e);
+static void phase_btn_event_cb(lv_event_t *e);
+static void diagnostics_open_cb(lv_event_t *e);
+static void diagnostics_close_cb(lv_event_t *e);
 static lv_obj_t *ok_button_create(lv_obj_t *parent);
 static lv_obj_t *cancel_button_create(lv_obj_t *parent);
 static lv_obj_t *off_button_create(lv_obj_t *parent);
 static lv_obj_t *on_button_create(lv_obj_t *parent);
+static lv_obj_t *palette_button_create(lv_obj_t *parent);
+static lv_obj_t *phase_button_create(lv_obj_t *parent);
+static lv_obj_t *diagnostics_create(lv_obj_t *parent);
 static void animate_sliders(bool show);
 static void sliders_anim_cb(void *var, int32_t v);
 static void color_changed_cb(lv_color_t color);
@@ -39,6 +56,12 @@ static void show_sliders();
 static void hide_sliders();
 static void validate_pattern();
 static void cancel_pattern();
+static void edit_zones(uint8_t zones);
+static void show_edited_zones();
+static void show_palette();
+static void show_phase();
+static bool uses_palette(uint32_t pattern_index);
+static zone_settings_t widget_settings();
 
 //
 // Static variables
@@ -60,8 +83,20 @@ static lv_obj_t *on_button_w;
 static lv_obj_t *color_selector_w;
 static lv_obj_t *frequency_slider_w;
 static lv_obj_t *no_connect_w;
+static lv_obj_t *update_progress_w;
 static lv_obj_t *dark_overlay_w;
+static lv_obj_t *palette_button_w;
+static lv_obj_t *phase_button_w;
+static lv_obj_t *edited_zones_w;
+static lv_obj_t *diagnostics_w;
+static lv_obj_t *diagnostics_label_w;
 static lv_timer_t *sliders_hide_timer = NULL;
+// The zones the widgets change, one bit per zone, and what the widgets showed at the last sync
+static uint8_t edited_zones = kAllZones;
+static zone_settings_t edited_settings;
+// The palette shown on the palette button, and the phase on the phase button
+static uint8_t edited_palette_index = 0;
+static uint8_t edited_phase = 0;
 
 
 // The encoder groups
@@ -103,6 +138,17 @@ void is_bed_ui(void) {
     pattern_slider_w = pattern_slider_create(screen_w, pattern_changed_cb, encoder_groups[0]);
     ok_btn_w = ok_button_create(screen_w);
     cancel_btn_w = cancel_button_create(screen_w);
+    palette_button_w = palette_button_create(screen_w);
+    phase_button_w = phase_button_create(screen_w);
+    // Long pressing a zone on the image edits that zone alone
+    lv_obj_add_event_cb(background_image_w, background_long_pressed_cb, LV_EVENT_LONG_PRESSED, NULL);
+    edited_zones_w = lv_label_create(screen_w);
+    lv_obj_align(edited_zones_w, LV_ALIGN_BOTTOM_MID, 0, -60);
+    lv_obj_set_style_text_font(edited_zones_w, font_normal, LV_PART_MAIN);
+    // Long pressing it shows the link diagnostics
+    lv_obj_add_flag(edited_zones_w, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_add_event_cb(edited_zones_w, diagnostics_open_cb, LV_EVENT_LONG_PRESSED, NULL);
+    show_edited_zones();
     // A dark overlay to dim the background when the brightness sliders are shown
     dark_overlay_w = lv_btn_create(screen_w);
     lv_obj_remove_style_all(dark_overlay_w);   // start from a blank slate
@@ -132,21 +178,112 @@ void is_bed_ui(void) {
     lv_obj_add_flag(off_button_w, LV_OBJ_FLAG_HIDDEN);
     lv_obj_add_flag(on_button_w, LV_OBJ_FLAG_HIDDEN);
     lv_obj_add_flag(dark_overlay_w, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_add_flag(edited_zones_w, LV_OBJ_FLAG_HIDDEN);
     // A Label to show when there is no controller connection
     no_connect_w = lv_label_create(screen_w);
     lv_obj_align(no_connect_w, LV_ALIGN_CENTER, 0, 0);
     lv_label_set_text(no_connect_w, "Waiting\nfor\nconnection");
     lv_obj_set_style_text_align(no_connect_w, LV_TEXT_ALIGN_CENTER, 0);
     lv_obj_set_style_text_font(no_connect_w, LV_FONT_DEFAULT, LV_PART_MAIN);
+    lv_obj_add_flag(no_connect_w, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_add_event_cb(no_connect_w, diagnostics_open_cb, LV_EVENT_LONG_PRESSED, NULL);
+    // A label to show the progress of pattern updates
+    update_progress_w = lv_label_create(screen_w);
+    lv_obj_align(update_progress_w, LV_ALIGN_TOP_MID, 0, 5);
+    lv_obj_set_style_text_font(update_progress_w, LV_FONT_DEFAULT, LV_PART_MAIN);
+    lv_obj_add_flag(update_progress_w, LV_OBJ_FLAG_HIDDEN);
+    // The link diagnostics, over everything else
+    diagnostics_w = diagnostics_create(screen_w);
+    // All the zones start with what the widgets show
+    edited_settings = widget_settings();
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        zone_settings[i] = edited_settings;
+    }
 }
 
 // Unhide all the widgets, when we get a connection to the controller
 void unhide_widgets() {
     lv_obj_remove_flag(background_image_w, LV_OBJ_FLAG_HIDDEN);
     lv_obj_remove_flag(pattern_slider_w, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_remove_flag(edited_zones_w, LV_OBJ_FLAG_HIDDEN);
     lv_obj_add_flag(no_connect_w, LV_OBJ_FLAG_HIDDEN);
 }
 
+void sync_zone_settings() {
+    // Only what changed is copied, so that editing all the zones keeps what differs between them
+    const zone_settings_t shown = widget_settings();
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        if (!(edited_zones & (1 << i))) {
+            continue;
+        }
+        zone_settings_t &settings = zone_settings[i];
+        if (shown.selected_pattern_index != edited_settings.selected_pattern_index) {
+            settings.selected_pattern_index = shown.selected_pattern_index;
+        }
+        if (shown.displayed_pattern_index != edited_settings.displayed_pattern_index) {
+            settings.displayed_pattern_index = shown.displayed_pattern_index;
+        }
+        if (!lv_color_eq(shown.color, edited_settings.color)) {
+            settings.color = shown.color;
+        }
+        if (shown.palette_index != edited_settings.palette_index) {
+            settings.palette_index = shown.palette_index;
+        }
+        if (shown.frequency != edited_settings.frequency) {
+            settings.frequency = shown.frequency;
+        }
+        if (shown.phase != edited_settings.phase) {
+            settings.phase = shown.phase;
+        }
+    }
+    edited_settings = shown;
+}
+
+void show_zone_settings() {
+    // The widgets show the first zone being edited
+    uint32_t zone = 0;
+    while (!(edited_zones & (1 << zone))) {
+        zone++;
+    }
+    const zone_settings_t &settings = zone_settings[zone];
+    selected_pattern_index = settings.selected_pattern_index;
+    displayed_pattern_index = settings.displayed_pattern_index;
+    edited_palette_index = settings.palette_index;
+    edited_phase = settings.phase;
+    change_color(color_selector_w, settings.color);
+    frequency_slider_set_frequency(frequency_slider_w, settings.frequency);
+    // This also shows the widgets that go with the pattern
+    pattern_slider_set_pattern(settings.displayed_pattern_index);
+    edited_settings = widget_settings();
+}
+
+// Show the progress of a pattern update
+void show_update_progress(uint8_t progress) {
+    static uint8_t shown_progress = 0xFF;
+    if (progress > 100) {
+        progress = 0xFF;
+    }
+    if (progress == shown_progress) {
+        return;
+    }
+    shown_progress = progress;
+    if (progress == 0xFF) {
+        lv_obj_add_flag(update_progress_w, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        lv_label_set_text_fmt(update_progress_w, "Updating patterns %d%%", progress);
+        lv_obj_remove_flag(update_progress_w, LV_OBJ_FLAG_HIDDEN);
+    }
+}
+
+// Show the counters of the link on the diagnostics screen
+void show_link_diagnostics(const char *text) {
+    lv_label_set_text(diagnostics_label_w, text);
+}
+
+void set_pattern_clock(uint32_t (*clock_ms)(void)) {
+    composite_image_set_clock(clock_ms);
+    frequency_slider_set_clock(clock_ms);
+}
 
 //
 // Private helper functions
@@ -217,6 +354,118 @@ static lv_obj_t *on_button_create(lv_obj_t *parent) {
     return btn_w;
 }
 
+static lv_obj_t *palette_button_create(lv_obj_t *parent) {
+    lv_obj_t *btn_w = lv_btn_create(parent);
+    lv_obj_add_event_cb(btn_w, palette_btn_event_cb, LV_EVENT_CLICKED, NULL);
+    lv_obj_set_style_bg_color(btn_w, lv_color_hex(0x505050), 0);
+    lv_obj_set_size(btn_w, 110, 35);
+    lv_obj_align(btn_w, LV_ALIGN_BOTTOM_MID, 0, -80);
+    lv_obj_t *label_w = lv_label_create(btn_w);
+    lv_obj_center(label_w);
+    lv_obj_set_style_text_font(label_w, LV_FONT_DEFAULT, LV_PART_MAIN);
+    // Only shown for the patterns that use a palette
+    lv_obj_add_flag(btn_w, LV_OBJ_FLAG_HIDDEN);
+
+    return btn_w;
+}
+
+// Shifts the cached patterns in their cycle, in the place of the palette button that they don't use
+static lv_obj_t *phase_button_create(lv_obj_t *parent) {
+    lv_obj_t *btn_w = lv_btn_create(parent);
+    lv_obj_add_event_cb(btn_w, phase_btn_event_cb, LV_EVENT_CLICKED, NULL);
+    lv_obj_set_style_bg_color(btn_w, lv_color_hex(0x505050), 0);
+    lv_obj_set_size(btn_w, 110, 35);
+    lv_obj_align(btn_w, LV_ALIGN_BOTTOM_MID, 0, -80);
+    lv_obj_t *label_w = lv_label_create(btn_w);
+    lv_obj_center(label_w);
+    lv_obj_set_style_text_font(label_w, LV_FONT_DEFAULT, LV_PART_MAIN);
+    // Only shown for the cached patterns
+    lv_obj_add_flag(btn_w, LV_OBJ_FLAG_HIDDEN);
+
+    return btn_w;
+}
+
+// The link diagnostics: a screen with the counters of the link, closed by a tap
+static lv_obj_t *diagnostics_create(lv_obj_t *parent) {
+    lv_obj_t *panel_w = lv_obj_create(parent);
+    lv_obj_set_size(panel_w, LV_PCT(100), LV_PCT(100));
+    lv_obj_set_pos(panel_w, 0, 0);
+    lv_obj_set_style_bg_color(panel_w, lv_color_black(), 0);
+    lv_obj_set_style_bg_opa(panel_w, LV_OPA_COVER, 0);
+    lv_obj_add_event_cb(panel_w, diagnostics_close_cb, LV_EVENT_CLICKED, NULL);
+    diagnostics_label_w = lv_label_create(panel_w);
+    lv_obj_align(diagnostics_label_w, LV_ALIGN_TOP_LEFT, 0, 0);
+    lv_obj_set_style_text_font(diagnostics_label_w, font_normal, LV_PART_MAIN);
+    lv_label_set_text(diagnostics_label_w, "No link counters yet");
+    lv_obj_add_flag(panel_w, LV_OBJ_FLAG_HIDDEN);
+
+    return panel_w;
+}
+
+// Edit other zones with the widgets
+static void edit_zones(uint8_t zones) {
+    // Keep what was changed for the previous zones
+    sync_zone_settings();
+    edited_zones = zones;
+    show_zone_settings();
+    show_edited_zones();
+}
+
+// Show which zones the widgets edit
+static void show_edited_zones() {
+    if (edited_zones == kAllZones) {
+        lv_label_set_text(edited_zones_w, "All zones");
+        return;
+    }
+    for (uint32_t i = 0; i < NUM_ZONES; i++) {
+        if (edited_zones & (1 << i)) {
+            lv_label_set_text(edited_zones_w, kZoneNames[i]);
+            return;
+        }
+    }
+}
+
+// Show the palette button if the displayed pattern uses a palette, and there is a choice
+static void show_palette() {
+    if (uses_palette(displayed_pattern_index) && num_palettes > 1) {
+        if (edited_palette_index >= num_palettes) {
+            edited_palette_index = 0;
+        }
+        lv_label_set_text_fmt(lv_obj_get_child(palette_button_w, 0), "Palette %d", edited_palette_index + 1);
+        lv_obj_remove_flag(palette_button_w, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        lv_obj_add_flag(palette_button_w, LV_OBJ_FLAG_HIDDEN);
+    }
+}
+
+// Show the phase button if the displayed pattern is a cached one
+static void show_phase() {
+    if (pattern_types[displayed_pattern_index] == IS_BED_PATTERN_CACHED) {
+        lv_label_set_text_fmt(lv_obj_get_child(phase_button_w, 0), "Phase %d%%", edited_phase * 100 / 256);
+        lv_obj_remove_flag(phase_button_w, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        lv_obj_add_flag(phase_button_w, LV_OBJ_FLAG_HIDDEN);
+    }
+}
+
+static bool uses_palette(uint32_t pattern_index) {
+    return pattern_types[pattern_index] == IS_BED_PATTERN_ROTATE ||
+           pattern_types[pattern_index] == IS_BED_PATTERN_FADE ||
+           pattern_types[pattern_index] == IS_BED_PATTERN_BLINK;
+}
+
+// What the widgets show
+static zone_settings_t widget_settings() {
+    zone_settings_t settings;
+    settings.selected_pattern_index = selected_pattern_index;
+    settings.displayed_pattern_index = displayed_pattern_index;
+    settings.color = selected_color;
+    settings.palette_index = edited_palette_index;
+    settings.frequency = frequency;
+    settings.phase = edited_phase;
+    return settings;
+}
+
 static void animate_sliders(bool show)
 {
     lv_anim_t a;
@@ -344,6 +593,9 @@ static void pattern_changed_cb(uint32_t pattern_index)
     } else {
         lv_obj_add_flag(frequency_slider_w, LV_OBJ_FLAG_HIDDEN);
     }
+    // And the palette and phase buttons
+    show_palette();
+    show_phase();
 }
 
 static void ok_btn_event_cb(lv_event_t *e) {
@@ -354,6 +606,24 @@ static void cancel_btn_event_cb(lv_event_t *e) {
     cancel_pattern();
 }
 
+static void palette_btn_event_cb(lv_event_t *e) {
+    edited_palette_index = (edited_palette_index + 1) % num_palettes;
+    show_palette();
+}
+
+static void phase_btn_event_cb(lv_event_t *e) {
+    edited_phase += kPhaseStep;
+    show_phase();
+}
+
+static void diagnostics_open_cb(lv_event_t *e) {
+    lv_obj_remove_flag(diagnostics_w, LV_OBJ_FLAG_HIDDEN);
+}
+
+static void diagnostics_close_cb(lv_event_t *e) {
+    lv_obj_add_flag(diagnostics_w, LV_OBJ_FLAG_HIDDEN);
+}
+
 static void off_btn_event_cb(lv_event_t *e) {
     show_sliders();
     // When the user clicks the off button, we set all brightnesses to zero
@@ -435,6 +705,23 @@ static void timer_hide_sliders_cb(lv_timer_t *timer) {
     hide_sliders();
 }
 
+static void background_long_pressed_cb(lv_event_t *e) {
+    lv_indev_t *indev = lv_indev_active();
+    if (indev == NULL) {
+        return;
+    }
+    lv_point_t point;
+    lv_indev_get_point(indev, &point);
+    // The layers are in the order of the zones. Long pressing the zone being edited, or outside of the
+    // zones, edits all the zones again.
+    int32_t layer = composite_image_layer_at(background_image_w, &point);
+    if (layer < 0 || edited_zones == (1 << layer)) {
+        edit_zones(kAllZones);
+    } else {
+        edit_zones(1 << layer);
+    }
+}
+
 static void background_clicked_cb(lv_event_t *e) {
     if (lv_obj_get_style_opa(center_brightness_w, LV_PART_MAIN) == LV_OPA_TRANSP) {
         show_sliders();
@@ -7,6 +7,7 @@ extern "C"
 #endif
 
 #include "../lvgl.h"
+#include <zones.h>
 
 #if LV_USE_GRID == 0
 #error "LV_USE_GRID needs to be enabled"
@@ -16,12 +17,49 @@ extern "C"
 #error "LV_USE_FLEX needs to be enabled"
 #endif
 
+// What a zone plays
+typedef struct {
+    // The selected pattern, and the one displayed before it is selected
+    uint32_t selected_pattern_index;
+    uint32_t displayed_pattern_index;
+    lv_color_t color;
+    uint8_t palette_index;
+    // Same unit as frequency
+    uint8_t frequency;
+    // The offset of cached patterns in their cycle, in 1/256th of the cycle
+    uint8_t phase;
+} zone_settings_t;
+
+// The settings of each zone. The widgets change those of the zones being edited, which are all of them
+// until a zone is long pressed on the image.
+extern zone_settings_t zone_settings[NUM_ZONES];
+
+// Number of palettes the zones can use
+extern uint8_t num_palettes;
+
 // Create a complete UI for the IS Bed
 void is_bed_ui(void);
 
+// Copy what changed on the widgets to the settings of the zones being edited
+void sync_zone_settings();
+
+// Show the settings of the zones being edited on the widgets, after zone_settings was changed
+void show_zone_settings();
+
 // Unhide the widgets once we have at least received one pattern from the controller
 void unhide_widgets();
 
+// Show the progress of a pattern update on the controller, in percent. Values above 100 hide it.
+void show_update_progress(uint8_t progress);
+
+// Show the counters of the link with the controller on the diagnostics screen, which opens with a long press
+// on the label of the edited zones, or on the one that waits for the connection
+void show_link_diagnostics(const char *text);
+
+// Set the clock the patterns of the controller run on, in ms, for the image and the frequency pulses to flash
+// in step with the LEDs
+void set_pattern_clock(uint32_t (*clock_ms)(void));
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -10,7 +10,7 @@ static const uint32_t kSliderSize = 45; // Size of the buttons
 //
 // Shared variables
 //
-String pattern_names[MAX_LED_PATTERNS];
+char pattern_names[MAX_LED_PATTERNS][MAX_LED_PATTERN_NAME_LENGTH + 1];
 uint8_t pattern_types[MAX_LED_PATTERNS];
 size_t num_patterns = 0;
 uint32_t displayed_pattern_index = 0;
@@ -91,7 +91,7 @@ void pattern_slider_set_pattern(uint32_t pattern_index)
     }
     displayed_pattern_index = pattern_index;
     pattern_changed_cb(displayed_pattern_index);
-    lv_label_set_text(pattern_label_w, pattern_names[displayed_pattern_index].c_str());
+    lv_label_set_text(pattern_label_w, pattern_names[displayed_pattern_index]);
 }
 
 //
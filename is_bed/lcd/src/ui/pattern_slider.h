@@ -4,11 +4,12 @@
 #include <lvgl.h>
 #include <Arduino.h>
 
+// The maximum number of LED patterns, as on the controller (see controller/src/led_pattern.h)
 #define MAX_LED_PATTERNS 64
 #define MAX_LED_PATTERN_NAME_LENGTH 32
 
-// The available LED patterns
-extern String pattern_names[MAX_LED_PATTERNS];
+// The names of the available LED patterns
+extern char pattern_names[MAX_LED_PATTERNS][MAX_LED_PATTERN_NAME_LENGTH + 1];
 extern size_t num_patterns;
 // The types of the patterns
 extern uint8_t pattern_types[MAX_LED_PATTERNS];
@@ -18,6 +18,59 @@ from pySerialTransfer import pySerialTransfer as txfer
 # Protocol constants
 NUM_ZONES = 4
 PATTERN_NAME_SIZE = 16
+UPDATE_NONE = 0xFF
+LCD_FRAME_SIZE = 10
+# In version 2, the LCD state is its frame followed by the pattern set
+LCD_V2_STATE_SIZE = LCD_FRAME_SIZE + 1
+
+# Protocol version 2: message types, sent as SerialTransfer packet IDs
+PROTOCOL_VERSION = 5
+MESSAGE_V1 = 0
+MESSAGE_HELLO = 1
+MESSAGE_CATALOG = 2
+MESSAGE_STATE = 3
+MESSAGE_PREVIEW = 4
+MESSAGE_ACK = 5
+MESSAGE_CATALOG_REQUEST = 6
+MESSAGE_PING = 7
+MESSAGE_PONG = 8
+MESSAGE_LINK_STATS = 9
+CATALOG_MAX_ENTRIES = 14
+CAPABILITY_PREVIEW = 0x01
+CAPABILITY_UPDATE_PROGRESS = 0x02
+CAPABILITY_SEGMENT_PREVIEW = 0x04
+MESSAGE_SEGMENT_PREVIEW = 10
+# The LCD follows our pattern clock with time requests, answered with the request and our time in ms
+MESSAGE_TIME_REQUEST = 11
+MESSAGE_TIME = 12
+CAPABILITY_PATTERN_CLOCK = 0x08
+TIME_REQUEST_SIZE = 5
+# Number of LED segments of each zone on the bed, for the segment preview
+ZONE_SEGMENTS = [8, 8, 4, 12]
+# (offset, size) of the fields of the LCD state and of the controller state, in the order of the bits of
+# the changed mask. In version 3, the LCD state has the settings of each zone. Version 5 adds the phase of each
+# zone, after the other fields.
+ZONE_STATE_SIZE = 9
+ZONE_STATE_FIELDS = [(0, 1), (1, 1), (2, 3), (5, 1), (6, 1), (7, 1)]
+LCD_V3_STATE_FIELDS = [(zone * ZONE_STATE_SIZE + offset, size)
+                       for zone in range(NUM_ZONES) for offset, size in ZONE_STATE_FIELDS] + [(NUM_ZONES * ZONE_STATE_SIZE, 1)]
+LCD_STATE_FIELDS = LCD_V3_STATE_FIELDS + [(zone * ZONE_STATE_SIZE + 8, 1) for zone in range(NUM_ZONES)]
+LCD_STATE_SIZE = NUM_ZONES * ZONE_STATE_SIZE + 1
+CONTROLLER_STATE_FIELDS = [(0, 1), (1, 1), (2, 1)]
+NUM_PALETTES = 8
+# In version 2, the LCD state is the version 1 LCD frame and the pattern set, and the controller state stops at
+# the pattern set
+LCD_V2_STATE_FIELDS = [(0, 1), (1, 1), (2, 1), (3, 1), (4, 1), (5, 1), (6, 3), (9, 1), (10, 1)]
+CONTROLLER_V2_STATE_FIELDS = CONTROLLER_STATE_FIELDS[:2]
+# In version 4, the messages but V1 frames and hello start with a link header: sequence number and time in ms.
+# The link counters are sent with each ping, once a second.
+LINK_HEADER_FORMAT = '<BH'
+LINK_HEADER_SIZE = 3
+PING_FORMAT = '<BI'
+PING_INTERVAL = 1.0
+LINK_STATS_FORMAT = '<IIIIIHIIIIIHHHH'
+LINK_STATS_NAMES = ['sent', 'received', 'dropped', 'duplicated', 'late', 'max_late_ms', 'crc_errors', 'frame_errors',
+                    'reconnects', 'pongs', 'pings_lost', 'rtt_last_ms', 'rtt_min_ms', 'rtt_avg_ms', 'rtt_max_ms']
 
 
 @dataclass
@@ -35,6 +88,7 @@ class ControllerToLcdFrame:
     pattern_index: int
     pattern_type: int
     zone_colors: List[ColorRGB]
+    pattern_set: int = 0  # Not in the frame, only in the catalog and the state
 
     def pack(self) -> bytes:
         """Pack the frame into bytes for serial transmission"""
@@ -50,7 +104,7 @@ class ControllerToLcdFrame:
         # Pack all zone colors (RGB)
         for color in self.zone_colors:
             data += struct.pack('BBB', color.r, color.g, color.b)
-        
+
         return data
 
 
@@ -62,11 +116,12 @@ class LcdToControllerFrame:
     zone_brightnesses: List[int]  # 4 zones, 0-100
     selected_color: ColorRGB
     frequency: int = 0  # Frerquency in Hz * 10
+    pattern_set: int = 0
 
     @staticmethod
     def unpack(data: bytes) -> 'LcdToControllerFrame':
-        """Unpack bytes into a frame structure"""
-        if len(data) != 10:
+        """Unpack a frame, or a version 2 state, which has the pattern set after the frame"""
+        if len(data) not in (LCD_FRAME_SIZE, LCD_V2_STATE_SIZE):
             raise ValueError(f"Invalid frame size: {len(data)} bytes")
         
         selected_pattern_index = struct.unpack('B', data[0:1])[0]
@@ -75,17 +130,61 @@ class LcdToControllerFrame:
         r, g, b = struct.unpack('BBB', data[6:9])
         selected_color = ColorRGB(r, g, b)
         frequency = struct.unpack('B', data[9:10])[0]
+        pattern_set = data[LCD_FRAME_SIZE] if len(data) == LCD_V2_STATE_SIZE else 0
         
         return LcdToControllerFrame(
             selected_pattern_index=selected_pattern_index,
             displayed_pattern_index=displayed_pattern_index,
             zone_brightnesses=zone_brightnesses,
             selected_color=selected_color,
-            frequency=frequency
+            frequency=frequency,
+            pattern_set=pattern_set
         )
 
 
 
+def mask_format(fields) -> str:
+    """Format of the header of the state messages: the changed mask has 32 bits for more than 16 fields"""
+    return '<BI' if len(fields) > 16 else '<BH'
+
+
+def apply_state_delta(state: bytearray, fields, data: bytes):
+    """Apply a state message to a state, and return its sequence number and changed mask"""
+    header_format = mask_format(fields)
+    offset = struct.calcsize(header_format)
+    sequence, changed = struct.unpack(header_format, data[0:offset])
+    for bit, (field_offset, size) in enumerate(fields):
+        if changed & (1 << bit):
+            state[field_offset:field_offset + size] = data[offset:offset + size]
+            offset += size
+    if offset != len(data):
+        raise ValueError(f"Invalid state message size: {len(data)} bytes")
+    return sequence, changed
+
+
+def pack_state(sequence: int, fields, state: bytes) -> bytes:
+    """Pack a state message with all the fields of a state"""
+    data = struct.pack(mask_format(fields), sequence, (1 << len(fields)) - 1)
+    for field_offset, size in fields:
+        data += state[field_offset:field_offset + size]
+    return data
+
+
+def rgb565(color: ColorRGB) -> int:
+    """Quantize a color to RGB565"""
+    return (color.r >> 3) << 11 | (color.g >> 2) << 5 | color.b >> 3
+
+
+def send_message(transfer: txfer.SerialTransfer, message_type: int, payload: bytes, link=None) -> None:
+    """Send a message with its type as the packet ID, and the link header if the LCD speaks version 4"""
+    if link is not None and link.version >= 4 and message_type not in (MESSAGE_V1, MESSAGE_HELLO):
+        payload = struct.pack(LINK_HEADER_FORMAT, link.tx_sequence, int(time.monotonic() * 1000) & 0xFFFF) + payload
+        link.tx_sequence = (link.tx_sequence + 1) % 256
+        link.sent += 1
+    transfer.tx_buff = list(payload)
+    transfer.send(len(payload), message_type)
+
+
 # Predefined patterns for testing
 PATTERNS = [
     "Rotate",
@@ -106,26 +205,119 @@ def hsv_to_rgb(h: float, s: float = 1.0, v: float = 1.0) -> ColorRGB:
     return ColorRGB(int(r * 255), int(g * 255), int(b * 255))
 
 
-def receive_lcd_status(transfer: txfer.SerialTransfer) -> None:
+class LcdLink:
+    """What the mock controller knows about the LCD"""
+    def __init__(self):
+        self.version = 1
+        self.capabilities = 0
+        self.state = bytearray(LCD_V2_STATE_SIZE)
+        # The settings of each zone, in version 3
+        self.zone_state = bytearray(LCD_STATE_SIZE)
+        # Our state message, sent until the LCD acknowledges it
+        self.sequence = 0
+        self.state_acked = False
+        # Next catalog entry to send, or None if the LCD is not waiting for the catalog
+        self.catalog_next = None
+        # Link counters (version 4), and the time of the last ping
+        self.tx_sequence = 0
+        self.rx_sequence = None
+        self.sent = 0
+        self.received = 0
+        self.dropped = 0
+        self.last_ping = 0.0
+
+    def receive_header(self, data: bytes) -> bytes:
+        """Count the link header of a message, and return its payload"""
+        sequence, _ = struct.unpack(LINK_HEADER_FORMAT, data[0:LINK_HEADER_SIZE])
+        skipped = (sequence - self.rx_sequence) % 256 if self.rx_sequence is not None else 0
+        if skipped < 128:
+            self.dropped += skipped
+            self.rx_sequence = (sequence + 1) % 256
+        self.received += 1
+        return data[LINK_HEADER_SIZE:]
+
+
+def print_lcd_status(frame: LcdToControllerFrame) -> None:
+    """Display the state of the LCD"""
+    print(f"\n{'='*60}")
+    print(f"LCD Status Received:")
+    print(f"  Selected Pattern Index: {frame.selected_pattern_index} ({PATTERNS[frame.selected_pattern_index] if frame.selected_pattern_index < len(PATTERNS) else 'Unknown'})")
+    print(f"  Displayed Pattern Index: {frame.displayed_pattern_index} ({PATTERNS[frame.displayed_pattern_index] if frame.displayed_pattern_index < len(PATTERNS) else 'Unknown'})")
+    print(f"  Zone Brightnesses:")
+    zone_names = ["Cage", "Center", "Front", "Headboard"]
+    for i, brightness in enumerate(frame.zone_brightnesses):
+        print(f"    {zone_names[i]:12s}: {brightness:3d}%")
+    print(f"  Selected Color: RGB({frame.selected_color.r}, {frame.selected_color.g}, {frame.selected_color.b})")
+    print(f"  Frequency: {frame.frequency / 10.0} Hz")
+    print(f"  Pattern Set: {frame.pattern_set}")
+    print(f"{'='*60}\n")
+
+
+def print_zone_status(state: bytes) -> None:
+    """Display the version 3 state of the LCD, with the settings of each zone"""
+    zone_names = ["Cage", "Center", "Front", "Headboard"]
+    print(f"\n{'='*60}")
+    print(f"LCD Zones Received (pattern set {state[NUM_ZONES * ZONE_STATE_SIZE]}):")
+    for i in range(NUM_ZONES):
+        selected, displayed, r, g, b, palette, frequency, brightness, phase = struct.unpack(
+            'BBBBBBBBB', state[i * ZONE_STATE_SIZE:(i + 1) * ZONE_STATE_SIZE])
+        name = PATTERNS[selected] if selected < len(PATTERNS) else 'Unknown'
+        print(f"  {zone_names[i]:10s}: pattern {selected} ({name}), displayed {displayed}, "
+              f"RGB({r}, {g}, {b}), palette {palette}, {frequency / 10.0} Hz, brightness {brightness}, phase {phase}/256")
+    print(f"{'='*60}\n")
+
+
+def receive_lcd_status(transfer: txfer.SerialTransfer, link: LcdLink) -> None:
     """Check for and display messages from the LCD"""
-    if transfer.available() == 10:
-        # Extract the data
-        data = bytes(transfer.rx_buff[:10])
-        try:
-            frame = LcdToControllerFrame.unpack(data)
-            print(f"\n{'='*60}")
-            print(f"LCD Status Received:")
-            print(f"  Selected Pattern Index: {frame.selected_pattern_index} ({PATTERNS[frame.selected_pattern_index] if frame.selected_pattern_index < len(PATTERNS) else 'Unknown'})")
-            print(f"  Displayed Pattern Index: {frame.displayed_pattern_index} ({PATTERNS[frame.displayed_pattern_index] if frame.displayed_pattern_index < len(PATTERNS) else 'Unknown'})")
-            print(f"  Zone Brightnesses:")
-            zone_names = ["Cage", "Center", "Front", "Headboard"]
-            for i, brightness in enumerate(frame.zone_brightnesses):
-                print(f"    {zone_names[i]:12s}: {brightness:3d}%")
-            print(f"  Selected Color: RGB({frame.selected_color.r}, {frame.selected_color.g}, {frame.selected_color.b})")
-            print(f"  Frequency: {frame.frequency / 10.0} Hz")
-            print(f"{'='*60}\n")
-        except Exception as e:
-            print(f"Error unpacking LCD frame: {e}")
+    size = transfer.available()
+    if not size:
+        return
+    data = bytes(transfer.rx_buff[:size])
+    message_type = transfer.id_byte
+    try:
+        if link.version >= 4 and message_type not in (MESSAGE_V1, MESSAGE_HELLO):
+            data = link.receive_header(data)
+        if message_type == MESSAGE_V1 and size in (LCD_FRAME_SIZE, LCD_V2_STATE_SIZE):
+            # The pattern set some LCDs add after their frame is ignored, like on the controller
+            link.state[:LCD_FRAME_SIZE] = data[:LCD_FRAME_SIZE]
+            print_lcd_status(LcdToControllerFrame.unpack(data[:LCD_FRAME_SIZE]))
+        elif message_type == MESSAGE_HELLO:
+            version, capabilities = struct.unpack('BB', data[0:2])
+            print(f"LCD says hello: version {version}, capabilities 0x{capabilities:02x}")
+            link.version = min(version, PROTOCOL_VERSION)
+            link.capabilities = capabilities
+            link.state_acked = False
+            link.rx_sequence = None
+            send_message(transfer, MESSAGE_HELLO,
+                         struct.pack('BB', PROTOCOL_VERSION,
+                                     CAPABILITY_PREVIEW | CAPABILITY_UPDATE_PROGRESS | CAPABILITY_PATTERN_CLOCK))
+        elif message_type == MESSAGE_STATE and link.version >= 3:
+            fields = LCD_STATE_FIELDS if link.version >= 5 else LCD_V3_STATE_FIELDS
+            sequence, changed = apply_state_delta(link.zone_state, fields, data)
+            send_message(transfer, MESSAGE_ACK, struct.pack('B', sequence), link)
+            # Heartbeats have no fields
+            if changed:
+                print_zone_status(bytes(link.zone_state))
+        elif message_type == MESSAGE_STATE:
+            sequence, changed = apply_state_delta(link.state, LCD_V2_STATE_FIELDS, data)
+            send_message(transfer, MESSAGE_ACK, struct.pack('B', sequence), link)
+            if changed:
+                print_lcd_status(LcdToControllerFrame.unpack(bytes(link.state)))
+        elif message_type == MESSAGE_ACK:
+            link.state_acked = data[0] == link.sequence
+        elif message_type == MESSAGE_CATALOG_REQUEST:
+            print(f"LCD asks for the catalog from entry {data[0]}")
+            link.catalog_next = data[0]
+        elif message_type == MESSAGE_PING:
+            send_message(transfer, MESSAGE_PONG, data, link)
+        elif message_type == MESSAGE_TIME_REQUEST:
+            send_message(transfer, MESSAGE_TIME,
+                         data[:TIME_REQUEST_SIZE] + struct.pack('<I', int(time.monotonic() * 1000) & 0xFFFFFFFF), link)
+        elif message_type == MESSAGE_LINK_STATS:
+            stats = dict(zip(LINK_STATS_NAMES, struct.unpack(LINK_STATS_FORMAT, data)))
+            print(f"LCD link counters: {stats}")
+    except Exception as e:
+        print(f"Error unpacking LCD message: {e}")
 
 
 def continuous_update_loop(transfer: txfer.SerialTransfer, update_rate: float = 0.1) -> None:
@@ -136,6 +328,7 @@ def continuous_update_loop(transfer: txfer.SerialTransfer, update_rate: float =
     print("="*60 + "\n")
     
     pattern_idx = 0
+    link = LcdLink()
     hue = 0.0  # HSV hue (0.0 to 1.0)
     hue_step = 0.005  # Small step for smooth color transitions
     
@@ -159,9 +352,44 @@ def continuous_update_loop(transfer: txfer.SerialTransfer, update_rate: float =
                 pattern_type= pattern_idx if (pattern_idx == 1 or pattern_idx == 2) else 6,
                 zone_colors=zone_colors
             )
-            payload = frame.pack()
-            transfer.tx_buff = payload
-            transfer.send(len(payload))
+            if link.version < 2:
+                send_message(transfer, MESSAGE_V1, frame.pack())
+            else:
+                # Catalog chunk if the LCD asked for it, preview, and our state until it is acknowledged
+                if link.catalog_next is not None:
+                    first = min(link.catalog_next, len(PATTERNS))
+                    count = min(len(PATTERNS) - first, CATALOG_MAX_ENTRIES)
+                    payload = struct.pack('BBBB', frame.pattern_set, len(PATTERNS), first, count)
+                    for i in range(first, first + count):
+                        pattern_type = i if (i == 1 or i == 2) else 6
+                        payload += struct.pack('B', pattern_type)
+                        payload += PATTERNS[i].encode('ascii')[:PATTERN_NAME_SIZE].ljust(PATTERN_NAME_SIZE, b'\x00')
+                    send_message(transfer, MESSAGE_CATALOG, payload, link)
+                    link.catalog_next = first + count if first + count < len(PATTERNS) else None
+                if link.capabilities & CAPABILITY_SEGMENT_PREVIEW:
+                    # A hue that runs along the segments of each zone
+                    payload = bytes(ZONE_SEGMENTS)
+                    for zone, count in enumerate(ZONE_SEGMENTS):
+                        for i in range(count):
+                            payload += struct.pack('<H', rgb565(hsv_to_rgb((hue * 10 + zone * 0.25 + i / count) % 1.0)))
+                    send_message(transfer, MESSAGE_SEGMENT_PREVIEW, payload, link)
+                else:
+                    send_message(transfer, MESSAGE_PREVIEW, b''.join(struct.pack('BBB', c.r, c.g, c.b) for c in zone_colors), link)
+                if not link.state_acked:
+                    link.sequence = (link.sequence + 1) % 256
+                    if link.version >= 3:
+                        state = pack_state(link.sequence, CONTROLLER_STATE_FIELDS,
+                                           bytes([UPDATE_NONE, frame.pattern_set, NUM_PALETTES]))
+                    else:
+                        state = pack_state(link.sequence, CONTROLLER_V2_STATE_FIELDS, bytes([UPDATE_NONE, frame.pattern_set]))
+                    send_message(transfer, MESSAGE_STATE, state, link)
+                # A ping, with our counters. The pongs are not timed.
+                if link.version >= 4 and time.monotonic() - link.last_ping >= PING_INTERVAL:
+                    link.last_ping = time.monotonic()
+                    send_message(transfer, MESSAGE_PING,
+                                 struct.pack(PING_FORMAT, 0, int(link.last_ping * 1000) & 0xFFFFFFFF), link)
+                    send_message(transfer, MESSAGE_LINK_STATS, struct.pack(
+                        LINK_STATS_FORMAT, link.sent, link.received, link.dropped, *([0] * 12)), link)
             
             # Update hue for smooth color cycling
             hue = (hue + hue_step) % 1.0
@@ -170,7 +398,7 @@ def continuous_update_loop(transfer: txfer.SerialTransfer, update_rate: float =
             print(f"Sending pattern {pattern_idx} ({PATTERNS[pattern_idx]}) ({frame.pattern_type}), hue: {hue:.2f}")
             
             # Check for incoming messages from LCD
-            receive_lcd_status(transfer)
+            receive_lcd_status(transfer, link)
             
             # Cycle through patterns periodically
             pattern_idx = (pattern_idx + 1) % len(PATTERNS)